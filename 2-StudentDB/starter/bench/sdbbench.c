@@ -0,0 +1,576 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/ptrace.h>
+
+// database include files, for the id range only
+#include "../db.h"
+
+// Benchmark driver for sdbsc, see "make bench".  Every operation is timed as
+// the user runs it, one sdbsc process per command, in a scratch directory so
+// the student.db of the caller is never touched.  Batch mode (-b) runs the
+// bulk load and a burst of finds in a single process, which shows the cost
+// of the storage without the process start up.
+//
+// The datasets cover the ids 1..size, dense holds every id and sparse every
+// SPARSE_STRIDE-th one, so its file is mostly holes.
+#define SPARSE_STRIDE   16
+#define DEF_RUNS        200     //samples of the single student commands
+#define DEF_SCAN_RUNS   20      //samples of c, p and x
+#define BATCH_FINDS     10000   //finds in the batch burst
+
+typedef struct dataset {
+    const char *name;
+    int size;                   //highest id
+    int stride;                 //distance of the ids
+} dataset_t;
+
+static const dataset_t datasets[] = {
+    { "dense 1k", 1000, 1 },
+    { "sparse 1k", 1000, SPARSE_STRIDE },
+    { "dense 100k", MAX_STD_ID, 1 },
+    { "sparse 100k", MAX_STD_ID, SPARSE_STRIDE },
+};
+
+static char sdbsc[PATH_MAX];    //absolute path of the binary under test
+static const char *engine = NULL; //-M or -U passed to sdbsc, NULL for none
+static bool count_calls = false;
+static uint32_t seed = 2463534242u;
+
+/*
+ *  rnd
+ *
+ *  xorshift32, the runs are the same from one benchmark to the next.
+ *
+ *  returns:  a pseudo random number
+ */
+static uint32_t rnd(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/*
+ *  now_ns
+ *
+ *  returns:  the monotonic clock in nanoseconds
+ */
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ *  spawn
+ *      args:   arguments of sdbsc, NULL terminated, without the program name
+ *      input:  file for stdin, NULL for /dev/null
+ *      trace:  stop the child for ptrace before sdbsc starts
+ *
+ *  Starts sdbsc with its output going to /dev/null.
+ *
+ *  returns:  pid of the child, -1 on error
+ */
+static pid_t spawn(char **args, const char *input, bool trace)
+{
+    char *argv[8];
+    int argc = 0;
+
+    argv[argc++] = sdbsc;
+    if (engine != NULL)
+    {
+        argv[argc++] = (char *)engine;
+    }
+    while (*args != NULL && argc < 7)
+    {
+        argv[argc++] = *args++;
+    }
+    argv[argc] = NULL;
+
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        return pid;
+    }
+
+    int in = open(input != NULL ? input : "/dev/null", O_RDONLY);
+    int out = open("/dev/null", O_WRONLY);
+    if (in == -1 || out == -1)
+    {
+        _exit(127);
+    }
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    if (trace)
+    {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    }
+    execv(sdbsc, argv);
+    _exit(127);
+}
+
+/*
+ *  run
+ *      args:   arguments of sdbsc, NULL terminated
+ *      input:  file for stdin, NULL for /dev/null
+ *
+ *  returns:  wall time of the command in nanoseconds, -1 if it could not be
+ *            started or was killed
+ */
+static int64_t run(char **args, const char *input)
+{
+    int status;
+
+    int64_t start = now_ns();
+    pid_t pid = spawn(args, input, false);
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) == 127)
+    {
+        return -1;
+    }
+
+    return now_ns() - start;
+}
+
+/*
+ *  run_traced
+ *      args:   arguments of sdbsc, NULL terminated
+ *      input:  file for stdin, NULL for /dev/null
+ *
+ *  Runs the command under ptrace and counts the system calls of all its
+ *  threads, every call stops the thread once on entry and once on exit.
+ *
+ *  returns:  the number of system calls, -1 on error
+ */
+static long run_traced(char **args, const char *input)
+{
+    long stops = 0;
+    int status;
+
+    pid_t child = spawn(args, input, true);
+    if (child == -1 || waitpid(child, &status, 0) == -1 || !WIFSTOPPED(status))
+    {
+        return -1;
+    }
+    ptrace(PTRACE_SETOPTIONS, child, NULL,
+           (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL));
+    ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, __WALL)) != -1)
+    {
+        if (!WIFSTOPPED(status))
+        {
+            continue; // a thread or the process exited
+        }
+
+        int sig = WSTOPSIG(status);
+        if (sig == (SIGTRAP | 0x80))
+        {
+            stops++;
+            sig = 0;
+        }
+        else if (sig == SIGTRAP || sig == SIGSTOP)
+        {
+            sig = 0; // clone events and the first stop of new threads
+        }
+        ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig);
+    }
+
+    // exit_group() does not return, so it has no exit stop
+    return (stops + 1) / 2;
+}
+
+/*
+ *  compare_ns
+ *
+ *  qsort() comparator for the latency samples.
+ */
+static int compare_ns(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ *  report
+ *      set:      name of the dataset
+ *      op:       name of the operation
+ *      samples:  wall time of every run, sorted here
+ *      n:        number of runs
+ *      ops:      operations per run, records of a batch
+ *      calls:    system calls of one run, -1 if not counted
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  one line of the report
+ */
+static void report(const char *set, const char *op, int64_t *samples, int n, int ops, long calls)
+{
+    int64_t total = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        total += samples[i];
+    }
+    qsort(samples, n, sizeof(int64_t), compare_ns);
+
+    printf("%-12s %-14s %6d %12.0f %10.3f %10.3f", set, op, n * ops,
+           total > 0 ? (double)n * ops * 1e9 / total : 0.0,
+           samples[n / 2] / 1e6, samples[(n * 99) / 100] / 1e6);
+    if (calls >= 0)
+    {
+        printf(" %10ld", calls);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/*
+ *  bench_op
+ *      set:     name of the dataset
+ *      op:      name of the operation
+ *      args:    arguments of sdbsc, NULL terminated, args[1] is rewritten
+ *               with a random id of the dataset if ids is not NULL
+ *      ids:     ids of the dataset, NULL if the command takes no id
+ *      nids:    number of ids
+ *      runs:    number of samples
+ *
+ *  Times runs commands and reports them.
+ *
+ *  returns:  0 on success, -1 if a command failed to run
+ */
+static int bench_op(const char *set, const char *op, char **args, const int *ids, int nids,
+                    int runs)
+{
+    char id[16];
+    int64_t *samples = malloc(runs * sizeof(int64_t));
+    long calls = -1;
+
+    if (samples == NULL)
+    {
+        return -1;
+    }
+    for (int i = 0; i < runs; i++)
+    {
+        if (ids != NULL)
+        {
+            snprintf(id, sizeof(id), "%d", ids[rnd() % nids]);
+            args[1] = id;
+        }
+        samples[i] = run(args, NULL);
+        if (samples[i] < 0)
+        {
+            free(samples);
+            return -1;
+        }
+    }
+    if (count_calls)
+    {
+        calls = run_traced(args, NULL);
+    }
+
+    report(set, op, samples, runs, 1, calls);
+    free(samples);
+    return 0;
+}
+
+/*
+ *  bench_batch
+ *      set:    name of the dataset
+ *      op:     name of the operation
+ *      input:  file with the batch commands
+ *      ops:    number of commands in the file
+ *
+ *  Times one sdbsc -b run.
+ *
+ *  returns:  0 on success, -1 if the command failed to run
+ */
+static int bench_batch(const char *set, const char *op, const char *input, int ops)
+{
+    char *args[] = { "-b", NULL };
+    long calls = -1;
+
+    int64_t t = run(args, input);
+    if (t < 0)
+    {
+        return -1;
+    }
+    if (count_calls)
+    {
+        calls = run_traced(args, input);
+    }
+
+    report(set, op, &t, 1, ops, calls);
+    return 0;
+}
+
+/*
+ *  write_batch
+ *      path:    file to write
+ *      ids:     ids of the dataset
+ *      nids:    number of ids
+ *      finds:   0 to write an add for every id, else the number of random
+ *               finds to write
+ *
+ *  returns:  the number of commands written, -1 on error
+ */
+static int write_batch(const char *path, const int *ids, int nids, int finds)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        return -1;
+    }
+
+    int n = (finds > 0) ? finds : nids;
+    for (int i = 0; i < n; i++)
+    {
+        if (finds > 0)
+        {
+            fprintf(f, "f %d\n", ids[rnd() % nids]);
+        }
+        else
+        {
+            fprintf(f, "a %d first%d last%d %d\n", ids[i], ids[i], ids[i],
+                    (ids[i] * 7) % (MAX_STD_GPA + 1));
+        }
+    }
+
+    return (fclose(f) == 0) ? n : -1;
+}
+
+/*
+ *  bench_dataset
+ *      set:        the dataset
+ *      runs:       samples of the single student commands
+ *      scan_runs:  samples of c, p and x
+ *
+ *  Loads the dataset into an empty database and times every operation
+ *  against it.  Delete is followed by an untimed add of the same student
+ *  and add by an untimed delete, so every sample sees the whole dataset.
+ *
+ *  returns:  0 on success, -1 if a command failed to run
+ */
+static int bench_dataset(const dataset_t *set, int runs, int scan_runs)
+{
+    char *zero[] = { "-z", NULL };
+    char *add[] = { "-a", NULL, "bench", "student", "300", NULL };
+    char *del[] = { "-d", NULL, NULL };
+    char *find[] = { "-f", NULL, NULL };
+    char *count[] = { "-c", NULL };
+    char *print[] = { "-p", NULL };
+    char *compress[] = { "-x", NULL };
+    char id[16];
+    long calls = -1;
+    int rc = -1;
+
+    int nids = set->size / set->stride;
+    int *ids = malloc(nids * sizeof(int));
+    if (ids == NULL)
+    {
+        return -1;
+    }
+    for (int i = 0; i < nids; i++)
+    {
+        ids[i] = 1 + i * set->stride;
+    }
+
+    if (run(zero, NULL) < 0 || write_batch("load.txt", ids, nids, 0) < 0 ||
+        write_batch("find.txt", ids, nids, BATCH_FINDS) < 0 ||
+        bench_batch(set->name, "load (batch)", "load.txt", nids) < 0 ||
+        bench_batch(set->name, "find (batch)", "find.txt", BATCH_FINDS) < 0 ||
+        bench_op(set->name, "find", find, ids, nids, runs) < 0)
+    {
+        free(ids);
+        return -1;
+    }
+
+    // delete a random student and put it back, the add re-creates it
+    // with the name of the load so the next samples see the same data
+    bool ok = true;
+    int64_t *samples = malloc(runs * sizeof(int64_t));
+    for (int i = 0; ok && samples != NULL && i < runs; i++)
+    {
+        int sid = ids[rnd() % nids];
+        char name[2][32];
+        char gpa[8];
+        snprintf(id, sizeof(id), "%d", sid);
+        snprintf(name[0], sizeof(name[0]), "first%d", sid);
+        snprintf(name[1], sizeof(name[1]), "last%d", sid);
+        snprintf(gpa, sizeof(gpa), "%d", (sid * 7) % (MAX_STD_GPA + 1));
+        del[1] = id;
+        char *put[] = { "-a", id, name[0], name[1], gpa, NULL };
+        samples[i] = run(del, NULL);
+        ok = samples[i] >= 0 && run(put, NULL) >= 0;
+        if (ok && count_calls && i == runs - 1)
+        {
+            calls = run_traced(del, NULL);
+            ok = run(put, NULL) >= 0;
+        }
+    }
+    if (ok && samples != NULL)
+    {
+        report(set->name, "delete", samples, runs, 1, calls);
+
+        // add into the gaps of a sparse set, a dense one is full so the
+        // add goes to a deleted slot
+        for (int i = 0; ok && i < runs; i++)
+        {
+            int sid = (set->stride > 1) ? ids[rnd() % nids] + 1 : ids[rnd() % nids];
+            snprintf(id, sizeof(id), "%d", sid);
+            del[1] = id;
+            add[1] = id;
+            ok = (set->stride > 1 || run(del, NULL) >= 0);
+            samples[i] = ok ? run(add, NULL) : -1;
+            ok = samples[i] >= 0 && run(del, NULL) >= 0;
+            if (ok && count_calls && i == runs - 1)
+            {
+                calls = run_traced(add, NULL);
+                ok = run(del, NULL) >= 0;
+            }
+        }
+        if (ok)
+        {
+            report(set->name, "add", samples, runs, 1, calls);
+        }
+    }
+    free(samples);
+
+    if (ok && bench_op(set->name, "count", count, NULL, 0, scan_runs) == 0 &&
+        bench_op(set->name, "print", print, NULL, 0, scan_runs) == 0 &&
+        bench_op(set->name, "compress", compress, NULL, 0, scan_runs) == 0)
+    {
+        rc = 0;
+    }
+
+    free(ids);
+    return rc;
+}
+
+/*
+ *  cleanup
+ *      dir:  scratch directory
+ *
+ *  Removes the scratch directory and the files in it.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void cleanup(const char *dir)
+{
+    struct dirent *ent;
+    DIR *d = opendir(dir);
+
+    while (d != NULL && (ent = readdir(d)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+        {
+            unlinkat(dirfd(d), ent->d_name, 0);
+        }
+    }
+    if (d != NULL)
+    {
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+/*
+ *  usage
+ *      exename:  name of the executable
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void usage(char *exename)
+{
+    printf("usage: %s [-M|-U] [-s] [-q] [-n runs] [sdbsc]  Where:\n", exename);
+    printf("\t-M:  benchmarks the memory mapped engine of sdbsc\n");
+    printf("\t-U:  benchmarks the io_uring engine of sdbsc\n");
+    printf("\t-s:  counts the system calls of one run of every operation\n");
+    printf("\t-q:  quick run, the 1k datasets only\n");
+    printf("\t-n runs:  samples of add, delete and find, default %d\n", DEF_RUNS);
+    printf("\tsdbsc:  the binary to benchmark, default ./sdbsc\n");
+}
+
+int main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/sdbbench.XXXXXX";
+    int runs = DEF_RUNS;
+    bool quick = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "MUsqn:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'M':
+            engine = "-M";
+            break;
+        case 'U':
+            engine = "-U";
+            break;
+        case 's':
+            count_calls = true;
+            break;
+        case 'q':
+            quick = true;
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            if (runs > 0)
+            {
+                break;
+            }
+            // fall through
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (realpath(optind < argc ? argv[optind] : "./sdbsc", sdbsc) == NULL ||
+        access(sdbsc, X_OK) != 0)
+    {
+        printf("Can not run %s, build it with make first!\n",
+               optind < argc ? argv[optind] : "./sdbsc");
+        exit(1);
+    }
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0)
+    {
+        printf("Can not create the scratch directory %s!\n", dir);
+        exit(1);
+    }
+
+    printf("%-12s %-14s %6s %12s %10s %10s%s\n", "DATASET", "OPERATION", "OPS", "OPS/SEC",
+           "P50 MS", "P99 MS", count_calls ? "   SYSCALLS" : "");
+    int rc = 0;
+    int nsets = quick ? 2 : (int)(sizeof(datasets) / sizeof(datasets[0]));
+    for (int i = 0; rc == 0 && i < nsets; i++)
+    {
+        int scan_runs = (runs < DEF_SCAN_RUNS) ? runs : DEF_SCAN_RUNS;
+        rc = bench_dataset(&datasets[i], runs, scan_runs);
+        if (rc != 0)
+        {
+            printf("Running %s failed on the %s dataset!\n", sdbsc, datasets[i].name);
+        }
+    }
+
+    cleanup(dir);
+    return (rc == 0) ? 0 : 1;
+}
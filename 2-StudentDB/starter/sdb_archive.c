@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h> //c library for system call file routines
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Compressed archive of the database for cold data.  The students are
+// sorted by id and cut into blocks of ARCHIVE_BLOCK bytes, every block is
+// compressed on its own with the LZ codec of sdb_lz.c.  The file is
+//
+//      archive_header_t | archive_block_t[nblocks] | compressed blocks
+//
+// and the block index holds the id range of every block, so a lookup
+// decompresses the one block that can hold the id and a scan decompresses
+// each block once, in order.
+static char *arc = NULL;                // mapped archive, NULL if not open
+static size_t arc_len;                  // bytes in the archive
+static const archive_header_t *arc_hdr; // header at the start of arc
+static const archive_block_t *arc_idx;  // block index after the header
+
+// The last block decompressed, scans and lookups in id order reuse it
+static student_t arc_block[ARCHIVE_BLOCK_RECORDS];
+static int arc_block_no = -1;           // index of the block, -1 if none
+
+/*
+ *  archive_path
+ *      path:    buffer for the file name
+ *      len:     size of path
+ *      dbFile:  name of the database file
+ *      tmp:     name of the file the archive is written to before the rename
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void archive_path(char *path, size_t len, char *dbFile, bool tmp)
+{
+    snprintf(path, len, "%s%s%s", dbFile, ARCHIVE_SUFFIX, tmp ? ".tmp" : "");
+}
+
+/*
+ *  archive_collect
+ *      db_fd:   linux file descriptor of the database
+ *      *count:  set to the number of students
+ *
+ *  Collects the students of the database sorted by id.  A packed legacy file
+ *  can hold an id twice, like a lookup the archive keeps the first one.
+ *
+ *  returns:  malloc()ed array of the students, NULL on error
+ */
+static student_t *archive_collect(int db_fd, int *count)
+{
+    db_scan_t scan;
+    const student_t *student;
+    int rc;
+
+    id_table_t taken;
+    size_t cap = 1024;
+    student_t *students = malloc(cap * sizeof(student_t));
+    if (idtab_init(&taken, db_max_id(db_fd), sizeof(bool)) != NO_ERROR || students == NULL ||
+        db_scan_open(&scan, db_fd) != NO_ERROR)
+    {
+        idtab_free(&taken);
+        free(students);
+        return NULL;
+    }
+
+    *count = 0;
+    while ((rc = db_scan_next(&scan, &student)) > 0)
+    {
+        if (student->id < MIN_STD_ID || student->id > taken.max_id)
+        {
+            continue;
+        }
+        bool *seen = idtab_put(&taken, student->id);
+        if (seen == NULL)
+        {
+            rc = -1;
+            break;
+        }
+        if (*seen)
+        {
+            continue;
+        }
+        if ((size_t)*count == cap)
+        {
+            student_t *grown = realloc(students, 2 * cap * sizeof(student_t));
+            if (grown == NULL)
+            {
+                rc = -1;
+                break;
+            }
+            students = grown;
+            cap *= 2;
+        }
+        *seen = true;
+        students[(*count)++] = *student;
+    }
+    db_scan_close(&scan);
+    idtab_free(&taken);
+
+    if (rc < 0)
+    {
+        free(students);
+        return NULL;
+    }
+    qsort(students, *count, sizeof(student_t), compare_student_id);
+    return students;
+}
+
+/*
+ *  archive_write
+ *      dbFile:  name of the database file, the archive is dbFile ARCHIVE_SUFFIX
+ *      db_fd:   linux file descriptor of the database
+ *
+ *  Writes the compressed archive of the database.  The blocks are
+ *  compressed into memory first, so the header and the block index can
+ *  lead the file, which is written under a temporary name and renamed
+ *  into place.
+ *
+ *  returns:  <number>       number of students in the archive
+ *            ERR_DB_FILE    database or archive file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int archive_write(char *dbFile, int db_fd)
+{
+    char path[256];
+    char tmp[256];
+    int count;
+
+    student_t *students = archive_collect(db_fd, &count);
+    if (students == NULL)
+    {
+        return ERR_DB_FILE;
+    }
+
+    uint32_t nblocks = (count + ARCHIVE_BLOCK_RECORDS - 1) / ARCHIVE_BLOCK_RECORDS;
+    size_t data_at = sizeof(archive_header_t) + nblocks * sizeof(archive_block_t);
+    size_t cap = data_at + nblocks * LZ_BOUND(ARCHIVE_BLOCK);
+    char *out = malloc(cap);
+    if (out == NULL)
+    {
+        free(students);
+        return ERR_DB_FILE;
+    }
+
+    archive_header_t *hdr = (archive_header_t *)out;
+    archive_block_t *idx = (archive_block_t *)(out + sizeof(archive_header_t));
+    memset(hdr, 0, sizeof(archive_header_t));
+    hdr->magic = ARCHIVE_MAGIC;
+    hdr->count = count;
+    hdr->nblocks = nblocks;
+
+    size_t len = data_at;
+    for (uint32_t b = 0; b < nblocks; b++)
+    {
+        const student_t *first = &students[b * ARCHIVE_BLOCK_RECORDS];
+        int n = count - b * ARCHIVE_BLOCK_RECORDS;
+        if (n > ARCHIVE_BLOCK_RECORDS)
+        {
+            n = ARCHIVE_BLOCK_RECORDS;
+        }
+
+        idx[b].first_id = first[0].id;
+        idx[b].last_id = first[n - 1].id;
+        idx[b].offset = len;
+        idx[b].nrecords = n;
+        idx[b].clen = lz_compress((const unsigned char *)first, n * sizeof(student_t),
+                                  (unsigned char *)out + len);
+        len += idx[b].clen;
+    }
+    free(students);
+
+    archive_path(path, sizeof(path), dbFile, false);
+    archive_path(tmp, sizeof(tmp), dbFile, true);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    bool ok = (fd != -1) && write(fd, out, len) == (ssize_t)len && fsync(fd) == 0;
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    free(out);
+
+    if (!ok || rename(tmp, path) == -1)
+    {
+        unlink(tmp);
+        return ERR_DB_FILE;
+    }
+
+    return count;
+}
+
+/*
+ *  archive_open
+ *      dbFile:  name of the database file the archive was written from
+ *
+ *  Maps the archive for reading.  The header and the block index are
+ *  checked here, each block when it is decompressed.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the archive is missing or damaged
+ *
+ *  console:  Does not produce any console I/O
+ */
+int archive_open(char *dbFile)
+{
+    char path[256];
+    struct stat st;
+
+    archive_path(path, sizeof(path), dbFile, false);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return ERR_DB_FILE;
+    }
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(archive_header_t))
+    {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    arc = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (arc == MAP_FAILED)
+    {
+        arc = NULL;
+        return ERR_DB_FILE;
+    }
+    arc_len = st.st_size;
+    arc_hdr = (const archive_header_t *)arc;
+    arc_idx = (const archive_block_t *)(arc + sizeof(archive_header_t));
+    arc_block_no = -1;
+
+    if (arc_hdr->magic != ARCHIVE_MAGIC ||
+        arc_hdr->nblocks > (arc_len - sizeof(archive_header_t)) / sizeof(archive_block_t))
+    {
+        archive_close();
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  archive_close
+ *
+ *  Unmaps the archive, harmless if it is not open.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void archive_close(void)
+{
+    if (arc != NULL)
+    {
+        munmap(arc, arc_len);
+    }
+    arc = NULL;
+    arc_len = 0;
+    arc_block_no = -1;
+}
+
+/*
+ *  archive_count
+ *
+ *  returns:  number of students in the archive
+ */
+int archive_count(void)
+{
+    return arc_hdr->count;
+}
+
+/*
+ *  archive_load
+ *      b:  index of the block
+ *
+ *  Decompresses block b into arc_block, unless it is already there.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the block is damaged
+ */
+static int archive_load(uint32_t b)
+{
+    const archive_block_t *blk = &arc_idx[b];
+
+    if ((int)b == arc_block_no)
+    {
+        return NO_ERROR;
+    }
+    arc_block_no = -1;
+
+    if (blk->nrecords == 0 || blk->nrecords > ARCHIVE_BLOCK_RECORDS ||
+        blk->offset > arc_len || blk->clen > arc_len - blk->offset)
+    {
+        return ERR_DB_FILE;
+    }
+    ssize_t len = lz_decompress((const unsigned char *)arc + blk->offset, blk->clen,
+                                (unsigned char *)arc_block, sizeof(arc_block));
+    if (len != (ssize_t)(blk->nrecords * sizeof(student_t)))
+    {
+        return ERR_DB_FILE;
+    }
+
+    arc_block_no = b;
+    return NO_ERROR;
+}
+
+/*
+ *  archive_find_block
+ *      id:  student id
+ *
+ *  Binary search of the block index.
+ *
+ *  returns:  the first block whose ids reach id, nblocks if there is none
+ */
+static uint32_t archive_find_block(int id)
+{
+    uint32_t lo = 0;
+    uint32_t hi = arc_hdr->nblocks;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (arc_idx[mid].last_id < id)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ *  archive_next
+ *      id:  first id to look at
+ *
+ *  returns:  the smallest id >= id with a student
+ *            SRCH_NOT_FOUND there is none
+ *            ERR_DB_FILE    the block that holds it is damaged
+ */
+int archive_next(int id)
+{
+    uint32_t b = archive_find_block(id);
+    if (b == arc_hdr->nblocks)
+    {
+        return SRCH_NOT_FOUND;
+    }
+    if (archive_load(b) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < arc_idx[b].nrecords; i++)
+    {
+        if (arc_block[i].id >= id)
+        {
+            return arc_block[i].id;
+        }
+    }
+
+    return ERR_DB_FILE; // the block does not hold its id range
+}
+
+/*
+ *  archive_get
+ *      id:  student id
+ *      *s:  set to the student
+ *
+ *  Decompresses the one block whose id range holds id.
+ *
+ *  returns:  NO_ERROR       student found
+ *            SRCH_NOT_FOUND no student with this id
+ *            ERR_DB_FILE    the block is damaged
+ */
+int archive_get(int id, student_t *s)
+{
+    uint32_t b = archive_find_block(id);
+    if (b == arc_hdr->nblocks || arc_idx[b].first_id > id)
+    {
+        return SRCH_NOT_FOUND;
+    }
+    if (archive_load(b) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < arc_idx[b].nrecords; i++)
+    {
+        if (arc_block[i].id == id)
+        {
+            *s = arc_block[i];
+            return NO_ERROR;
+        }
+    }
+
+    return SRCH_NOT_FOUND;
+}
+
+/*
+ *  archive_histogram
+ *      hist:  MAX_STD_GPA + 1 counters, zeroed by the caller
+ *
+ *  Counts the students per GPA, decompressing the blocks one at a time.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    a block is damaged
+ */
+int archive_histogram(int *hist)
+{
+    for (uint32_t b = 0; b < arc_hdr->nblocks; b++)
+    {
+        if (archive_load(b) != NO_ERROR)
+        {
+            return ERR_DB_FILE;
+        }
+        for (int i = 0; i < arc_idx[b].nrecords; i++)
+        {
+            if (arc_block[i].gpa >= MIN_STD_GPA && arc_block[i].gpa <= MAX_STD_GPA)
+            {
+                hist[arc_block[i].gpa]++;
+            }
+        }
+    }
+
+    return NO_ERROR;
+}
+
+// The archive as a read only copy for -A, see run_copy()
+const copy_ops_t archive_copy = {
+    archive_write, archive_open, archive_close, archive_count,
+    archive_next, archive_get, archive_histogram,
+    M_ARCHIVE_WRITTEN, M_ARCHIVE_LOADED, M_ERR_ARCHIVE,
+};
@@ -0,0 +1,459 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h> //c library for system call file routines
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Compact copy of the database.  Every id slot is a 12 byte hot record
+// with the id, the gpa and the offset of the names in a heap file, where
+// the first and the last name are stored NUL terminated without padding.
+// Slot 0 is never a student, it holds the magic, the student count and the
+// size of the heap.  The hot file is positional like the database, so a
+// lookup is one slot, and scans over ids and GPAs read 12 instead of 64
+// bytes per student.
+//
+// The copy is written from the database by compact_write() and read back
+// through a read only mapping, see compact_open().
+static compact_record_t *hot = NULL; // mapped hot file, NULL if not open
+static size_t hot_slots;             // records in the hot file
+static char *heap = NULL;            // mapped heap file, NULL if empty
+static size_t heap_len;              // bytes in the heap file
+
+/*
+ *  compact_path
+ *      path:    buffer for the file name
+ *      len:     size of path
+ *      dbFile:  name of the database file
+ *      suffix:  COMPACT_HOT_SUFFIX or COMPACT_HEAP_SUFFIX
+ *      tmp:     name of the file the copy is written to before the rename
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void compact_path(char *path, size_t len, char *dbFile, const char *suffix, bool tmp)
+{
+    snprintf(path, len, "%s%s%s", dbFile, suffix, tmp ? ".tmp" : "");
+}
+
+/*
+ *  compact_write_heap
+ *      path:    name of the heap file to write
+ *      db_fd:   linux file descriptor of the database
+ *      *slots:  empty table of hot records, filled by this function
+ *      *count:  set to the number of students
+ *
+ *  Scans the database once, appends the names of every student to the heap
+ *  and fills its hot record.  A packed legacy file can hold an id twice,
+ *  like a lookup the copy keeps the first one.
+ *
+ *  returns:  <number>       size of the heap
+ *            ERR_DB_FILE    database or heap file I/O issue
+ */
+static int64_t compact_write_heap(char *path, int db_fd, id_table_t *slots, int *count)
+{
+    db_scan_t scan;
+    const student_t *student;
+    uint32_t len = 0;
+    int rc;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    FILE *out = (fd == -1) ? NULL : fdopen(fd, "w");
+    if (out == NULL)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return ERR_DB_FILE;
+    }
+    if (db_scan_open(&scan, db_fd) != NO_ERROR)
+    {
+        fclose(out);
+        return ERR_DB_FILE;
+    }
+
+    *count = 0;
+    while ((rc = db_scan_next(&scan, &student)) > 0)
+    {
+        int id = student->id;
+        if (id < MIN_STD_ID || id > slots->max_id)
+        {
+            continue;
+        }
+        compact_record_t *slot = idtab_put(slots, id);
+        if (slot == NULL)
+        {
+            rc = -1;
+            break;
+        }
+        if (slot->id != DELETED_STUDENT_ID)
+        {
+            continue;
+        }
+
+        size_t flen = strnlen(student->fname, sizeof(student->fname));
+        size_t llen = strnlen(student->lname, sizeof(student->lname));
+        slot->id = id;
+        slot->gpa = student->gpa;
+        slot->name_off = len;
+        fwrite(student->fname, 1, flen, out);
+        fputc('\0', out);
+        fwrite(student->lname, 1, llen, out);
+        fputc('\0', out);
+        len += flen + llen + 2;
+        (*count)++;
+    }
+    db_scan_close(&scan);
+
+    if (fflush(out) != 0 || fsync(fileno(out)) == -1)
+    {
+        rc = -1;
+    }
+    if (fclose(out) != 0 || rc < 0)
+    {
+        return ERR_DB_FILE;
+    }
+
+    return len;
+}
+
+/*
+ *  compact_write_hot
+ *      path:    name of the hot file to write
+ *      slots:   table of hot records, slot 0 is the header
+ *
+ *  Writes each run of used slots with one positional write, the file is
+ *  sized up front so empty runs and chunks of the table that were never
+ *  used stay holes.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    hot file I/O issue
+ */
+static int compact_write_hot(char *path, const id_table_t *slots)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    int last = 0;
+    for (int i = idtab_next(slots, 0); i >= 0; i = idtab_next(slots, i + 1))
+    {
+        const compact_record_t *slot = idtab_get(slots, i);
+        if (slot->id != DELETED_STUDENT_ID)
+        {
+            last = i;
+        }
+    }
+
+    // A run ends with its chunk, the next chunk is elsewhere in memory
+    int rc = (ftruncate(fd, (off_t)(last + 1) * sizeof(compact_record_t)) == -1) ? ERR_DB_FILE : NO_ERROR;
+    for (int i = idtab_next(slots, 0); i >= 0 && i <= last && rc == NO_ERROR;)
+    {
+        const compact_record_t *slot = idtab_get(slots, i);
+        if (slot->id == DELETED_STUDENT_ID)
+        {
+            i = idtab_next(slots, i + 1);
+            continue;
+        }
+
+        int run = 1;
+        while (i + run <= last && (i + run) % IDTAB_CHUNK != 0 && slot[run].id != DELETED_STUDENT_ID)
+        {
+            run++;
+        }
+        size_t len = run * sizeof(compact_record_t);
+        if (pwrite(fd, slot, len, (off_t)i * sizeof(compact_record_t)) != (ssize_t)len)
+        {
+            rc = ERR_DB_FILE;
+        }
+        i = idtab_next(slots, i + run);
+    }
+
+    if (rc == NO_ERROR && fsync(fd) == -1)
+    {
+        rc = ERR_DB_FILE;
+    }
+    close(fd);
+    return rc;
+}
+
+/*
+ *  compact_write
+ *      dbFile:  name of the database file, the copy is dbFile COMPACT_HOT_SUFFIX
+ *               and dbFile COMPACT_HEAP_SUFFIX
+ *      db_fd:   linux file descriptor of the database
+ *
+ *  Migrates the database into the compact format.  Both files are written
+ *  under temporary names and renamed into place, the heap first.  A reader
+ *  that opens the copy between the renames finds the heap size in the hot
+ *  header wrong and refuses the copy.
+ *
+ *  returns:  <number>       number of students in the copy
+ *            ERR_DB_FILE    database or compact file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int compact_write(char *dbFile, int db_fd)
+{
+    char hot_path[256];
+    char heap_path[256];
+    char hot_tmp[256];
+    char heap_tmp[256];
+    int count;
+
+    compact_path(hot_path, sizeof(hot_path), dbFile, COMPACT_HOT_SUFFIX, false);
+    compact_path(heap_path, sizeof(heap_path), dbFile, COMPACT_HEAP_SUFFIX, false);
+    compact_path(hot_tmp, sizeof(hot_tmp), dbFile, COMPACT_HOT_SUFFIX, true);
+    compact_path(heap_tmp, sizeof(heap_tmp), dbFile, COMPACT_HEAP_SUFFIX, true);
+
+    id_table_t slots;
+    compact_record_t *header = NULL;
+    if (idtab_init(&slots, db_max_id(db_fd), sizeof(compact_record_t)) == NO_ERROR)
+    {
+        header = idtab_put(&slots, 0);
+    }
+    if (header == NULL)
+    {
+        idtab_free(&slots);
+        return ERR_DB_FILE;
+    }
+
+    int64_t len = compact_write_heap(heap_tmp, db_fd, &slots, &count);
+    int rc = (len < 0) ? ERR_DB_FILE : NO_ERROR;
+    if (rc == NO_ERROR)
+    {
+        header->id = COMPACT_MAGIC;
+        header->gpa = count;
+        header->name_off = len;
+        rc = compact_write_hot(hot_tmp, &slots);
+    }
+    idtab_free(&slots);
+
+    if (rc != NO_ERROR || rename(heap_tmp, heap_path) == -1 || rename(hot_tmp, hot_path) == -1)
+    {
+        unlink(heap_tmp);
+        unlink(hot_tmp);
+        return ERR_DB_FILE;
+    }
+
+    return count;
+}
+
+/*
+ *  compact_map
+ *      path:  name of the file to map
+ *      *len:  set to the size of the file
+ *
+ *  returns:  read only mapping of the whole file, NULL if it is empty or
+ *            on error, *len tells the two apart
+ */
+static void *compact_map(char *path, size_t *len)
+{
+    struct stat st;
+    void *map = NULL;
+
+    *len = (size_t)-1;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0)
+    {
+        *len = st.st_size;
+        if (st.st_size > 0)
+        {
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED)
+            {
+                map = NULL;
+                *len = (size_t)-1;
+            }
+        }
+    }
+    close(fd);
+
+    return map;
+}
+
+/*
+ *  compact_open
+ *      dbFile:  name of the database file the copy was written from
+ *
+ *  Maps the compact copy for reading.  The copy is only used when the hot
+ *  file starts with COMPACT_MAGIC and the heap has the size recorded in it.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the copy is missing or damaged
+ *
+ *  console:  Does not produce any console I/O
+ */
+int compact_open(char *dbFile)
+{
+    char path[256];
+    size_t hot_len;
+
+    compact_path(path, sizeof(path), dbFile, COMPACT_HOT_SUFFIX, false);
+    hot = compact_map(path, &hot_len);
+    compact_path(path, sizeof(path), dbFile, COMPACT_HEAP_SUFFIX, false);
+    heap = compact_map(path, &heap_len);
+
+    if (hot == NULL || hot_len % sizeof(compact_record_t) != 0 || hot[0].id != COMPACT_MAGIC ||
+        heap_len == (size_t)-1 || hot[0].name_off != heap_len)
+    {
+        compact_close();
+        return ERR_DB_FILE;
+    }
+    hot_slots = hot_len / sizeof(compact_record_t);
+
+    return NO_ERROR;
+}
+
+/*
+ *  compact_close
+ *
+ *  Unmaps the compact copy, harmless if it is not open.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void compact_close(void)
+{
+    if (hot != NULL)
+    {
+        munmap(hot, hot_slots * sizeof(compact_record_t));
+    }
+    if (heap != NULL)
+    {
+        munmap(heap, heap_len);
+    }
+    hot = NULL;
+    heap = NULL;
+    hot_slots = 0;
+    heap_len = 0;
+}
+
+/*
+ *  compact_count
+ *
+ *  returns:  number of students in the compact copy
+ */
+int compact_count(void)
+{
+    return hot[0].gpa;
+}
+
+/*
+ *  compact_next
+ *      id:  first id to look at
+ *
+ *  returns:  the smallest id >= id with a student
+ *            SRCH_NOT_FOUND there is none
+ */
+int compact_next(int id)
+{
+    if (id < MIN_STD_ID)
+    {
+        id = MIN_STD_ID;
+    }
+    for (; (size_t)id < hot_slots; id++)
+    {
+        if (hot[id].id == id)
+        {
+            return id;
+        }
+    }
+
+    return SRCH_NOT_FOUND;
+}
+
+/*
+ *  compact_name
+ *      off:   heap offset of the name
+ *      dest:  field the name is copied to, zeroed by the caller
+ *      size:  size of dest
+ *
+ *  returns:  heap offset past the NUL of the name, 0 if the name does not
+ *            fit dest or runs past the end of the heap
+ */
+static size_t compact_name(size_t off, char *dest, size_t size)
+{
+    if (off >= heap_len)
+    {
+        return 0;
+    }
+
+    const char *end = memchr(heap + off, '\0', heap_len - off);
+    size_t len = (end == NULL) ? size + 1 : (size_t)(end - (heap + off));
+    if (len > size)
+    {
+        return 0;
+    }
+    memcpy(dest, heap + off, len);
+
+    return off + len + 1;
+}
+
+/*
+ *  compact_get
+ *      id:  student id
+ *      *s:  set to the student, rebuilt as a 64 byte record
+ *
+ *  returns:  NO_ERROR       student found
+ *            SRCH_NOT_FOUND no student with this id
+ *            ERR_DB_FILE    the names of the student are damaged
+ */
+int compact_get(int id, student_t *s)
+{
+    if (id < MIN_STD_ID || (size_t)id >= hot_slots || hot[id].id != id)
+    {
+        return SRCH_NOT_FOUND;
+    }
+
+    memset(s, 0, sizeof(student_t));
+    s->id = id;
+    s->gpa = hot[id].gpa;
+    size_t off = compact_name(hot[id].name_off, s->fname, sizeof(s->fname));
+    if (off == 0 || compact_name(off, s->lname, sizeof(s->lname)) == 0)
+    {
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  compact_histogram
+ *      hist:  MAX_STD_GPA + 1 counters, zeroed by the caller
+ *
+ *  Counts the students per GPA, only the hot records are read.
+ *
+ *  returns:  NO_ERROR       this never fails
+ */
+int compact_histogram(int *hist)
+{
+    for (size_t i = MIN_STD_ID; i < hot_slots; i++)
+    {
+        if ((size_t)hot[i].id == i && hot[i].gpa >= MIN_STD_GPA && hot[i].gpa <= MAX_STD_GPA)
+        {
+            hist[hot[i].gpa]++;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+// The compact copy as a read only copy for -K, see run_copy()
+const copy_ops_t compact_copy = {
+    compact_write, compact_open, compact_close, compact_count,
+    compact_next, compact_get, compact_histogram,
+    M_COMPACT_WRITTEN, M_COMPACT_LOADED, M_ERR_COMPACT,
+};
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// CRC32C (Castagnoli) of the record checksums, see sum_open() in
+// sdb_index.c.  x86-64 CPUs with SSE4.2 have an instruction for it that
+// folds 8 bytes per step, the program checks for it at run time and
+// otherwise uses a table driven version of the same polynomial.
+#define CRC32C_POLY 0x82f63b78  // reflected Castagnoli polynomial
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+/*
+ *  crc_make_table
+ *
+ *  pthread_once() routine, fills crc_table for crc32c_table().
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void crc_make_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crc_table[i] = crc;
+    }
+}
+
+/*
+ *  crc32c_table
+ *      crc:  running CRC, inverted
+ *      p:    bytes to add
+ *      len:  number of bytes
+ *
+ *  returns:  the updated running CRC
+ */
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *p, size_t len)
+{
+    pthread_once(&crc_table_once, crc_make_table);
+    while (len-- > 0)
+    {
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+/*
+ *  crc32c_sse42
+ *
+ *  crc32c_table() with the SSE4.2 crc32 instruction, 8 bytes at a time.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64 = crc;
+
+    while (len >= sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += sizeof(word);
+        len -= sizeof(word);
+    }
+    crc = (uint32_t)crc64;
+    while (len-- > 0)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+
+    return crc;
+}
+#endif
+
+/*
+ *  crc32c
+ *      buf:  bytes to checksum
+ *      len:  number of bytes
+ *
+ *  returns:  the CRC32C of the bytes
+ */
+uint32_t crc32c(const void *buf, size_t len)
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return ~crc32c_sse42(~0u, buf, len);
+    }
+#endif
+
+    return ~crc32c_table(~0u, buf, len);
+}
+
+/*
+ *  student_sum
+ *      s:  student record
+ *
+ *  returns:  the checksum of the record as it is kept in the sidecar
+ */
+uint32_t student_sum(const student_t *s)
+{
+    return crc32c(s, sizeof(student_t));
+}
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Tables with an entry per student id.  A segmented database takes ids up
+// to SEG_MAX_STD_ID, far too many for a dense array per scan, so the ids
+// are cut into chunks of IDTAB_CHUNK like the segments, and a chunk is only
+// allocated once an id in it is used.  Memory follows the students that
+// exist, not the id range.
+//
+// Chunks are published with an atomic compare and swap, threads of a
+// parallel scan can fill one table together.
+
+/*
+ *  idtab_init
+ *      *t:          table to set up
+ *      max_id:      largest id the table takes
+ *      entry_size:  bytes per id, the entries start zeroed
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    out of memory
+ */
+int idtab_init(id_table_t *t, int max_id, size_t entry_size)
+{
+    t->max_id = max_id;
+    t->entry_size = entry_size;
+    t->nchunks = max_id / IDTAB_CHUNK + 1;
+    t->chunks = calloc(t->nchunks, sizeof(char *));
+
+    return (t->chunks == NULL) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  idtab_free
+ *      *t:  table set up with idtab_init()
+ *
+ *  returns:  nothing, this is a void function
+ */
+void idtab_free(id_table_t *t)
+{
+    for (int i = 0; t->chunks != NULL && i < t->nchunks; i++)
+    {
+        free(t->chunks[i]);
+    }
+    free(t->chunks);
+    t->chunks = NULL;
+    t->nchunks = 0;
+}
+
+/*
+ *  idtab_get
+ *      *t:  the table
+ *      id:  student id
+ *
+ *  returns:  the entry of id, NULL if it is out of range or nothing in
+ *            its chunk was ever set, so the entry reads as zero
+ */
+void *idtab_get(const id_table_t *t, int id)
+{
+    if (id < 0 || id > t->max_id)
+    {
+        return NULL;
+    }
+
+    char *chunk = __atomic_load_n(&t->chunks[id / IDTAB_CHUNK], __ATOMIC_ACQUIRE);
+    return (chunk == NULL) ? NULL : chunk + (size_t)(id % IDTAB_CHUNK) * t->entry_size;
+}
+
+/*
+ *  idtab_put
+ *      *t:  the table
+ *      id:  student id
+ *
+ *  Allocates the chunk of id if needed.
+ *
+ *  returns:  the entry of id, NULL if it is out of range or out of memory
+ */
+void *idtab_put(id_table_t *t, int id)
+{
+    if (id < 0 || id > t->max_id)
+    {
+        return NULL;
+    }
+
+    char **slot = &t->chunks[id / IDTAB_CHUNK];
+    char *chunk = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (chunk == NULL)
+    {
+        char *fresh = calloc(IDTAB_CHUNK, t->entry_size);
+        if (fresh == NULL)
+        {
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(slot, &chunk, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            chunk = fresh;
+        }
+        else
+        {
+            free(fresh); // another thread was first, chunk is its chunk
+        }
+    }
+
+    return chunk + (size_t)(id % IDTAB_CHUNK) * t->entry_size;
+}
+
+/*
+ *  idtab_next
+ *      *t:  the table
+ *      id:  first id to consider
+ *
+ *  Skips the chunks that were never allocated, so a walk over the table
+ *  only visits the entries that can be set.
+ *
+ *  returns:  the smallest id >= id whose chunk is allocated, -1 if none
+ */
+int idtab_next(const id_table_t *t, int id)
+{
+    if (id < 0)
+    {
+        id = 0;
+    }
+    if (id > t->max_id)
+    {
+        return -1;
+    }
+
+    for (int c = id / IDTAB_CHUNK; c < t->nchunks; c++)
+    {
+        if (__atomic_load_n(&t->chunks[c], __ATOMIC_ACQUIRE) != NULL)
+        {
+            int first = c * IDTAB_CHUNK;
+            return (id > first) ? id : first;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,1447 @@
+#define _GNU_SOURCE //for SEEK_DATA and SEEK_HOLE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h> //c library for system call file routines
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Secondary indexes of the open database.  They are all opened and closed
+// together with the database through the idx_*() functions at the end of
+// this file, in between add, delete and import only update them in memory
+// or through a mapping.
+
+// Occupancy index, one bit per possible student id of the database in a
+// memory mapped sidecar.  A segmented database takes many more ids than a
+// single file, the mapping only reads the pages of the ids used.
+static int occ_fd = -1;         // fd of the sidecar file, -1 if none
+static occ_file_t *occ = NULL;  // mapping of the whole sidecar file
+static size_t occ_len;          // bytes in the mapping
+static int occ_max_id;          // largest id of the bitmap
+static bool occ_is_valid;       // bitmap matches the database
+static bool occ_changed;        // bits changed since occ_open()
+static bool occ_snapshot;       // mapped read only for a snapshot reader
+static int64_t occ_snap_size;   // database size of that snapshot
+
+/*
+ *  occ_db_size
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  returns:  size of the database file, or -1 on error
+ */
+static int64_t occ_db_size(int db_fd)
+{
+    return db_size(db_fd);
+}
+
+/*
+ *  idx_map_sidecar
+ *      fd:     fd of the sidecar file
+ *      len:    size the sidecar has for the database
+ *      fresh:  empty the sidecar first
+ *
+ *  Sizes the sidecar to len and maps it.  A sidecar of another size was
+ *  written for another id range and is emptied.  The new bytes are holes,
+ *  they read as zero without taking any space.
+ *
+ *  returns:  the mapping, MAP_FAILED on error
+ */
+static void *idx_map_sidecar(int fd, size_t len, bool fresh)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+    {
+        return MAP_FAILED;
+    }
+    if ((fresh || (size_t)st.st_size != len) && (ftruncate(fd, 0) == -1 || ftruncate(fd, len) == -1))
+    {
+        return MAP_FAILED;
+    }
+
+    return mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+}
+
+/*
+ *  occ_open
+ *      dbFile:   name of the database file, the index is dbFile OCC_FILE_SUFFIX
+ *      db_size:  current size of the database file, -1 if unknown
+ *      max_id:   largest id of the database
+ *      create:   the session writes, see idx_open()
+ *
+ *  Maps the occupancy index of the database.  The index is only trusted
+ *  when it was closed cleanly, covers max_id and the database still has the
+ *  size recorded with it, otherwise count and print fall back to scanning
+ *  until it is rebuilt with idx_rebuild().  An empty database always gets a
+ *  fresh index when the session writes.
+ *
+ *  returns:  NO_ERROR       the index is optional, so this never fails
+ *
+ *  console:  Does not produce any console I/O
+ */
+static int occ_open(char *dbFile, int64_t db_size, int max_id, bool create)
+{
+    char path[256];
+    struct stat st;
+    occ_file_t hdr;
+
+    occ_is_valid = false;
+    occ_changed = false;
+    occ_snapshot = false;
+    occ_max_id = max_id;
+    occ_len = sizeof(occ_file_t) + OCC_WORDS(max_id) * sizeof(uint64_t);
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, OCC_FILE_SUFFIX);
+    occ_fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (occ_fd == -1)
+    {
+        return NO_ERROR;
+    }
+
+    occ_is_valid = pread(occ_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+                   (hdr.magic == OCC_MAGIC) &&
+                   (hdr.dirty == 0) &&
+                   (db_size != -1) && (hdr.db_size == db_size) &&
+                   fstat(occ_fd, &st) == 0 && (size_t)st.st_size == occ_len;
+    bool fresh = !occ_is_valid && db_size == 0;
+    if (!occ_is_valid && !create)
+    {
+        return NO_ERROR;
+    }
+
+    // Nothing to index yet, start with an empty bitmap
+    void *base = idx_map_sidecar(occ_fd, occ_len, fresh);
+    if (base == MAP_FAILED)
+    {
+        occ_is_valid = false;
+        return NO_ERROR;
+    }
+    occ = base;
+
+    if (fresh)
+    {
+        occ->magic = OCC_MAGIC;
+        occ_is_valid = true;
+        occ_changed = true;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  occ_open_snapshot
+ *      dbFile:   name of the database file, the index is dbFile OCC_FILE_SUFFIX
+ *      db_size:  size of the database when the snapshot was taken
+ *      max_id:   largest id of the database
+ *
+ *  Maps the occupancy index read only for a snapshot reader, which does not
+ *  take the index lock.  Writers keep changing the bitmap next to it, so
+ *  occ_valid() checks it against the snapshot every time.  An index that is
+ *  missing or has another size is not used.
+ *
+ *  returns:  NO_ERROR       the index is optional, so this never fails
+ *
+ *  console:  Does not produce any console I/O
+ */
+static int occ_open_snapshot(char *dbFile, int64_t db_size, int max_id)
+{
+    char path[256];
+    struct stat st;
+
+    occ_is_valid = false;
+    occ_changed = false;
+    occ_snapshot = true;
+    occ_snap_size = db_size;
+    occ_max_id = max_id;
+    occ_len = sizeof(occ_file_t) + OCC_WORDS(max_id) * sizeof(uint64_t);
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, OCC_FILE_SUFFIX);
+    occ_fd = open(path, O_RDONLY);
+    if (occ_fd == -1 || fstat(occ_fd, &st) == -1 || (size_t)st.st_size != occ_len)
+    {
+        return NO_ERROR;
+    }
+
+    void *base = mmap(NULL, occ_len, PROT_READ, MAP_SHARED, occ_fd, 0);
+    if (base == MAP_FAILED)
+    {
+        return NO_ERROR;
+    }
+    occ = base;
+    occ_is_valid = true;
+
+    return NO_ERROR;
+}
+
+/*
+ *  occ_close
+ *      db_size:  current size of the database file, -1 if unknown
+ *
+ *  Stamps a changed index with the current database size, marks it clean
+ *  and closes the sidecar.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the index could not be written
+ */
+static int occ_close(int64_t db_size)
+{
+    int rc = NO_ERROR;
+
+    if (occ_fd == -1)
+    {
+        return NO_ERROR;
+    }
+
+    if (occ != NULL)
+    {
+        if (occ_is_valid && occ_changed)
+        {
+            occ->magic = OCC_MAGIC;
+            occ->db_size = db_size;
+            occ->dirty = (db_size == -1);
+            if (db_size == -1 || msync(occ, occ_len, MS_ASYNC) == -1)
+            {
+                rc = ERR_DB_FILE;
+            }
+        }
+        munmap(occ, occ_len);
+    }
+
+    close(occ_fd);
+    occ_fd = -1;
+    occ = NULL;
+    occ_is_valid = false;
+    occ_changed = false;
+    occ_snapshot = false;
+    return rc;
+}
+
+/*
+ *  occ_valid
+ *
+ *  A snapshot reader can only use the index while it is clean for the size
+ *  of the snapshot and no write began since the snapshot was taken.
+ *
+ *  returns:  true if the occupancy index can be used instead of a scan
+ */
+bool occ_valid(void)
+{
+    if (!occ_is_valid || !occ_snapshot)
+    {
+        return occ_is_valid;
+    }
+
+    return __atomic_load_n(&occ->magic, __ATOMIC_ACQUIRE) == OCC_MAGIC &&
+           __atomic_load_n(&occ->dirty, __ATOMIC_ACQUIRE) == 0 &&
+           __atomic_load_n(&occ->db_size, __ATOMIC_ACQUIRE) == occ_snap_size &&
+           snap_current();
+}
+
+/*
+ *  occ_begin
+ *
+ *  Must be called before the database is modified.  The first change flags
+ *  the index as dirty in the sidecar, so a crash before occ_close() leaves
+ *  an index that occ_open() will not trust.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void occ_begin(void)
+{
+    if (occ_is_valid)
+    {
+        occ->dirty = 1;
+    }
+}
+
+/*
+ *  occ_set
+ *      id:       student id
+ *      present:  true if a student with this id is now in the database
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void occ_set(int id, bool present)
+{
+    if (!occ_is_valid || id < 0 || id > occ_max_id)
+    {
+        return;
+    }
+
+    uint64_t mask = 1ULL << (id % 64);
+    if (present)
+    {
+        occ->bits[id / 64] |= mask;
+    }
+    else
+    {
+        occ->bits[id / 64] &= ~mask;
+    }
+    occ_changed = true;
+}
+
+/*
+ *  occ_count
+ *
+ *  returns:  number of students in the index, a popcount of the bitmap, or
+ *            -1 if a writer changed the index of a snapshot reader meanwhile
+ */
+int occ_count(void)
+{
+    int count = 0;
+
+    for (int i = 0; i < OCC_WORDS(occ_max_id); i++)
+    {
+        count += __builtin_popcountll(occ->bits[i]);
+    }
+
+    return (occ_snapshot && !occ_valid()) ? -1 : count;
+}
+
+/*
+ *  occ_next
+ *      id:  first id to consider
+ *
+ *  returns:  the smallest id >= id that is in the index, or -1 if none
+ */
+int occ_next(int id)
+{
+    if (id < 0)
+    {
+        id = 0;
+    }
+    if (id > occ_max_id)
+    {
+        return -1;
+    }
+
+    int word = id / 64;
+    uint64_t bits = occ->bits[word] & (~0ULL << (id % 64));
+    for (;;)
+    {
+        if (bits != 0)
+        {
+            return word * 64 + __builtin_ctzll(bits);
+        }
+        if (++word == OCC_WORDS(occ_max_id))
+        {
+            return -1;
+        }
+        bits = occ->bits[word];
+    }
+}
+
+// Record checksums, the CRC32C of every student by id in a memory mapped
+// sidecar sized to the ids of the database.  A flipped bit or a torn record
+// in the database no longer looks like valid data, verify_db() compares
+// every record with its checksum.  The sums follow the same rules as the
+// indexes, they are only trusted when they were closed cleanly for a
+// database of this size.
+static int sum_fd = -1;             // fd of the sidecar file, -1 if none
+static char *sum_map = NULL;        // mapping of the whole sidecar file
+static size_t sum_len;              // bytes in the mapping
+static int sum_max_id;              // largest id with a checksum
+static off_t sum_data_start;        // a part of the sidecar known to hold
+static off_t sum_data_end;          // data, see sum_next()
+static bool sum_is_valid;           // sums match the database
+static bool sum_changed;            // sums changed since sum_open()
+
+static sum_header_t *sum_header(void)
+{
+    return (sum_header_t *)sum_map;
+}
+
+static uint32_t *sum_table(void)
+{
+    return (uint32_t *)(sum_map + sizeof(sum_header_t));
+}
+
+/*
+ *  sum_open
+ *      dbFile:   name of the database file, the sums are dbFile SUM_FILE_SUFFIX
+ *      db_size:  current size of the database file, -1 if unknown
+ *      max_id:   largest id of the database
+ *      create:   the session writes, see idx_open()
+ *
+ *  Maps the checksum sidecar, only the pages of the ids used are ever read.
+ *  An empty database always gets fresh, all zero sums when the session
+ *  writes.
+ *
+ *  returns:  NO_ERROR       the sums are optional, so this never fails
+ */
+static int sum_open(char *dbFile, int64_t db_size, int max_id, bool create)
+{
+    char path[256];
+    struct stat st;
+    sum_header_t hdr;
+
+    sum_is_valid = false;
+    sum_changed = false;
+    sum_max_id = max_id;
+    sum_len = SUM_FILE_SIZE(max_id);
+    sum_data_start = 0;
+    sum_data_end = 0;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, SUM_FILE_SUFFIX);
+    sum_fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (sum_fd == -1)
+    {
+        return NO_ERROR;
+    }
+
+    sum_is_valid = pread(sum_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+                   (hdr.magic == SUM_MAGIC) &&
+                   (hdr.dirty == 0) &&
+                   (db_size != -1) && (hdr.db_size == db_size) &&
+                   fstat(sum_fd, &st) == 0 && (size_t)st.st_size == sum_len;
+    bool fresh = !sum_is_valid && db_size == 0;
+    if (!sum_is_valid && !create)
+    {
+        return NO_ERROR;
+    }
+
+    // A fresh file is cut back first, so every sum reads as 0
+    void *base = idx_map_sidecar(sum_fd, sum_len, fresh);
+    if (base == MAP_FAILED)
+    {
+        sum_is_valid = false;
+        return NO_ERROR;
+    }
+    sum_map = base;
+
+    if (fresh)
+    {
+        sum_is_valid = true;
+        sum_changed = true;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  sum_close
+ *      db_size:  current size of the database file, -1 if unknown
+ *
+ *  Stamps changed sums with the database size and marks them clean.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the sums could not be written
+ */
+static int sum_close(int64_t db_size)
+{
+    int rc = NO_ERROR;
+
+    if (sum_fd == -1)
+    {
+        return NO_ERROR;
+    }
+
+    if (sum_map != NULL)
+    {
+        if (sum_is_valid && sum_changed)
+        {
+            sum_header()->magic = SUM_MAGIC;
+            sum_header()->db_size = db_size;
+            sum_header()->dirty = (db_size == -1);
+            if (msync(sum_map, sum_len, MS_ASYNC) == -1)
+            {
+                rc = ERR_DB_FILE;
+            }
+        }
+        munmap(sum_map, sum_len);
+    }
+
+    close(sum_fd);
+    sum_fd = -1;
+    sum_map = NULL;
+    sum_is_valid = false;
+    sum_changed = false;
+    return rc;
+}
+
+/*
+ *  sum_begin
+ *
+ *  Flags the sums as dirty before the database is modified, see
+ *  occ_begin().
+ */
+static void sum_begin(void)
+{
+    if (sum_is_valid)
+    {
+        sum_header()->dirty = 1;
+    }
+}
+
+/*
+ *  sum_set
+ *      id:   student id
+ *      sum:  checksum of the student, 0 once it is deleted
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void sum_set(int id, uint32_t sum)
+{
+    if (!sum_is_valid || id < 0 || id > sum_max_id)
+    {
+        return;
+    }
+
+    sum_table()[id] = sum;
+    sum_changed = true;
+}
+
+/*
+ *  sum_next
+ *      id:  first id to consider
+ *
+ *  Finds the next checksum without touching the holes of the sidecar, a
+ *  segmented database has room for far more ids than it has students.
+ *
+ *  returns:  the smallest id >= id with a checksum
+ *            SRCH_NOT_FOUND there is none
+ *            ERR_DB_FILE    sidecar file I/O issue
+ */
+int sum_next(int id)
+{
+    off_t first = sizeof(sum_header_t);
+
+    for (id = (id < 0) ? 0 : id; id <= sum_max_id; id++)
+    {
+        off_t at = first + (off_t)id * sizeof(uint32_t);
+        if (at < sum_data_start || at >= sum_data_end)
+        {
+            off_t start = lseek(sum_fd, at, SEEK_DATA);
+            off_t end = (start == -1) ? -1 : lseek(sum_fd, start, SEEK_HOLE);
+            if (start == -1 && errno == ENXIO)
+            {
+                break; // the rest is a hole
+            }
+            if (start == -1 && errno == EINVAL)
+            {
+                start = at; // no hole support, read everything
+                end = sum_len;
+            }
+            if (start == -1 || end == -1)
+            {
+                return ERR_DB_FILE;
+            }
+            sum_data_start = start;
+            sum_data_end = end;
+
+            // Extents are whole pages, so start falls on an id
+            if (start > at)
+            {
+                id = (start - first) / sizeof(uint32_t);
+                if (id > sum_max_id)
+                {
+                    break;
+                }
+            }
+        }
+        if (sum_table()[id] != 0)
+        {
+            return id;
+        }
+    }
+
+    return SRCH_NOT_FOUND;
+}
+
+/*
+ *  sum_valid
+ *
+ *  returns:  true if the checksums match the database
+ */
+bool sum_valid(void)
+{
+    return sum_is_valid;
+}
+
+/*
+ *  sum_get
+ *      id:  student id, MIN_STD_ID to the largest id of the database
+ *
+ *  Only reads the mapping, so parallel scans can call it.
+ *
+ *  returns:  the checksum of the student, 0 if there is none
+ */
+uint32_t sum_get(int id)
+{
+    return sum_table()[id];
+}
+
+// Sorted sidecar index.  The entries are kept ordered by compare() in a
+// memory mapped file behind a sidx_header_t, so a lookup is a binary search
+// and an insert or delete moves the tail of the array in place.
+typedef struct sidx {
+    const char *suffix;     // index file is the db file name + suffix
+    uint32_t magic;
+    size_t entry_size;
+    int (*compare)(const void *, const void *);
+    void (*make_entry)(const student_t *, void *);
+    int fd;                 // fd of the sidecar file, -1 if none
+    char *map;              // mapping of the whole sidecar file
+    size_t map_len;
+    bool valid;             // entries match the database
+    bool changed;           // entries changed since sidx_open()
+} sidx_t;
+
+/*
+ *  compare_lname_entry
+ *
+ *  Orders last name index entries by last name, then id.
+ */
+static int compare_lname_entry(const void *a, const void *b)
+{
+    const lname_entry_t *ea = a;
+    const lname_entry_t *eb = b;
+
+    int rc = strncmp(ea->lname, eb->lname, sizeof(ea->lname));
+    if (rc != 0)
+    {
+        return rc;
+    }
+    return (ea->id > eb->id) - (ea->id < eb->id);
+}
+
+/*
+ *  make_lname_entry
+ *
+ *  Builds the last name index entry for a student.
+ */
+static void make_lname_entry(const student_t *s, void *entry)
+{
+    lname_entry_t *e = entry;
+
+    // The key is fixed width, NUL padded and always terminated
+    size_t len = strnlen(s->lname, sizeof(e->lname) - 1);
+    memset(e, 0, sizeof(lname_entry_t));
+    memcpy(e->lname, s->lname, len);
+    e->id = s->id;
+}
+
+static sidx_t lname_idx = {
+    LNAME_FILE_SUFFIX, LNAME_MAGIC, sizeof(lname_entry_t),
+    compare_lname_entry, make_lname_entry, -1, NULL, 0, false, false
+};
+
+/*
+ *  compare_gpa_entry
+ *
+ *  Orders GPA index entries by GPA, then id.  Every GPA bucket is one run of
+ *  entries in the index.
+ */
+static int compare_gpa_entry(const void *a, const void *b)
+{
+    const gpa_entry_t *ea = a;
+    const gpa_entry_t *eb = b;
+
+    if (ea->gpa != eb->gpa)
+    {
+        return (ea->gpa > eb->gpa) - (ea->gpa < eb->gpa);
+    }
+    return (ea->id > eb->id) - (ea->id < eb->id);
+}
+
+/*
+ *  make_gpa_entry
+ *
+ *  Builds the GPA index entry for a student.
+ */
+static void make_gpa_entry(const student_t *s, void *entry)
+{
+    gpa_entry_t *e = entry;
+
+    e->gpa = s->gpa;
+    e->id = s->id;
+}
+
+static sidx_t gpa_idx = {
+    GPA_FILE_SUFFIX, GPA_MAGIC, sizeof(gpa_entry_t),
+    compare_gpa_entry, make_gpa_entry, -1, NULL, 0, false, false
+};
+
+// All sorted indexes, kept up to date by the idx_*() functions
+static sidx_t *sorted_indexes[] = { &lname_idx, &gpa_idx };
+#define N_SORTED_INDEXES (int)(sizeof(sorted_indexes) / sizeof(sorted_indexes[0]))
+
+static sidx_header_t *sidx_header(sidx_t *idx)
+{
+    return (sidx_header_t *)idx->map;
+}
+
+static char *sidx_entry(sidx_t *idx, size_t i)
+{
+    return idx->map + sizeof(sidx_header_t) + i * idx->entry_size;
+}
+
+/*
+ *  sidx_resize
+ *      idx:    sorted index
+ *      count:  number of entries the file must be able to hold
+ *
+ *  Grows the sidecar file and its mapping, it is never shrunk.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    index file I/O issue, the index is invalidated
+ */
+static int sidx_resize(sidx_t *idx, size_t count)
+{
+    size_t needed = sizeof(sidx_header_t) + count * idx->entry_size;
+
+    if (idx->map != NULL && needed <= idx->map_len)
+    {
+        return NO_ERROR;
+    }
+
+    if (idx->map != NULL)
+    {
+        munmap(idx->map, idx->map_len);
+        idx->map = NULL;
+    }
+
+    void *base = MAP_FAILED;
+    if (ftruncate(idx->fd, needed) == 0)
+    {
+        base = mmap(NULL, needed, PROT_READ | PROT_WRITE, MAP_SHARED, idx->fd, 0);
+    }
+    if (base == MAP_FAILED)
+    {
+        idx->valid = false;
+        idx->map_len = 0;
+        return ERR_DB_FILE;
+    }
+
+    idx->map = base;
+    idx->map_len = needed;
+    return NO_ERROR;
+}
+
+/*
+ *  sidx_open
+ *      idx:      sorted index
+ *      dbFile:   name of the database file
+ *      db_size:  current size of the database file, -1 if unknown
+ *      create:   the session writes, see idx_open()
+ *
+ *  Maps the sidecar file.  Same as for the occupancy index the entries are
+ *  only trusted when the index was closed cleanly for a database of this
+ *  size, and an empty database always gets a fresh index when the session
+ *  writes.
+ *
+ *  returns:  NO_ERROR       the index is optional, so this never fails
+ */
+static int sidx_open(sidx_t *idx, char *dbFile, int64_t db_size, bool create)
+{
+    char path[256];
+    struct stat st;
+
+    idx->valid = false;
+    idx->changed = false;
+    idx->map = NULL;
+    idx->map_len = 0;
+
+    snprintf(path, sizeof(path), "%s%s", dbFile, idx->suffix);
+    idx->fd = open(path, create ? O_RDWR | O_CREAT : O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (idx->fd == -1 || fstat(idx->fd, &st) == -1)
+    {
+        return NO_ERROR;
+    }
+
+    if ((size_t)st.st_size >= sizeof(sidx_header_t))
+    {
+        void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, idx->fd, 0);
+        if (base == MAP_FAILED)
+        {
+            return NO_ERROR;
+        }
+        idx->map = base;
+        idx->map_len = st.st_size;
+
+        sidx_header_t *hdr = sidx_header(idx);
+        idx->valid = (hdr->magic == idx->magic) &&
+                     (hdr->dirty == 0) &&
+                     (hdr->entry_size == idx->entry_size) &&
+                     (db_size != -1) && (hdr->db_size == db_size) &&
+                     (sizeof(sidx_header_t) + hdr->count * idx->entry_size <= idx->map_len);
+    }
+
+    if (!idx->valid && create && db_size == 0 && sidx_resize(idx, 0) == NO_ERROR)
+    {
+        // Nothing to index yet, start with an empty array
+        sidx_header_t *hdr = sidx_header(idx);
+        memset(hdr, 0, sizeof(sidx_header_t));
+        hdr->magic = idx->magic;
+        hdr->entry_size = idx->entry_size;
+        idx->valid = true;
+        idx->changed = true;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  sidx_close
+ *      idx:      sorted index
+ *      db_size:  current size of the database file, -1 if unknown
+ *
+ *  Stamps a changed index with the database size and marks it clean.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the index could not be written
+ */
+static int sidx_close(sidx_t *idx, int64_t db_size)
+{
+    int rc = NO_ERROR;
+
+    if (idx->fd == -1)
+    {
+        return NO_ERROR;
+    }
+
+    if (idx->map != NULL)
+    {
+        if (idx->valid && idx->changed)
+        {
+            sidx_header_t *hdr = sidx_header(idx);
+            hdr->db_size = db_size;
+            hdr->dirty = (db_size == -1);
+            if (msync(idx->map, idx->map_len, MS_ASYNC) == -1)
+            {
+                rc = ERR_DB_FILE;
+            }
+        }
+        munmap(idx->map, idx->map_len);
+    }
+
+    close(idx->fd);
+    idx->fd = -1;
+    idx->map = NULL;
+    idx->map_len = 0;
+    idx->valid = false;
+    idx->changed = false;
+    return rc;
+}
+
+/*
+ *  sidx_begin
+ *
+ *  Flags the index as dirty before the database is modified, see
+ *  occ_begin().
+ */
+static void sidx_begin(sidx_t *idx)
+{
+    if (idx->valid)
+    {
+        sidx_header(idx)->dirty = 1;
+    }
+}
+
+/*
+ *  sidx_lower_bound
+ *      idx:  sorted index
+ *      key:  entry to search for
+ *
+ *  returns:  position of the first entry that does not compare less than
+ *            key, the number of entries if there is none
+ */
+static size_t sidx_lower_bound(sidx_t *idx, const void *key)
+{
+    size_t lo = 0;
+    size_t hi = sidx_header(idx)->count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->compare(sidx_entry(idx, mid), key) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ *  sidx_insert_many
+ *      idx:       sorted index
+ *      students:  new students, in any order
+ *      n:         number of students
+ *
+ *  The new entries are sorted on their own and then merged into the index
+ *  from the back, so a bulk insert costs one pass over the index instead of
+ *  one memmove() per student.
+ *
+ *  returns:  nothing, on errors the index is invalidated
+ */
+static void sidx_insert_many(sidx_t *idx, const student_t *students, size_t n)
+{
+    if (!idx->valid || n == 0)
+    {
+        return;
+    }
+
+    char *fresh = malloc(n * idx->entry_size);
+    size_t count = sidx_header(idx)->count;
+    if (fresh == NULL || sidx_resize(idx, count + n) != NO_ERROR)
+    {
+        free(fresh);
+        idx->valid = false;
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        idx->make_entry(&students[i], fresh + i * idx->entry_size);
+    }
+    qsort(fresh, n, idx->entry_size, idx->compare);
+
+    // Merge from the back so no entry is overwritten before it moved
+    size_t old_i = count;
+    size_t new_i = n;
+    size_t out = count + n;
+    while (new_i > 0)
+    {
+        const char *from;
+        if (old_i > 0 &&
+            idx->compare(sidx_entry(idx, old_i - 1), fresh + (new_i - 1) * idx->entry_size) > 0)
+        {
+            from = sidx_entry(idx, --old_i);
+        }
+        else
+        {
+            from = fresh + (--new_i) * idx->entry_size;
+        }
+        memcpy(sidx_entry(idx, --out), from, idx->entry_size);
+    }
+
+    free(fresh);
+    sidx_header(idx)->count = count + n;
+    idx->changed = true;
+}
+
+/*
+ *  sidx_remove
+ *      idx:  sorted index
+ *      s:    student that was deleted
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void sidx_remove(sidx_t *idx, const student_t *s)
+{
+    char key[idx->entry_size];
+
+    if (!idx->valid)
+    {
+        return;
+    }
+
+    idx->make_entry(s, key);
+    size_t count = sidx_header(idx)->count;
+    size_t pos = sidx_lower_bound(idx, key);
+    if (pos == count || idx->compare(sidx_entry(idx, pos), key) != 0)
+    {
+        return;
+    }
+
+    memmove(sidx_entry(idx, pos), sidx_entry(idx, pos + 1), (count - pos - 1) * idx->entry_size);
+    sidx_header(idx)->count = count - 1;
+    idx->changed = true;
+}
+
+/*
+ *  sidx_replace
+ *      idx:      sorted index
+ *      entries:  complete, sorted set of entries built from the database
+ *      n:        number of entries
+ *
+ *  returns:  1 if the index was missing, stale or had different entries,
+ *            0 if it already matched, ERR_DB_FILE on I/O errors
+ */
+static int sidx_replace(sidx_t *idx, const char *entries, size_t n)
+{
+    bool same = idx->valid && sidx_header(idx)->count == n &&
+                memcmp(sidx_entry(idx, 0), entries, n * idx->entry_size) == 0;
+
+    if (idx->fd == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    idx->valid = true;
+    if (sidx_resize(idx, n) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+
+    sidx_header_t *hdr = sidx_header(idx);
+    hdr->magic = idx->magic;
+    hdr->entry_size = idx->entry_size;
+    hdr->count = n;
+    memcpy(sidx_entry(idx, 0), entries, n * idx->entry_size);
+    idx->changed = true;
+
+    return same ? 0 : 1;
+}
+
+/*
+ *  lname_find_prefix
+ *      prefix:  last name prefix to look for
+ *      **first: set to the first matching entry
+ *
+ *  Binary search of the last name index, the matches are the count entries
+ *  starting at *first.
+ *
+ *  returns:  <number>       number of matching entries
+ *            ERR_DB_OP      the last name index is not valid, scan instead
+ */
+int lname_find_prefix(const char *prefix, const lname_entry_t **first)
+{
+    lname_entry_t key;
+
+    if (!lname_idx.valid)
+    {
+        return ERR_DB_OP;
+    }
+
+    memset(&key, 0, sizeof(key));
+    strncpy(key.lname, prefix, sizeof(key.lname) - 1);
+    size_t len = strlen(key.lname);
+
+    size_t count = sidx_header(&lname_idx)->count;
+    size_t pos = sidx_lower_bound(&lname_idx, &key);
+    size_t end = pos;
+    while (end < count &&
+           strncmp(((lname_entry_t *)sidx_entry(&lname_idx, end))->lname, key.lname, len) == 0)
+    {
+        end++;
+    }
+
+    *first = (const lname_entry_t *)sidx_entry(&lname_idx, pos);
+    return end - pos;
+}
+
+/*
+ *  gpa_find_range
+ *      lo:      lowest GPA to look for
+ *      hi:      highest GPA to look for
+ *      **first: set to the first matching entry
+ *
+ *  The buckets lo..hi are one contiguous run of the GPA index, found with
+ *  two binary searches.  The matches are the count entries starting at
+ *  *first.
+ *
+ *  returns:  <number>       number of matching entries
+ *            ERR_DB_OP      the GPA index is not valid, scan instead
+ */
+int gpa_find_range(int lo, int hi, const gpa_entry_t **first)
+{
+    gpa_entry_t key;
+
+    if (!gpa_idx.valid)
+    {
+        return ERR_DB_OP;
+    }
+
+    // Ids are never negative, so (gpa, -1) sorts before every entry of gpa
+    key.gpa = lo;
+    key.id = -1;
+    size_t start = sidx_lower_bound(&gpa_idx, &key);
+    key.gpa = hi + 1;
+    size_t end = sidx_lower_bound(&gpa_idx, &key);
+
+    *first = (const gpa_entry_t *)sidx_entry(&gpa_idx, start);
+    return (end > start) ? end - start : 0;
+}
+
+/*
+ *  gpa_histogram
+ *      hist:  MAX_STD_GPA + 1 counters, must start zeroed
+ *
+ *  Counts the students per GPA from the GPA index.  Each GPA is a run of
+ *  entries, so this is one sequential pass over 8 byte entries.
+ *
+ *  returns:  NO_ERROR       hist holds the counts
+ *            ERR_DB_OP      the GPA index is not valid, scan instead
+ */
+int gpa_histogram(int *hist)
+{
+    if (!gpa_idx.valid)
+    {
+        return ERR_DB_OP;
+    }
+
+    const gpa_entry_t *entries = (const gpa_entry_t *)sidx_entry(&gpa_idx, 0);
+    size_t count = sidx_header(&gpa_idx)->count;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (entries[i].gpa >= MIN_STD_GPA && entries[i].gpa <= MAX_STD_GPA)
+        {
+            hist[entries[i].gpa]++;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  idx_open
+ *      dbFile:  name of the database file
+ *      db_fd:   linux file descriptor of the open database
+ *      create:  the session writes, so it creates missing sidecars and sets
+ *               up fresh indexes
+ *
+ *  Opens every secondary index of the database.  Sessions that only read
+ *  leave the sidecars as they are, a missing or stale one is no index.
+ *
+ *  returns:  NO_ERROR       the indexes are optional, so this never fails
+ */
+int idx_open(char *dbFile, int db_fd, bool create)
+{
+    int64_t db_size = occ_db_size(db_fd);
+    int max_id = db_max_id(db_fd);
+
+    occ_open(dbFile, db_size, max_id, create);
+    sum_open(dbFile, db_size, max_id, create);
+    for (int i = 0; i < N_SORTED_INDEXES; i++)
+    {
+        sidx_open(sorted_indexes[i], dbFile, db_size, create);
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  idx_open_snapshot
+ *      dbFile:   name of the database file
+ *      db_fd:    linux file descriptor of the open database
+ *      db_size:  size of the database when the snapshot was taken
+ *
+ *  Opens the occupancy index for a snapshot reader, the other indexes are
+ *  not used by the snapshot commands.
+ *
+ *  returns:  NO_ERROR       the indexes are optional, so this never fails
+ */
+int idx_open_snapshot(char *dbFile, int db_fd, int64_t db_size)
+{
+    return occ_open_snapshot(dbFile, db_size, db_max_id(db_fd));
+}
+
+/*
+ *  idx_close
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Writes back and closes every secondary index.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    an index could not be written
+ */
+int idx_close(int db_fd)
+{
+    int64_t db_size = occ_db_size(db_fd);
+    int rc = occ_close(db_size);
+
+    if (sum_close(db_size) != NO_ERROR)
+    {
+        rc = ERR_DB_FILE;
+    }
+    for (int i = 0; i < N_SORTED_INDEXES; i++)
+    {
+        if (sidx_close(sorted_indexes[i], db_size) != NO_ERROR)
+        {
+            rc = ERR_DB_FILE;
+        }
+    }
+
+    return rc;
+}
+
+/*
+ *  idx_begin
+ *
+ *  Must be called before the database is modified, see occ_begin().
+ */
+void idx_begin(void)
+{
+    occ_begin();
+    sum_begin();
+    for (int i = 0; i < N_SORTED_INDEXES; i++)
+    {
+        sidx_begin(sorted_indexes[i]);
+    }
+}
+
+/*
+ *  idx_add
+ *      students:  students that were written to the database
+ *      n:         number of students
+ *
+ *  returns:  nothing, this is a void function
+ */
+void idx_add(const student_t *students, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        occ_set(students[i].id, true);
+        sum_set(students[i].id, student_sum(&students[i]));
+    }
+    for (int i = 0; i < N_SORTED_INDEXES; i++)
+    {
+        sidx_insert_many(sorted_indexes[i], students, n);
+    }
+}
+
+/*
+ *  idx_remove
+ *      s:  student that was deleted from the database
+ *
+ *  returns:  nothing, this is a void function
+ */
+void idx_remove(const student_t *s)
+{
+    occ_set(s->id, false);
+    sum_set(s->id, 0);
+    for (int i = 0; i < N_SORTED_INDEXES; i++)
+    {
+        sidx_remove(sorted_indexes[i], s);
+    }
+}
+
+// An id found by idx_rebuild(), with the checksum of its record
+typedef struct idx_found {
+    int id;
+    uint32_t sum;
+    size_t seq;             // position in the scan
+} idx_found_t;
+
+/*
+ *  compare_found
+ *
+ *  qsort() comparator of idx_found_t, by id and then in scan order, so the
+ *  first record of an id comes first.
+ */
+static int compare_found(const void *a, const void *b)
+{
+    const idx_found_t *x = a;
+    const idx_found_t *y = b;
+
+    if (x->id != y->id)
+    {
+        return (x->id < y->id) ? -1 : 1;
+    }
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+/*
+ *  idx_clear_sidecar
+ *      fd:   fd of a mapped sidecar
+ *      hdr:  bytes of its header
+ *      len:  size of the sidecar
+ *
+ *  Cuts everything behind the header back to holes, which read as zero
+ *  without taking any space.  The mapping stays valid.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    sidecar file I/O issue
+ */
+static int idx_clear_sidecar(int fd, size_t hdr, size_t len)
+{
+    if (ftruncate(fd, hdr) == -1 || ftruncate(fd, len) == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  idx_rebuild
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Rebuilds every secondary index and the record checksums from a single
+ *  full scan of the database and compares the result against what was
+ *  loaded from the sidecars.  The checksums are taken from the records as
+ *  they are, verify_db() is what finds records that were damaged.  Only the
+ *  ids that were found are kept in memory, not the whole id range.
+ *
+ *  returns:  <number>       number of index entries that were wrong, a
+ *                           missing or stale index counts as at least one.
+ *                           0 if all indexes were correct
+ *            ERR_DB_FILE    database or index file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int idx_rebuild(int db_fd)
+{
+    db_scan_t scan;
+    const student_t *student;
+    char *entries[N_SORTED_INDEXES] = { NULL };
+    size_t n = 0;
+    size_t cap = 1024;
+    int rc = NO_ERROR;
+
+    idx_found_t *found = malloc(cap * sizeof(idx_found_t));
+    for (int i = 0; i < N_SORTED_INDEXES; i++)
+    {
+        entries[i] = malloc(cap * sorted_indexes[i]->entry_size);
+        if (entries[i] == NULL)
+        {
+            rc = ERR_DB_FILE;
+        }
+    }
+    if (occ == NULL || sum_map == NULL || found == NULL || rc != NO_ERROR ||
+        db_scan_open(&scan, db_fd) != NO_ERROR)
+    {
+        for (int i = 0; i < N_SORTED_INDEXES; i++)
+        {
+            free(entries[i]);
+        }
+        free(found);
+        return ERR_DB_FILE;
+    }
+
+    while (rc == NO_ERROR && (rc = db_scan_next(&scan, &student)) > 0)
+    {
+        rc = NO_ERROR;
+        if (student->id < MIN_STD_ID || student->id > occ_max_id)
+        {
+            continue;
+        }
+
+        if (n == cap)
+        {
+            cap *= 2;
+            idx_found_t *more = realloc(found, cap * sizeof(idx_found_t));
+            if (more == NULL)
+            {
+                rc = ERR_DB_FILE;
+                break;
+            }
+            found = more;
+            for (int i = 0; i < N_SORTED_INDEXES; i++)
+            {
+                char *grown = realloc(entries[i], cap * sorted_indexes[i]->entry_size);
+                if (grown == NULL)
+                {
+                    rc = ERR_DB_FILE;
+                    break;
+                }
+                entries[i] = grown;
+            }
+            if (rc != NO_ERROR)
+            {
+                break;
+            }
+        }
+        found[n].id = student->id;
+        found[n].sum = student_sum(student);
+        found[n].seq = n;
+        for (int i = 0; i < N_SORTED_INDEXES; i++)
+        {
+            sorted_indexes[i]->make_entry(student, entries[i] + n * sorted_indexes[i]->entry_size);
+        }
+        n++;
+    }
+    db_scan_close(&scan);
+
+    int wrong = 0;
+    if (rc == NO_ERROR)
+    {
+        // Like a lookup the first record of an id counts
+        qsort(found, n, sizeof(idx_found_t), compare_found);
+        size_t nids = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (nids == 0 || found[i].id != found[nids - 1].id)
+            {
+                found[nids++] = found[i];
+            }
+        }
+
+        // Bits that are missing plus bits of students that are gone
+        int kept = 0;
+        for (size_t i = 0; i < nids; i++)
+        {
+            kept += (occ->bits[found[i].id / 64] >> (found[i].id % 64)) & 1;
+        }
+        wrong = ((int)nids - kept) + (occ_count() - kept);
+        if (wrong == 0 && !occ_is_valid)
+        {
+            wrong = 1;
+        }
+        if (idx_clear_sidecar(occ_fd, sizeof(occ_file_t), occ_len) != NO_ERROR)
+        {
+            rc = ERR_DB_FILE;
+        }
+        for (size_t i = 0; rc == NO_ERROR && i < nids; i++)
+        {
+            occ->bits[found[i].id / 64] |= 1ULL << (found[i].id % 64);
+        }
+        occ_is_valid = (rc == NO_ERROR);
+        occ_changed = true;
+
+        // Sums that differ plus sums of students that are gone
+        int wrong_sums = 0;
+        int id;
+        for (id = sum_next(0); id >= 0; id = sum_next(id + 1))
+        {
+            wrong_sums++;
+        }
+        for (size_t i = 0; i < nids; i++)
+        {
+            uint32_t old = sum_table()[found[i].id];
+            wrong_sums += (old != found[i].sum) - (old != 0);
+        }
+        sum_data_start = 0;
+        sum_data_end = 0;
+        if (id == ERR_DB_FILE ||
+            idx_clear_sidecar(sum_fd, sizeof(sum_header_t), sum_len) != NO_ERROR)
+        {
+            rc = ERR_DB_FILE;
+        }
+        if (wrong_sums == 0 && !sum_is_valid)
+        {
+            wrong_sums = 1;
+        }
+        wrong += wrong_sums;
+        for (size_t i = 0; rc == NO_ERROR && i < nids; i++)
+        {
+            sum_table()[found[i].id] = found[i].sum;
+        }
+        sum_is_valid = (rc == NO_ERROR);
+        sum_changed = true;
+
+        for (int i = 0; i < N_SORTED_INDEXES && rc == NO_ERROR; i++)
+        {
+            qsort(entries[i], n, sorted_indexes[i]->entry_size, sorted_indexes[i]->compare);
+            int replaced = sidx_replace(sorted_indexes[i], entries[i], n);
+            if (replaced < 0)
+            {
+                rc = ERR_DB_FILE;
+            }
+            wrong += replaced;
+        }
+    }
+
+    for (int i = 0; i < N_SORTED_INDEXES; i++)
+    {
+        free(entries[i]);
+    }
+    free(found);
+
+    return (rc == NO_ERROR) ? wrong : ERR_DB_FILE;
+}
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Small LZ77 codec for the archive blocks, see sdb_archive.c.  The
+// compressed stream is a sequence of
+//
+//      0nnnnnnn                 n + 1 literal bytes follow
+//      1nnnnnnn  off_lo off_hi  copy n + LZ_MIN_MATCH bytes from off bytes
+//                               back in the output
+//
+// A copy may overlap the bytes it produces, so the NUL padding of the
+// names shrinks to a few bytes per run.
+#define LZ_MIN_MATCH    3
+#define LZ_MAX_MATCH    (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_MAX_OFFSET   0xffff
+#define LZ_HASH_BITS    12
+
+/*
+ *  lz_hash
+ *      p:  at least LZ_MIN_MATCH bytes
+ *
+ *  returns:  slot of the match table for the bytes at p
+ */
+static uint32_t lz_hash(const unsigned char *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ *  lz_literals
+ *      src:  literal bytes
+ *      n:    number of literal bytes
+ *      dst:  output buffer
+ *      out:  bytes already in dst
+ *
+ *  returns:  bytes in dst after the literal runs were appended
+ */
+static size_t lz_literals(const unsigned char *src, size_t n, unsigned char *dst, size_t out)
+{
+    while (n > 0)
+    {
+        size_t run = (n < LZ_MAX_LITERALS) ? n : LZ_MAX_LITERALS;
+        dst[out++] = run - 1;
+        memcpy(dst + out, src, run);
+        out += run;
+        src += run;
+        n -= run;
+    }
+
+    return out;
+}
+
+/*
+ *  lz_compress
+ *      src:  data to compress
+ *      len:  bytes in src
+ *      dst:  output buffer of at least LZ_BOUND(len) bytes
+ *
+ *  Greedy compression, every position is matched against the last
+ *  position with the same hash.
+ *
+ *  returns:  bytes written to dst
+ */
+size_t lz_compress(const unsigned char *src, size_t len, unsigned char *dst)
+{
+    uint32_t table[1 << LZ_HASH_BITS] = { 0 }; // last position + 1 per hash
+    size_t out = 0;
+    size_t lit_start = 0;
+    size_t i = 0;
+
+    while (i + LZ_MIN_MATCH <= len)
+    {
+        uint32_t h = lz_hash(src + i);
+        size_t ref = table[h];
+        table[h] = i + 1;
+
+        if (ref == 0 || i - (ref - 1) > LZ_MAX_OFFSET ||
+            memcmp(src + ref - 1, src + i, LZ_MIN_MATCH) != 0)
+        {
+            i++;
+            continue;
+        }
+        ref--;
+
+        size_t m = LZ_MIN_MATCH;
+        while (i + m < len && m < LZ_MAX_MATCH && src[ref + m] == src[i + m])
+        {
+            m++;
+        }
+
+        out = lz_literals(src + lit_start, i - lit_start, dst, out);
+        size_t off = i - ref;
+        dst[out++] = 0x80 | (m - LZ_MIN_MATCH);
+        dst[out++] = off & 0xff;
+        dst[out++] = off >> 8;
+
+        i += m;
+        lit_start = i;
+    }
+
+    return lz_literals(src + lit_start, len - lit_start, dst, out);
+}
+
+/*
+ *  lz_decompress
+ *      src:  compressed data
+ *      len:  bytes in src
+ *      dst:  output buffer
+ *      cap:  size of dst
+ *
+ *  Every run is checked against both buffers, damaged input fails instead
+ *  of reading or writing out of bounds.
+ *
+ *  returns:  <number>       bytes written to dst
+ *            ERR_DB_FILE    src is not a valid stream or does not fit dst
+ */
+ssize_t lz_decompress(const unsigned char *src, size_t len, unsigned char *dst, size_t cap)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len)
+    {
+        unsigned char c = src[in++];
+        if (c < 0x80)
+        {
+            size_t n = c + 1;
+            if (n > len - in || n > cap - out)
+            {
+                return ERR_DB_FILE;
+            }
+            memcpy(dst + out, src + in, n);
+            in += n;
+            out += n;
+            continue;
+        }
+
+        size_t n = (c & 0x7f) + LZ_MIN_MATCH;
+        if (len - in < 2)
+        {
+            return ERR_DB_FILE;
+        }
+        size_t off = src[in] | (src[in + 1] << 8);
+        in += 2;
+        if (off == 0 || off > out || n > cap - out)
+        {
+            return ERR_DB_FILE;
+        }
+        // Byte by byte, the copy may overlap its own output
+        for (size_t k = 0; k < n; k++, out++)
+        {
+            dst[out] = dst[out - off];
+        }
+    }
+
+    return out;
+}
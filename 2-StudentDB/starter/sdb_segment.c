@@ -0,0 +1,895 @@
+#define _GNU_SOURCE //for SEEK_DATA and SEEK_HOLE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h> //c library for system call file routines
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Segmented database.  Instead of one sparse student.db the records live in
+// a directory of segment files, dbFile SEG_DIR_SUFFIX, each covering a fixed
+// range of ids, next to a manifest that lists them.  student.db itself stays
+// behind as an empty file that carries the locks.
+//
+// The record helpers of sdbsc.c route their offsets here, so everything
+// above them still sees one file of id * sizeof(student_t) slots.  Like in
+// a single sparse file every segment before the last one that holds data
+// is full size, missing parts are holes, so a short read is always EOF.
+//
+// The manifest covers ids up to SEG_MAX_STD_ID, so a segmented database takes
+// far more students than one file.  Segment files only appear once records
+// reach them, and each one that does stays open until seg_close().
+static int seg_anchor = -1;         // fd of the database, -1 if not segmented
+static char seg_dir[256];           // directory of the segment files
+static int seg_n;                   // number of segments in the manifest
+static int seg_ids;                 // ids per segment
+static off_t seg_len;               // bytes per segment
+static int *seg_fds;                // fd per segment, -1 if not opened yet
+static int seg_filled;              // segments below this are known full size
+static pthread_mutex_t seg_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ *  seg_path
+ *      path:  buffer for the file name
+ *      len:   size of path
+ *      dir:   segment directory
+ *      seg:   segment number, -1 for the manifest
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the name does not fit into path
+ */
+static int seg_path(char *path, size_t len, const char *dir, int seg)
+{
+    int n;
+
+    if (seg < 0)
+    {
+        n = snprintf(path, len, "%s/%s", dir, SEG_MANIFEST);
+    }
+    else
+    {
+        n = snprintf(path, len, "%s/%05d", dir, seg);
+    }
+
+    return (n < 0 || (size_t)n >= len) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  seg_fd
+ *      seg:     segment number
+ *      create:  create the segment file if it does not exist
+ *
+ *  Opens segment files on first use, scan threads share the fds.
+ *
+ *  returns:  the fd of the segment, -1 if it does not exist or on error
+ */
+static int seg_fd(int seg, bool create)
+{
+    char path[PATH_MAX];
+
+    pthread_mutex_lock(&seg_mutex);
+    int fd = seg_fds[seg];
+    if (fd == -1 && seg_path(path, sizeof(path), seg_dir, seg) == NO_ERROR)
+    {
+        fd = open(path, O_RDWR | (create ? O_CREAT : 0), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+        seg_fds[seg] = fd;
+    }
+    pthread_mutex_unlock(&seg_mutex);
+
+    return fd;
+}
+
+/*
+ *  seg_grow
+ *      fd:    fd of a segment
+ *      size:  size the segment needs at least
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    segment file I/O issue
+ */
+static int seg_grow(int fd, off_t size)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || (st.st_size < size && ftruncate(fd, size) == -1))
+    {
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  seg_fill
+ *      seg:  segment about to be written
+ *
+ *  Makes every segment below seg full size, the holes read back as empty
+ *  records just like the middle of a sparse file.  Growing never loses a
+ *  record another process writes at the same time.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    segment file I/O issue
+ */
+static int seg_fill(int seg)
+{
+    int rc = NO_ERROR;
+
+    for (int i = seg_filled; rc == NO_ERROR && i < seg; i++)
+    {
+        int fd = seg_fd(i, true);
+        rc = (fd == -1) ? ERR_DB_FILE : seg_grow(fd, seg_len);
+    }
+    if (rc == NO_ERROR && seg > seg_filled)
+    {
+        seg_filled = seg;
+    }
+
+    return rc;
+}
+
+/*
+ *  seg_read_manifest
+ *      path:  file name of the manifest
+ *      *hdr:  set to the manifest header
+ *
+ *  A manifest is only accepted if its segments tile at least the id range
+ *  of a single file and every segment holds whole scan blocks, so no scan
+ *  block or punched range ever crosses into the next segment.  Ids past
+ *  SEG_MAX_STD_ID are never used, see seg_max_id().
+ *
+ *  returns:  NO_ERROR       manifest read
+ *            SRCH_NOT_FOUND there is no manifest, the database is one file
+ *            ERR_DB_FILE    the manifest is damaged
+ */
+static int seg_read_manifest(const char *path, seg_manifest_t *hdr)
+{
+    seg_entry_t entry;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return (errno == ENOENT) ? SRCH_NOT_FOUND : ERR_DB_FILE;
+    }
+
+    int rc = NO_ERROR;
+    if (pread(fd, hdr, sizeof(seg_manifest_t), 0) != sizeof(seg_manifest_t) ||
+        hdr->magic != SEG_MAGIC || hdr->seg_ids == 0 ||
+        ((off_t)hdr->seg_ids * sizeof(student_t)) % DB_SCAN_BLOCK != 0 ||
+        (uint64_t)hdr->nsegs * hdr->seg_ids <= MAX_STD_ID ||
+        hdr->nsegs > SEG_MAX_STD_ID / hdr->seg_ids + 1)
+    {
+        rc = ERR_DB_FILE;
+    }
+    for (uint32_t i = 0; rc == NO_ERROR && i < hdr->nsegs; i++)
+    {
+        off_t at = sizeof(seg_manifest_t) + i * sizeof(seg_entry_t);
+        if (pread(fd, &entry, sizeof(entry), at) != sizeof(entry) ||
+            entry.first_id != (int64_t)i * hdr->seg_ids ||
+            entry.last_id != entry.first_id + hdr->seg_ids - 1)
+        {
+            rc = ERR_DB_FILE;
+        }
+    }
+    close(fd);
+
+    return rc;
+}
+
+/*
+ *  seg_fd_limit
+ *
+ *  Raises the soft limit on open files towards the hard one, so that a
+ *  database with records in every segment can keep all of them open next
+ *  to SEG_FD_SPARE other files.
+ *
+ *  returns:  nothing, a segment that can not be opened is an I/O error
+ */
+static void seg_fd_limit(void)
+{
+    struct rlimit rl;
+    rlim_t want = (rlim_t)seg_n + SEG_FD_SPARE;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < want)
+    {
+        rl.rlim_cur = (rl.rlim_max < want) ? rl.rlim_max : want;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+/*
+ *  seg_open
+ *      dbFile:    name of the database file
+ *      db_fd:     linux file descriptor of the database, locked
+ *      truncate:  empty every segment
+ *
+ *  Called by open_db() for every database.  If dbFile SEG_DIR_SUFFIX holds
+ *  a manifest the database is segmented and the record helpers route db_fd
+ *  here until seg_close().
+ *
+ *  returns:  NO_ERROR       on success, also for a database in one file
+ *            ERR_DB_FILE    the manifest or a segment can not be used
+ */
+int seg_open(char *dbFile, int db_fd, bool truncate)
+{
+    seg_manifest_t hdr;
+    char path[PATH_MAX];
+
+    snprintf(seg_dir, sizeof(seg_dir), "%s%s", dbFile, SEG_DIR_SUFFIX);
+    if (seg_path(path, sizeof(path), seg_dir, -1) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+    int rc = seg_read_manifest(path, &hdr);
+    if (rc != NO_ERROR)
+    {
+        return (rc == SRCH_NOT_FOUND) ? NO_ERROR : ERR_DB_FILE;
+    }
+
+    seg_fds = malloc(hdr.nsegs * sizeof(int));
+    if (seg_fds == NULL)
+    {
+        return ERR_DB_FILE;
+    }
+    for (uint32_t i = 0; i < hdr.nsegs; i++)
+    {
+        seg_fds[i] = -1;
+    }
+    seg_n = hdr.nsegs;
+    seg_ids = hdr.seg_ids;
+    seg_len = (off_t)hdr.seg_ids * sizeof(student_t);
+    seg_filled = 0;
+    seg_anchor = db_fd;
+    seg_fd_limit();
+
+    for (int i = 0; truncate && i < seg_n; i++)
+    {
+        int fd = seg_fd(i, false);
+        if ((fd == -1) ? errno != ENOENT : ftruncate(fd, 0) == -1)
+        {
+            seg_close(db_fd);
+            return ERR_DB_FILE;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  seg_close
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Closes the segment files, harmless for a database in one file.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void seg_close(int db_fd)
+{
+    if (db_fd != seg_anchor)
+    {
+        return;
+    }
+
+    for (int i = 0; i < seg_n; i++)
+    {
+        if (seg_fds[i] != -1)
+        {
+            close(seg_fds[i]);
+        }
+    }
+    free(seg_fds);
+    seg_fds = NULL;
+    seg_n = 0;
+    seg_anchor = -1;
+}
+
+/*
+ *  seg_active
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  returns:  true if db_fd is a segmented database
+ */
+bool seg_active(int db_fd)
+{
+    return db_fd != -1 && db_fd == seg_anchor;
+}
+
+/*
+ *  seg_count
+ *
+ *  returns:  the number of segments of the open segmented database
+ */
+int seg_count(void)
+{
+    return seg_n;
+}
+
+/*
+ *  seg_max_id
+ *
+ *  returns:  the largest id of the open segmented database, the last id of
+ *            its manifest up to SEG_MAX_STD_ID
+ */
+int seg_max_id(void)
+{
+    int64_t last = (int64_t)seg_n * seg_ids - 1;
+
+    return (last < SEG_MAX_STD_ID) ? (int)last : SEG_MAX_STD_ID;
+}
+
+/*
+ *  seg_read
+ *      buf:     destination buffer
+ *      len:     number of bytes to read
+ *      offset:  offset in the database
+ *
+ *  pread() across the segments.
+ *
+ *  returns:  number of bytes read, 0 at EOF, or -1 on error
+ */
+ssize_t seg_read(void *buf, size_t len, off_t offset)
+{
+    size_t got = 0;
+
+    while (got < len && offset / seg_len < seg_n)
+    {
+        int fd = seg_fd(offset / seg_len, false);
+        if (fd == -1 && errno != ENOENT)
+        {
+            return -1;
+        }
+        if (fd == -1)
+        {
+            break; // past the last segment written
+        }
+
+        off_t at = offset % seg_len;
+        size_t want = (len - got < (size_t)(seg_len - at)) ? len - got : (size_t)(seg_len - at);
+        ssize_t n = pread(fd, (char *)buf + got, want, at);
+        if (n == -1)
+        {
+            return -1;
+        }
+        got += n;
+        offset += n;
+        if ((size_t)n < want)
+        {
+            break; // EOF of the last segment
+        }
+    }
+
+    return got;
+}
+
+/*
+ *  seg_write
+ *      buf:     source buffer
+ *      len:     number of bytes to write
+ *      offset:  offset in the database
+ *
+ *  pwrite() across the segments, new segments are created as needed.
+ *
+ *  returns:  number of bytes written, or -1 on error
+ */
+ssize_t seg_write(const void *buf, size_t len, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        int seg = offset / seg_len;
+        int fd = (seg < seg_n && seg_fill(seg) == NO_ERROR) ? seg_fd(seg, true) : -1;
+        if (fd == -1)
+        {
+            return -1;
+        }
+
+        off_t at = offset % seg_len;
+        size_t want = (len - done < (size_t)(seg_len - at)) ? len - done : (size_t)(seg_len - at);
+        ssize_t n = pwrite(fd, (const char *)buf + done, want, at);
+        if (n == -1)
+        {
+            return -1;
+        }
+        done += n;
+        offset += n;
+    }
+
+    return done;
+}
+
+/*
+ *  seg_resize
+ *      size:  new size of the database
+ *
+ *  ftruncate() across the segments, the segments below size are full size
+ *  and the ones past it are emptied.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    segment file I/O issue
+ */
+int seg_resize(off_t size)
+{
+    if (size > (off_t)seg_n * seg_len)
+    {
+        return ERR_DB_FILE;
+    }
+
+    for (int i = 0; i < seg_n; i++)
+    {
+        off_t want = size - i * seg_len;
+        want = (want < 0) ? 0 : (want > seg_len) ? seg_len : want;
+
+        int fd = seg_fd(i, want > 0);
+        if (fd != -1 && ftruncate(fd, want) == -1)
+        {
+            return ERR_DB_FILE;
+        }
+        if (fd == -1 && (want > 0 || errno != ENOENT))
+        {
+            return ERR_DB_FILE;
+        }
+    }
+    seg_filled = size / seg_len;
+
+    return NO_ERROR;
+}
+
+/*
+ *  seg_punch
+ *      offset:  start of the range
+ *      len:     bytes in the range
+ *
+ *  fallocate(FALLOC_FL_PUNCH_HOLE) across the segments.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_OP      the file system can not punch holes
+ *            ERR_DB_FILE    segment file I/O issue
+ */
+int seg_punch(off_t offset, off_t len)
+{
+    while (len > 0)
+    {
+        off_t at = offset % seg_len;
+        off_t n = (len < seg_len - at) ? len : seg_len - at;
+
+        int fd = (offset / seg_len < seg_n) ? seg_fd(offset / seg_len, false) : -1;
+        if (fd == -1 && offset / seg_len < seg_n && errno != ENOENT)
+        {
+            return ERR_DB_FILE;
+        }
+        if (fd != -1 && fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, at, n) == -1)
+        {
+            return (errno == EOPNOTSUPP) ? ERR_DB_OP : ERR_DB_FILE;
+        }
+        offset += n;
+        len -= n;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  seg_seek
+ *      offset:  offset in the database
+ *      whence:  SEEK_DATA, SEEK_HOLE or SEEK_END
+ *
+ *  lseek() across the segments.  SEEK_DATA moves on to the next segment
+ *  with data, a segment boundary always counts as the start of a hole.
+ *  SEEK_END is the end of the last segment that holds anything.
+ *
+ *  returns:  the resulting offset, or -1 with errno set
+ */
+off_t seg_seek(off_t offset, int whence)
+{
+    struct stat st;
+
+    if (whence == SEEK_END)
+    {
+        for (int i = seg_n - 1; i >= 0; i--)
+        {
+            int fd = seg_fd(i, false);
+            if ((fd == -1) ? errno != ENOENT : fstat(fd, &st) == -1)
+            {
+                return -1;
+            }
+            if (fd != -1 && st.st_size > 0)
+            {
+                return i * seg_len + st.st_size + offset;
+            }
+        }
+        return offset;
+    }
+
+    for (int i = offset / seg_len; i < seg_n; i++)
+    {
+        off_t at = (i == offset / seg_len) ? offset % seg_len : 0;
+        int fd = seg_fd(i, false);
+        off_t found = (fd == -1) ? -1 : lseek(fd, at, whence);
+        if (found != -1)
+        {
+            return i * seg_len + found;
+        }
+        if ((fd == -1) ? errno != ENOENT : errno != ENXIO)
+        {
+            return -1;
+        }
+        if (whence == SEEK_HOLE)
+        {
+            break; // offset is past the end of its segment
+        }
+    }
+
+    errno = ENXIO;
+    return -1;
+}
+
+/*
+ *  seg_sync
+ *
+ *  fdatasync() of every segment opened so far, the others were not written.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    segment file I/O issue
+ */
+int seg_sync(void)
+{
+    int rc = NO_ERROR;
+
+    for (int i = 0; i < seg_n; i++)
+    {
+        if (seg_fds[i] != -1 && fdatasync(seg_fds[i]) == -1)
+        {
+            rc = ERR_DB_FILE;
+        }
+    }
+
+    return rc;
+}
+
+// One thread of seg_parallel(), the threads take the segments in turn
+typedef struct seg_worker {
+    seg_part_fn part;
+    void *arg;
+    int next;                       // next segment to hand out, shared
+    int rc;                         // ERR_DB_FILE once any segment failed
+} seg_worker_t;
+
+/*
+ *  seg_worker
+ *
+ *  pthread entry point of seg_parallel().
+ */
+static void *seg_worker(void *arg)
+{
+    seg_worker_t *w = arg;
+
+    for (;;)
+    {
+        int seg = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED);
+        if (seg >= seg_n)
+        {
+            break;
+        }
+        if (w->part(seg, seg * seg_len, (seg + 1) * seg_len, w->arg) != NO_ERROR)
+        {
+            __atomic_store_n(&w->rc, ERR_DB_FILE, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ *  seg_parallel
+ *      part:  runs the maintenance of one segment
+ *      arg:   passed to part
+ *
+ *  Runs part for every segment, on one thread per CPU up to
+ *  DB_SCAN_THREADS.  Segments are independent files, so compress and backup
+ *  work on them side by side.
+ *
+ *  returns:  NO_ERROR       part succeeded for every segment
+ *            ERR_DB_FILE    part failed for any of them
+ */
+int seg_parallel(seg_part_fn part, void *arg)
+{
+    pthread_t threads[DB_SCAN_THREADS];
+    bool started[DB_SCAN_THREADS] = { false };
+    seg_worker_t w = { part, arg, 0, NO_ERROR };
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = (cpus < DB_SCAN_THREADS) ? (int)cpus : DB_SCAN_THREADS;
+    if (nthreads > seg_n)
+    {
+        nthreads = seg_n;
+    }
+
+    // The calling thread takes its share too
+    for (int i = 1; i < nthreads; i++)
+    {
+        started[i] = pthread_create(&threads[i], NULL, seg_worker, &w) == 0;
+    }
+    seg_worker(&w);
+    for (int i = 1; i < nthreads; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    return w.rc;
+}
+
+/*
+ *  seg_copy_file
+ *      from:  fd of the file to copy
+ *      to:    file name of the copy
+ *
+ *  Copies a sparse file extent by extent, the holes stay holes.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    file I/O issue
+ */
+int seg_copy_file(int from, const char *to)
+{
+    struct stat st;
+
+    char *buf = malloc(DB_SCAN_BLOCK);
+    int fd = open(to, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    bool ok = (buf != NULL && fd != -1 && fstat(from, &st) == 0);
+
+    off_t position = 0;
+    while (ok && position < st.st_size)
+    {
+        off_t start = lseek(from, position, SEEK_DATA);
+        off_t end = (start == -1) ? -1 : lseek(from, start, SEEK_HOLE);
+        if (start == -1 && errno == ENXIO)
+        {
+            break; // the file ends in a hole
+        }
+        if (start == -1 && errno == EINVAL)
+        {
+            start = position; // no hole support, copy everything
+            end = st.st_size;
+        }
+        ok = (start != -1 && end != -1);
+
+        for (position = start; ok && position < end;)
+        {
+            size_t want = (end - position < DB_SCAN_BLOCK) ? end - position : DB_SCAN_BLOCK;
+            ssize_t n = pread(from, buf, want, position);
+            ok = (n > 0 && pwrite(fd, buf, n, position) == n);
+            position += n;
+        }
+    }
+    ok = ok && ftruncate(fd, st.st_size) == 0 && fdatasync(fd) == 0;
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    free(buf);
+    return ok ? NO_ERROR : ERR_DB_FILE;
+}
+
+/*
+ *  seg_backup_part
+ *
+ *  seg_parallel() part of seg_backup(), copies one segment file.
+ */
+static int seg_backup_part(int seg, off_t start, off_t end, void *arg)
+{
+    char path[PATH_MAX];
+    (void)start;
+    (void)end;
+
+    int fd = seg_fd(seg, false);
+    if (fd == -1)
+    {
+        // never written, nothing to copy
+        return (errno == ENOENT) ? NO_ERROR : ERR_DB_FILE;
+    }
+    if (seg_path(path, sizeof(path), arg, seg) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+    return seg_copy_file(fd, path);
+}
+
+/*
+ *  seg_backup
+ *      dir:  directory the backup goes to, the segment directory of the
+ *            backup is created in it under the same name
+ *
+ *  Copies the manifest and all segments, the segments in parallel.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    file I/O issue
+ */
+int seg_backup(const char *dir)
+{
+    char path[PATH_MAX];
+    char to[PATH_MAX];
+
+    int n = snprintf(to, sizeof(to), "%s/%s", dir, seg_dir);
+    if (n < 0 || (size_t)n >= sizeof(to) ||
+        (mkdir(to, S_IRWXU | S_IRGRP | S_IXGRP) == -1 && errno != EEXIST))
+    {
+        return ERR_DB_FILE;
+    }
+
+    int fd = -1;
+    if (seg_path(path, sizeof(path), seg_dir, -1) == NO_ERROR)
+    {
+        fd = open(path, O_RDONLY);
+    }
+    int rc = (fd == -1) ? ERR_DB_FILE : NO_ERROR;
+    if (rc == NO_ERROR)
+    {
+        rc = seg_path(path, sizeof(path), to, -1);
+        if (rc == NO_ERROR)
+        {
+            rc = seg_copy_file(fd, path);
+        }
+        close(fd);
+    }
+
+    return (rc == NO_ERROR) ? seg_parallel(seg_backup_part, to) : rc;
+}
+
+/*
+ *  seg_remove_dir
+ *      dir:  directory to remove
+ *
+ *  Removes a segment directory and the files in it.
+ *
+ *  returns:  NO_ERROR       on success, or if there is no such directory
+ *            ERR_DB_FILE    file I/O issue
+ */
+static int seg_remove_dir(const char *dir)
+{
+    struct dirent *ent;
+
+    DIR *d = opendir(dir);
+    if (d == NULL)
+    {
+        return (errno == ENOENT) ? NO_ERROR : ERR_DB_FILE;
+    }
+    while ((ent = readdir(d)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+        {
+            unlinkat(dirfd(d), ent->d_name, 0);
+        }
+    }
+    closedir(d);
+
+    return (rmdir(dir) == -1) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  seg_create
+ *      dbFile:  name of the database file
+ *      recs:    the students, sorted by id
+ *      n:       number of students
+ *
+ *  Writes a new segment directory with the students at their slots, next
+ *  to the database under a temporary name, and renames it into place once
+ *  it is durable.  The records are not routed through seg_write(), the
+ *  database the caller holds is still the single file.
+ *
+ *  returns:  <number>       segments in the manifest
+ *            ERR_DB_FILE    file I/O issue
+ */
+int seg_create(char *dbFile, const student_t *recs, size_t n)
+{
+    char dir[256];
+    char tmp[PATH_MAX];
+    char path[PATH_MAX];
+    seg_manifest_t hdr = { SEG_MAGIC, SEG_IDS, SEG_MAX_STD_ID / SEG_IDS + 1, 0 };
+    off_t len = (off_t)SEG_IDS * sizeof(student_t);
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+
+    snprintf(dir, sizeof(dir), "%s%s", dbFile, SEG_DIR_SUFFIX);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dir);
+    if (seg_remove_dir(tmp) != NO_ERROR || mkdir(tmp, S_IRWXU | S_IRGRP | S_IXGRP) == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    // The manifest lists every segment with its id range
+    FILE *f = NULL;
+    if (seg_path(path, sizeof(path), tmp, -1) == NO_ERROR)
+    {
+        f = fopen(path, "w");
+    }
+    bool ok = (f != NULL) && fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    for (uint32_t i = 0; ok && i < hdr.nsegs; i++)
+    {
+        seg_entry_t entry = { (int64_t)i * SEG_IDS, (int64_t)(i + 1) * SEG_IDS - 1 };
+        ok = fwrite(&entry, sizeof(entry), 1, f) == 1;
+    }
+    ok = (f != NULL) && fflush(f) == 0 && fdatasync(fileno(f)) == 0 && ok;
+    if (f != NULL)
+    {
+        fclose(f);
+    }
+
+    // One write per run of consecutive ids inside a segment, the segments
+    // below the last one are full size
+    int last = (n > 0) ? recs[n - 1].id / SEG_IDS : -1;
+    for (int seg = 0; ok && seg <= last; seg++)
+    {
+        int fd = -1;
+        if (seg_path(path, sizeof(path), tmp, seg) == NO_ERROR)
+        {
+            fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+        }
+        ok = (fd != -1) && (seg == last || ftruncate(fd, len) == 0);
+        while (ok && n > 0 && recs->id / SEG_IDS == seg)
+        {
+            size_t run = 1;
+            while (run < n && recs[run].id == recs->id + (int)run && recs[run].id / SEG_IDS == seg)
+            {
+                run++;
+            }
+            size_t bytes = run * sizeof(student_t);
+            off_t at = (off_t)(recs->id % SEG_IDS) * sizeof(student_t);
+            ok = pwrite(fd, recs, bytes, at) == (ssize_t)bytes;
+            recs += run;
+            n -= run;
+        }
+        ok = ok && fdatasync(fd) == 0;
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+
+    // A directory without a manifest is left over from an interrupted -j
+    if (!ok || seg_remove_dir(dir) != NO_ERROR || rename(tmp, dir) == -1)
+    {
+        seg_remove_dir(tmp);
+        return ERR_DB_FILE;
+    }
+
+    return hdr.nsegs;
+}
+
+/*
+ *  seg_remove
+ *      dbFile:  name of the database file
+ *
+ *  Removes the segment directory of a database that was joined back into
+ *  one file.  The manifest goes first, so an interrupted removal leaves a
+ *  database in one file behind.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    file I/O issue
+ */
+int seg_remove(char *dbFile)
+{
+    char dir[256];
+    char path[PATH_MAX];
+
+    snprintf(dir, sizeof(dir), "%s%s", dbFile, SEG_DIR_SUFFIX);
+    if (seg_path(path, sizeof(path), dir, -1) != NO_ERROR ||
+        (unlink(path) == -1 && errno != ENOENT))
+    {
+        return ERR_DB_FILE;
+    }
+
+    return seg_remove_dir(dir);
+}
@@ -0,0 +1,661 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Server mode.  run_server() loads every student into a table indexed by id
+// and answers add, count, delete, find and print requests from the table,
+// so a request costs a socket round trip instead of a process that opens
+// and scans the database.  The table holds the chunks of ids that have
+// students, see sdb_idtab.c.  Changes are queued as dirty and written back
+// by a flusher thread every SERVER_FLUSH_MS through store_students(), which
+// commits them to the write-ahead log as one group.
+//
+// The table, the dirty ids and the count are shared with the flusher and
+// protected by table_lock.
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_wakeup = PTHREAD_COND_INITIALIZER;
+static id_table_t table;            // the entry of an id holds that student
+static int *dirty;                  // slots changed since the last flush, an
+static size_t ndirty;               // id can be queued more than once
+static size_t dirty_cap;
+static int live;                    // students in the table
+static bool flusher_stop;           // set once the server shuts down
+static volatile sig_atomic_t server_stop;
+
+/*
+ *  server_path
+ *      path:  buffer for the socket name
+ *      len:   size of the buffer
+ *
+ *  The socket sits next to the database, named DB_FILE SERVER_SOCK_SUFFIX.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void server_path(char *path, size_t len)
+{
+    snprintf(path, len, "%s%s", DB_FILE, SERVER_SOCK_SUFFIX);
+}
+
+/*
+ *  write_all
+ *      fd:   socket
+ *      buf:  bytes to send
+ *      len:  number of bytes
+ *
+ *  returns:  NO_ERROR       everything was sent
+ *            ERR_DB_FILE    the peer went away
+ */
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t sent = write(fd, p, len);
+        if (sent == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return ERR_DB_FILE;
+        }
+        p += sent;
+        len -= sent;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  read_all
+ *      fd:   socket
+ *      buf:  destination
+ *      len:  number of bytes expected
+ *
+ *  returns:  NO_ERROR       all len bytes arrived
+ *            ERR_DB_FILE    the peer went away first
+ */
+static int read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0)
+    {
+        ssize_t got = read(fd, p, len);
+        if (got == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return ERR_DB_FILE;
+        }
+        p += got;
+        len -= got;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  mark_dirty
+ *      id:  slot that is about to change, table_lock must be held
+ *
+ *  returns:  NO_ERROR       id is queued for the next flush
+ *            ERR_DB_FILE    out of memory, the slot must not change
+ */
+static int mark_dirty(int id)
+{
+    if (ndirty == dirty_cap)
+    {
+        size_t cap = dirty_cap ? 2 * dirty_cap : 1024;
+        int *grown = realloc(dirty, cap * sizeof(int));
+        if (grown == NULL)
+        {
+            return ERR_DB_FILE;
+        }
+        dirty = grown;
+        dirty_cap = cap;
+    }
+    dirty[ndirty++] = id;
+
+    return NO_ERROR;
+}
+
+/*
+ *  table_student
+ *      id:  student id, table_lock must be held
+ *
+ *  returns:  the student with this id, NULL if there is none
+ */
+static student_t *table_student(int id)
+{
+    student_t *s = idtab_get(&table, id);
+
+    return (s != NULL && s->id == id && id >= MIN_STD_ID) ? s : NULL;
+}
+
+/*
+ *  print_table_row
+ *      out:     console output for the client
+ *      *s:      student to print
+ *      header:  print the column header first
+ *
+ *  Same format as print_student() and print_db().
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void print_table_row(FILE *out, const student_t *s, bool header)
+{
+    char row[STUDENT_ROW_MAX];
+
+    if (header)
+    {
+        fprintf(out, STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+    }
+
+    fwrite(row, 1, format_student(row, s), out);
+}
+
+/*
+ *  serve_request
+ *      *req:  the request
+ *      out:   console output for the client
+ *
+ *  Runs one request against the table, printing exactly what the command
+ *  prints when it runs against the database file.
+ *
+ *  returns:  the exit code of the command
+ */
+static int serve_request(const server_request_t *req, FILE *out)
+{
+    int id = req->student.id;
+    bool valid_id = (id >= MIN_STD_ID && id <= table.max_id);
+    bool header_printed = false;
+    int exit_code = EXIT_OK;
+    student_t *s;
+
+    pthread_mutex_lock(&table_lock);
+    switch (req->op)
+    {
+    case 'a':
+        if (!valid_id || table_student(id) != NULL)
+        {
+            fprintf(out, M_ERR_DB_ADD_DUP, id);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        s = idtab_put(&table, id);
+        if (s == NULL || mark_dirty(id) != NO_ERROR)
+        {
+            fprintf(out, M_ERR_DB_WRITE);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        *s = req->student;
+        live++;
+        fprintf(out, M_STD_ADDED, id);
+        break;
+
+    case 'c':
+        if (live == 0)
+        {
+            fprintf(out, M_DB_EMPTY);
+        }
+        else
+        {
+            fprintf(out, M_DB_RECORD_CNT, live);
+        }
+        break;
+
+    case 'd':
+        s = table_student(id);
+        if (s == NULL)
+        {
+            fprintf(out, M_STD_NOT_FND_MSG, id);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        if (mark_dirty(id) != NO_ERROR)
+        {
+            fprintf(out, M_ERR_DB_WRITE);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        *s = EMPTY_STUDENT_RECORD;
+        live--;
+        fprintf(out, M_STD_DEL_MSG, id);
+        break;
+
+    case 'f':
+        s = table_student(id);
+        if (s == NULL)
+        {
+            fprintf(out, M_STD_NOT_FND_MSG, id);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        print_table_row(out, s, true);
+        break;
+
+    case 'p':
+        if (live == 0)
+        {
+            fprintf(out, M_DB_EMPTY);
+            break;
+        }
+        for (int i = idtab_next(&table, MIN_STD_ID); i >= 0; i = idtab_next(&table, i + 1))
+        {
+            s = table_student(i);
+            if (s != NULL)
+            {
+                print_table_row(out, s, !header_printed);
+                header_printed = true;
+            }
+        }
+        break;
+
+    default:
+        fprintf(out, M_ERR_SERVER_OP);
+        exit_code = EXIT_FAIL_ARGS;
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    return exit_code;
+}
+
+/*
+ *  serve_client
+ *      client:  accepted connection
+ *
+ *  Reads one request, answers it and closes the connection.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void serve_client(int client)
+{
+    server_request_t req;
+    server_reply_t reply;
+    char *text = NULL;
+    size_t text_len = 0;
+
+    FILE *out = open_memstream(&text, &text_len);
+    if (out != NULL && read_all(client, &req, sizeof(req)) == NO_ERROR)
+    {
+        reply.exit_code = serve_request(&req, out);
+        fclose(out);
+        out = NULL;
+        reply.len = text_len;
+        if (write_all(client, &reply, sizeof(reply)) == NO_ERROR)
+        {
+            write_all(client, text, text_len);
+        }
+    }
+    if (out != NULL)
+    {
+        fclose(out);
+    }
+    free(text);
+    close(client);
+}
+
+/*
+ *  compare_int
+ *
+ *  qsort() comparator of ids.
+ */
+static int compare_int(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ *  flush_changes
+ *      fd:  linux file descriptor of the database
+ *
+ *  Takes the dirty slots out of the table and writes them with a single
+ *  store_students() call, outside of table_lock so requests are not held
+ *  up by the disk.  Slots that fail to write are marked dirty again.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int flush_changes(int fd)
+{
+    int rc = NO_ERROR;
+
+    pthread_mutex_lock(&table_lock);
+    int *ids = dirty;
+    size_t queued = ndirty;
+    dirty = NULL;
+    ndirty = 0;
+    dirty_cap = 0;
+
+    // Each slot is written once, with what it holds now
+    qsort(ids, queued, sizeof(int), compare_int);
+    size_t n = 0;
+    for (size_t i = 0; i < queued; i++)
+    {
+        if (n == 0 || ids[i] != ids[n - 1])
+        {
+            ids[n++] = ids[i];
+        }
+    }
+    student_t *images = malloc((n + 1) * sizeof(student_t));
+    for (size_t i = 0; images != NULL && i < n; i++)
+    {
+        student_t *s = idtab_get(&table, ids[i]);
+        images[i] = (s != NULL) ? *s : EMPTY_STUDENT_RECORD;
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    if (n > 0 && (images == NULL || store_students(fd, ids, images, n) != NO_ERROR))
+    {
+        pthread_mutex_lock(&table_lock);
+        for (size_t i = 0; i < n; i++)
+        {
+            mark_dirty(ids[i]);
+        }
+        pthread_mutex_unlock(&table_lock);
+        rc = ERR_DB_FILE;
+    }
+
+    free(ids);
+    free(images);
+    return rc;
+}
+
+/*
+ *  flusher
+ *      arg:  pointer to the database fd
+ *
+ *  Background thread, flushes every SERVER_FLUSH_MS and once more when the
+ *  server stops.
+ *
+ *  returns:  NULL
+ */
+static void *flusher(void *arg)
+{
+    int fd = *(int *)arg;
+    bool stop = false;
+
+    while (!stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += SERVER_FLUSH_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        pthread_mutex_lock(&table_lock);
+        if (!flusher_stop)
+        {
+            pthread_cond_timedwait(&flush_wakeup, &table_lock, &deadline);
+        }
+        stop = flusher_stop;
+        pthread_mutex_unlock(&table_lock);
+
+        if (flush_changes(fd) != NO_ERROR)
+        {
+            fprintf(stderr, M_ERR_DB_WRITE);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ *  stop_server
+ *
+ *  SIGINT and SIGTERM handler, the accept loop notices within
+ *  SERVER_POLL_MS.
+ */
+static void stop_server(int sig)
+{
+    (void)sig;
+    server_stop = 1;
+}
+
+/*
+ *  server_listen
+ *
+ *  Creates the server socket.  It is bound and listening under a temporary
+ *  name before it is renamed into place, so a client never finds a socket
+ *  that refuses it.  The rename replaces a socket file left behind by a
+ *  server that died, a live server keeps its socket.
+ *
+ *  returns:  the listening socket, or -1 on error
+ */
+static int server_listen(void)
+{
+    struct sockaddr_un addr;
+    struct sockaddr_un tmp;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    server_path(addr.sun_path, sizeof(addr.sun_path));
+    tmp = addr;
+    if (snprintf(tmp.sun_path, sizeof(tmp.sun_path), "%s.%d", addr.sun_path, (int)getpid()) >=
+        (int)sizeof(tmp.sun_path))
+    {
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1)
+    {
+        return -1;
+    }
+
+    // Somebody accepts on the socket of a live server
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        close(sock);
+        return -1;
+    }
+    close(sock);
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1)
+    {
+        return -1;
+    }
+    unlink(tmp.sun_path);
+    if (bind(sock, (struct sockaddr *)&tmp, sizeof(tmp)) == -1 ||
+        listen(sock, SERVER_BACKLOG) == -1 || rename(tmp.sun_path, addr.sun_path) == -1)
+    {
+        close(sock);
+        unlink(tmp.sun_path);
+        return -1;
+    }
+
+    return sock;
+}
+
+/*
+ *  run_server
+ *      fd:  linux file descriptor of the database, opened with
+ *           DB_ACCESS_EXCLUSIVE so the table stays the only copy that changes
+ *
+ *  Serves requests until SIGINT or SIGTERM, then writes back the last
+ *  changes.  Packed legacy databases are compressed into the positional
+ *  layout first, the flusher writes slots by id.
+ *
+ *  returns:  <number>       the fd of the database, it changes if the
+ *                           database had to be compressed
+ *            ERR_DB_FILE    database file or socket issue
+ *
+ *  console:  M_SERVER_STARTED   once requests are accepted
+ *            M_SERVER_STOPPED   after the last changes were written
+ *            M_ERR_SERVER_SOCK  the socket could not be set up
+ *            M_ERR_DB_READ      error reading the database file
+ *            M_ERR_DB_WRITE     error writing the database file
+ */
+int run_server(int fd)
+{
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    pthread_t flush_thread;
+    int rc = NO_ERROR;
+
+    if (db_layout(fd) == DB_LAYOUT_PACKED)
+    {
+        fd = compress_db(fd);
+        if (fd < 0)
+        {
+            return ERR_DB_FILE;
+        }
+    }
+
+    live = idtab_init(&table, db_max_id(fd), sizeof(student_t));
+    if (live == NO_ERROR)
+    {
+        live = load_students(fd, &table);
+    }
+    if (live < 0)
+    {
+        idtab_free(&table);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    // Handlers go in before the socket appears, a background shell starts
+    // us with SIGINT ignored and a client may stop us right away
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_server;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN); // clients that hang up early are ignored
+
+    int sock = server_listen();
+    if (sock == -1)
+    {
+        idtab_free(&table);
+        printf(M_ERR_SERVER_SOCK);
+        return ERR_DB_FILE;
+    }
+    server_path(path, sizeof(path));
+
+    flusher_stop = false;
+    pthread_create(&flush_thread, NULL, flusher, &fd);
+
+    printf(M_SERVER_STARTED, DB_FILE, path);
+    fflush(stdout);
+
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    while (!server_stop)
+    {
+        if (poll(&pfd, 1, SERVER_POLL_MS) <= 0)
+        {
+            continue;
+        }
+        int client = accept(sock, NULL, NULL);
+        if (client >= 0)
+        {
+            serve_client(client);
+        }
+    }
+
+    // Stop taking requests, then let the flusher write the rest
+    close(sock);
+    unlink(path);
+    pthread_mutex_lock(&table_lock);
+    flusher_stop = true;
+    pthread_cond_signal(&flush_wakeup);
+    pthread_mutex_unlock(&table_lock);
+    pthread_join(flush_thread, NULL);
+
+    if (flush_changes(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        rc = ERR_DB_FILE;
+    }
+    idtab_free(&table);
+    free(dirty);
+    dirty = NULL;
+    ndirty = 0;
+    dirty_cap = 0;
+
+    printf(M_SERVER_STOPPED);
+    return (rc == NO_ERROR) ? fd : rc;
+}
+
+/*
+ *  server_request
+ *      op:  the option of the command, 'a', 'c', 'd', 'f' or 'p'
+ *      *s:  the student for a, only the id for d and f
+ *
+ *  Client side of the server mode, sends the command to the running server
+ *  and prints its answer.
+ *
+ *  returns:  the exit code of the command
+ *
+ *  console:  the output of the command
+ *            M_ERR_SERVER   no server is running
+ */
+int server_request(char op, const student_t *s)
+{
+    struct sockaddr_un addr;
+    server_request_t req;
+    server_reply_t reply;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    server_path(addr.sun_path, sizeof(addr.sun_path));
+
+    memset(&req, 0, sizeof(req));
+    req.op = op;
+    if (s != NULL)
+    {
+        req.student = *s;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        write_all(sock, &req, sizeof(req)) != NO_ERROR ||
+        read_all(sock, &reply, sizeof(reply)) != NO_ERROR)
+    {
+        if (sock != -1)
+        {
+            close(sock);
+        }
+        printf(M_ERR_SERVER);
+        return EXIT_FAIL_DB;
+    }
+
+    char buf[4096];
+    size_t left = reply.len;
+    while (left > 0)
+    {
+        size_t chunk = (left < sizeof(buf)) ? left : sizeof(buf);
+        if (read_all(sock, buf, chunk) != NO_ERROR)
+        {
+            close(sock);
+            printf(M_ERR_SERVER);
+            return EXIT_FAIL_DB;
+        }
+        fwrite(buf, 1, chunk, stdout);
+        left -= chunk;
+    }
+
+    close(sock);
+    return reply.exit_code;
+}
@@ -0,0 +1,682 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h> //c library for system call file routines
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Snapshot reads.  A reader opened with DB_ACCESS_SNAPSHOT sees the database
+// as it was when it was opened, while writers keep adding and deleting
+// students next to it without waiting.  Every add or delete, and every run
+// of a -b batch as a whole, is one write between snap_begin() and
+// snap_end(), under the DB_LOCK_SNAP lock byte, and gets the next version of
+// the sidecar header.  A reader takes a reader slot, holding its lock byte
+// for as long as it reads, and remembers the last version that ended.  It
+// never takes the commit lock, so it does not wait for an open write.
+//
+// Before a write changes a SNAP_BLOCK of the database for the first time,
+// snap_preserve() copies the block as it is into the sidecar and publishes
+// an entry for it.  After each read a reader puts back the oldest image
+// saved after its version, so it never sees any part of a write that had
+// not ended when it started.  The entries are dropped by the first write
+// after the last reader left.  If they run out while readers are open, the
+// readers are told to give up with the oldest version, rather than letting
+// writers wait.
+//
+// Only writers create the sidecar.  A reader that finds none sees the
+// database as it is, the first writer finds the reader's slot lock and
+// keeps the images for it, see snap_attach().
+static char snap_path[256];             // name of the sidecar
+static int snap_fd = -1;                // fd of the sidecar, -1 if not open
+static int snap_db_fd = -1;             // database the sidecar belongs to
+static snap_header_t *snap_hdr = MAP_FAILED;
+static pthread_mutex_t snap_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int snap_slot = -1;              // reader slot, -1 for a writer
+static uint64_t snap_seen;              // version of the reader's snapshot
+static off_t snap_db_size;              // database size at that version
+static uint64_t snap_txn;               // version of the open write, 0 if none
+static bool snap_saving;                // the open write still saves images
+static int snap_depth;                  // snap_begin() calls not ended yet
+
+/*
+ *  snap_lock
+ *      db_fd:  linux file descriptor of the database
+ *      cmd:    F_SETLKW to wait, F_SETLK to try, F_GETLK to test
+ *      type:   F_RDLCK, F_WRLCK or F_UNLCK
+ *      start:  the lock byte
+ *
+ *  returns:  NO_ERROR       the lock was taken, or for F_GETLK no other
+ *                           process holds it
+ *            ERR_DB_OP      another process holds the lock
+ *            ERR_DB_FILE    fcntl() failed
+ */
+static int snap_lock(int db_fd, int cmd, short type, off_t start)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = 1;
+
+    while (fcntl(db_fd, cmd, &fl) == -1)
+    {
+        if (errno == EACCES || errno == EAGAIN)
+        {
+            return ERR_DB_OP;
+        }
+        if (errno != EINTR)
+        {
+            return ERR_DB_FILE;
+        }
+    }
+    if (cmd == F_GETLK && fl.l_type != F_UNLCK)
+    {
+        return ERR_DB_OP;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  snap_unmap
+ *
+ *  Closes the sidecar without touching the lock bytes.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void snap_unmap(void)
+{
+    if (snap_hdr != MAP_FAILED)
+    {
+        munmap(snap_hdr, SNAP_DATA_AT);
+    }
+    if (snap_fd != -1)
+    {
+        close(snap_fd);
+    }
+    snap_hdr = MAP_FAILED;
+    snap_fd = -1;
+    snap_slot = -1;
+    snap_txn = 0;
+}
+
+/*
+ *  snap_map
+ *      create:  a writer creates the sidecar, readers only open it
+ *
+ *  Maps the sidecar header, harmless if it is mapped already.  The header
+ *  may still have to be set up by snap_attach().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    no sidecar or sidecar I/O issue
+ */
+static int snap_map(bool create)
+{
+    struct stat st;
+
+    if (snap_hdr != MAP_FAILED)
+    {
+        return NO_ERROR;
+    }
+
+    int fd = open(snap_path, create ? O_RDWR | O_CREAT : O_RDWR,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1)
+    {
+        return ERR_DB_FILE;
+    }
+    if (fstat(fd, &st) == -1 || (st.st_size < (off_t)SNAP_DATA_AT &&
+                                 (!create || ftruncate(fd, SNAP_DATA_AT) == -1)))
+    {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    snap_header_t *hdr = mmap(NULL, SNAP_DATA_AT, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+    {
+        close(fd);
+        return ERR_DB_FILE;
+    }
+
+    // Parallel scans map it lazily, see snap_header()
+    snap_fd = fd;
+    __atomic_store_n(&snap_hdr, hdr, __ATOMIC_RELEASE);
+    return NO_ERROR;
+}
+
+/*
+ *  snap_header
+ *
+ *  A reader that started before any writer created the sidecar maps it
+ *  once it is there.  Parallel scans share the mapping.
+ *
+ *  returns:  the sidecar header, NULL if no writer set it up yet, which
+ *            means nothing was saved for the reader
+ */
+static snap_header_t *snap_header(void)
+{
+    snap_header_t *hdr = __atomic_load_n(&snap_hdr, __ATOMIC_ACQUIRE);
+
+    if (hdr == MAP_FAILED)
+    {
+        pthread_mutex_lock(&snap_map_mutex);
+        snap_map(false);
+        hdr = snap_hdr;
+        pthread_mutex_unlock(&snap_map_mutex);
+    }
+    if (hdr == MAP_FAILED || __atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SNAP_MAGIC)
+    {
+        return NULL;
+    }
+
+    return hdr;
+}
+
+/*
+ *  snap_attach
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Takes the commit lock and maps the sidecar if that was not done yet.
+ *  The first writer sets the header up.  Readers that opened before that
+ *  found no sidecar and see the database as it was when the header was set
+ *  up, so their slots get the first version.
+ *
+ *  returns:  NO_ERROR       on success, the commit lock is held
+ *            ERR_DB_FILE    sidecar I/O issue, no lock is held
+ */
+static int snap_attach(int db_fd)
+{
+    if (snap_lock(db_fd, F_SETLKW, F_WRLCK, DB_LOCK_SNAP) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+    if (snap_map(true) != NO_ERROR)
+    {
+        snap_lock(db_fd, F_SETLK, F_UNLCK, DB_LOCK_SNAP);
+        return ERR_DB_FILE;
+    }
+
+    if (snap_hdr->magic != SNAP_MAGIC)
+    {
+        memset(snap_hdr, 0, sizeof(snap_header_t));
+        snap_hdr->version = SNAP_FIRST_VERSION;
+        snap_hdr->committed = SNAP_FIRST_VERSION;
+        __atomic_store_n(&snap_hdr->magic, SNAP_MAGIC, __ATOMIC_SEQ_CST);
+        for (int i = 0; i < SNAP_READERS; i++)
+        {
+            if (snap_lock(db_fd, F_GETLK, F_WRLCK, DB_LOCK_SNAP + 1 + i) == ERR_DB_OP)
+            {
+                snap_hdr->readers[i] = SNAP_FIRST_VERSION;
+            }
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  snap_register
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Takes a free reader slot and the last version that ended as the
+ *  snapshot.  The slot is published before the version is checked again,
+ *  so a write either finds the slot in snap_begin() or has not begun yet,
+ *  and a write that began meanwhile saves every block it changes anyway.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_OP      every reader slot is taken
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int snap_register(int db_fd)
+{
+    for (int i = 0; i < SNAP_READERS; i++)
+    {
+        int rc = snap_lock(db_fd, F_SETLK, F_WRLCK, DB_LOCK_SNAP + 1 + i);
+        if (rc == ERR_DB_OP)
+        {
+            continue;
+        }
+        if (rc != NO_ERROR)
+        {
+            return rc;
+        }
+
+        snap_slot = i;
+        snap_seen = SNAP_FIRST_VERSION;
+        if (snap_map(false) == NO_ERROR &&
+            __atomic_load_n(&snap_hdr->magic, __ATOMIC_ACQUIRE) == SNAP_MAGIC)
+        {
+            // Only the open write may have begun after the committed one
+            do
+            {
+                snap_seen = __atomic_load_n(&snap_hdr->committed, __ATOMIC_ACQUIRE);
+                __atomic_store_n(&snap_hdr->readers[i], snap_seen, __ATOMIC_SEQ_CST);
+            } while (__atomic_load_n(&snap_hdr->version, __ATOMIC_SEQ_CST) > snap_seen + 1);
+        }
+
+        snap_db_size = db_size(db_fd);
+        if (snap_db_size == -1)
+        {
+            snap_lock(db_fd, F_SETLK, F_UNLCK, DB_LOCK_SNAP + 1 + i);
+            snap_slot = -1;
+            return ERR_DB_FILE;
+        }
+        return NO_ERROR;
+    }
+
+    return ERR_DB_OP;
+}
+
+/*
+ *  snap_open
+ *      dbFile:  name of the database file, the sidecar is dbFile
+ *               SNAP_FILE_SUFFIX
+ *      db_fd:   linux file descriptor of the database, opened with a shared
+ *               session lock
+ *      reader:  true to take a snapshot, false for a writer
+ *
+ *  A reader takes its snapshot without waiting for writers.  A writer only
+ *  remembers the database here, snap_begin() creates the sidecar with the
+ *  first write, so sessions that end up not writing never touch it.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_OP      every reader slot is taken, nothing is open
+ *            ERR_DB_FILE    sidecar or database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int snap_open(char *dbFile, int db_fd, bool reader)
+{
+    snprintf(snap_path, sizeof(snap_path), "%s%s", dbFile, SNAP_FILE_SUFFIX);
+    snap_db_fd = db_fd;
+    if (!reader)
+    {
+        return NO_ERROR;
+    }
+
+    int rc = snap_register(db_fd);
+    if (rc != NO_ERROR)
+    {
+        snap_unmap();
+        snap_db_fd = -1;
+    }
+
+    return rc;
+}
+
+/*
+ *  snap_close
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Gives the reader slot back and closes the sidecar, harmless if it was
+ *  never opened for this database.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void snap_close(int db_fd)
+{
+    if (db_fd != snap_db_fd)
+    {
+        return;
+    }
+
+    if (snap_slot >= 0)
+    {
+        snap_header_t *hdr = snap_header();
+        if (hdr != NULL)
+        {
+            __atomic_store_n(&hdr->readers[snap_slot], 0, __ATOMIC_RELEASE);
+        }
+        snap_lock(db_fd, F_SETLK, F_UNLCK, DB_LOCK_SNAP + 1 + snap_slot);
+    }
+    snap_unmap();
+    snap_db_fd = -1;
+}
+
+/*
+ *  snap_reading
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  returns:  true if reads of the database go through a snapshot
+ */
+bool snap_reading(int db_fd)
+{
+    return snap_slot >= 0 && db_fd == snap_db_fd;
+}
+
+/*
+ *  snap_size
+ *
+ *  returns:  the size of the database when the snapshot was taken, scans
+ *            stop there
+ */
+off_t snap_size(void)
+{
+    return snap_db_size;
+}
+
+/*
+ *  snap_current
+ *
+ *  Indexes are kept up to date by the writers and have no saved images, a
+ *  snapshot reader may only use them while no write began since its
+ *  snapshot.  Check again after using them.
+ *
+ *  returns:  true if the database is still the snapshot
+ */
+bool snap_current(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    snap_header_t *hdr = snap_header();
+
+    return hdr == NULL || __atomic_load_n(&hdr->version, __ATOMIC_SEQ_CST) == snap_seen;
+}
+
+/*
+ *  snap_entry
+ *      *e:      entry of the sidecar
+ *      *block:  set to the block the entry saved
+ *
+ *  A writer reuses entries once no reader needs them, it clears saved
+ *  while it changes the entry.
+ *
+ *  returns:  version of the write that saved the block, 0 if the entry is
+ *            changing
+ */
+static uint64_t snap_entry(const snap_entry_t *e, int64_t *block)
+{
+    uint64_t saved = __atomic_load_n(&e->saved, __ATOMIC_ACQUIRE);
+
+    *block = __atomic_load_n(&e->block, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&e->saved, __ATOMIC_RELAXED) == saved ? saved : 0;
+}
+
+/*
+ *  snap_older_image
+ *      entries:  the published entries
+ *      n:        number of entries
+ *      i:        entry the reader could use
+ *      block:    the block entry i saved
+ *      saved:    version of entry i
+ *
+ *  returns:  true if another entry saved the same block later than the
+ *            snapshot but before entry i, that image is the one to use
+ */
+static bool snap_older_image(const snap_entry_t *entries, uint32_t n, uint32_t i,
+                             int64_t block, uint64_t saved)
+{
+    for (uint32_t j = 0; j < n; j++)
+    {
+        int64_t other;
+        uint64_t when = snap_entry(&entries[j], &other);
+        if (j != i && other == block && when > snap_seen && when < saved)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ *  snap_overlay
+ *      buf:     bytes just read from the database
+ *      offset:  file offset of buf[0]
+ *      len:     bytes in buf
+ *
+ *  Replaces what writers changed since the snapshot with the saved images.
+ *  Only reads the sidecar, so parallel scans can call it.
+ *
+ *  returns:  NO_ERROR       buf holds the snapshot
+ *            ERR_DB_OP      the snapshot was given up
+ *            ERR_DB_FILE    sidecar I/O issue
+ *
+ *  console:  M_ERR_SNAP_OLD  the snapshot was given up
+ */
+int snap_overlay(char *buf, off_t offset, size_t len)
+{
+    snap_header_t *hdr = snap_header();
+    if (hdr == NULL)
+    {
+        return NO_ERROR;
+    }
+
+    // Entries are only published once their image is written
+    uint32_t n = __atomic_load_n(&hdr->nentries, __ATOMIC_ACQUIRE);
+    const snap_entry_t *entries = hdr->entries;
+    off_t end = offset + len;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        int64_t block;
+        uint64_t saved = snap_entry(&entries[i], &block);
+        off_t at = block * SNAP_BLOCK;
+        if (saved <= snap_seen || at + SNAP_BLOCK <= offset || at >= end ||
+            snap_older_image(entries, n, i, block, saved))
+        {
+            continue;
+        }
+
+        off_t from = (at > offset) ? at : offset;
+        off_t to = (at + SNAP_BLOCK < end) ? at + SNAP_BLOCK : end;
+        if (pread(snap_fd, buf + (from - offset), to - from,
+                  SNAP_DATA_AT + (off_t)i * SNAP_BLOCK + (from - at)) != to - from)
+        {
+            return ERR_DB_FILE;
+        }
+    }
+
+    // Checked last, entries reused after the snapshot was given up may have
+    // been read above
+    if (__atomic_load_n(&hdr->oldest, __ATOMIC_ACQUIRE) > snap_seen)
+    {
+        printf(M_ERR_SNAP_OLD);
+        return ERR_DB_OP;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  snap_next_saved
+ *      from:  offset the scan is at
+ *      to:    offset db_skip_hole() wants to skip to
+ *
+ *  A block that was deleted after the snapshot may be a hole now, scans
+ *  must not skip it.
+ *
+ *  returns:  the first offset between from and to with a saved image for
+ *            the snapshot, to if there is none
+ */
+off_t snap_next_saved(off_t from, off_t to)
+{
+    snap_header_t *hdr = snap_header();
+    off_t next = to;
+
+    if (hdr == NULL)
+    {
+        return next;
+    }
+
+    uint32_t n = __atomic_load_n(&hdr->nentries, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        int64_t block;
+        uint64_t saved = snap_entry(&hdr->entries[i], &block);
+        off_t at = block * SNAP_BLOCK;
+        if (saved > snap_seen && at + SNAP_BLOCK > from && at < next)
+        {
+            next = (at > from) ? at : from;
+        }
+    }
+
+    return next;
+}
+
+/*
+ *  snap_begin
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Starts a write, which must be closed with snap_end().  Calls nest, the
+ *  outermost pair is one write for the readers, so a run of a -b batch is
+ *  taken into snapshots as a whole.  Writes from other processes wait here,
+ *  readers never do.  Once no reader is left the saved blocks are dropped.
+ *  Sessions that did not snap_open(), for example exclusive ones that no
+ *  reader can share, skip all of this.
+ *
+ *  Single writes take the commit lock after their slot lock, under the
+ *  shared DB_LOCK_WRITE.  A -b batch takes it before its slot locks, so it
+ *  holds DB_LOCK_WRITE alone first, see run_batch_runs().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the commit lock could not be taken
+ */
+int snap_begin(int db_fd)
+{
+    struct stat st;
+
+    if (snap_depth++ > 0 || db_fd != snap_db_fd || snap_slot >= 0)
+    {
+        return NO_ERROR;
+    }
+    if (snap_attach(db_fd) != NO_ERROR)
+    {
+        snap_depth--;
+        return ERR_DB_FILE;
+    }
+
+    // A write that crashed before snap_end() left its version behind, new
+    // snapshots see what it got done.  The version moves on before the
+    // reader slots are looked at, see snap_register().
+    __atomic_store_n(&snap_hdr->committed, snap_hdr->version, __ATOMIC_RELEASE);
+    snap_txn = snap_hdr->version + 1;
+    __atomic_store_n(&snap_hdr->version, snap_txn, __ATOMIC_SEQ_CST);
+
+    // Slots of readers that went away without snap_close() do not count,
+    // the next reader of the slot overwrites them
+    bool readers = false;
+    for (int i = 0; i < SNAP_READERS && !readers; i++)
+    {
+        readers = __atomic_load_n(&snap_hdr->readers[i], __ATOMIC_SEQ_CST) != 0 &&
+                  snap_lock(db_fd, F_GETLK, F_WRLCK, DB_LOCK_SNAP + 1 + i) == ERR_DB_OP;
+    }
+
+    // Give the space of the images back too, also after snapshots were
+    // given up
+    if (!readers && (snap_hdr->nentries > 0 ||
+                     (fstat(snap_fd, &st) == 0 && st.st_size > (off_t)SNAP_DATA_AT)))
+    {
+        __atomic_store_n(&snap_hdr->nentries, 0, __ATOMIC_RELEASE);
+        if (ftruncate(snap_fd, SNAP_DATA_AT) == -1)
+        {
+            snap_txn = 0;
+            snap_lock(db_fd, F_SETLK, F_UNLCK, DB_LOCK_SNAP);
+            snap_depth--;
+            return ERR_DB_FILE;
+        }
+    }
+
+    snap_saving = true;
+    return NO_ERROR;
+}
+
+/*
+ *  snap_end
+ *
+ *  Ends a snap_begin(), the outermost one commits the version, so
+ *  snapshots taken from now on include the write, and releases the commit
+ *  lock.  Also called when the write failed half way, the saved images
+ *  still hide it from older snapshots.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void snap_end(void)
+{
+    if (snap_depth == 0 || --snap_depth > 0 || snap_txn == 0)
+    {
+        return;
+    }
+
+    __atomic_store_n(&snap_hdr->committed, snap_txn, __ATOMIC_SEQ_CST);
+    snap_txn = 0;
+    snap_lock(snap_db_fd, F_SETLK, F_UNLCK, DB_LOCK_SNAP);
+}
+
+/*
+ *  snap_preserve
+ *      db_fd:   linux file descriptor of the database
+ *      offset:  file offset about to be written
+ *      len:     bytes about to be written
+ *
+ *  Called by db_write() before it changes the database.  Saves the blocks
+ *  in the range as they are now, once per write.  Readers may take their
+ *  snapshot while the write is open, so the blocks are saved even if no
+ *  reader was open at snap_begin().  Outside of snap_begin() and snap_end()
+ *  this does nothing.
+ *
+ *  returns:  NO_ERROR       the write may go ahead
+ *            ERR_DB_FILE    database or sidecar I/O issue
+ */
+int snap_preserve(int db_fd, off_t offset, size_t len)
+{
+    char image[SNAP_BLOCK];
+
+    if (snap_txn == 0 || !snap_saving || len == 0)
+    {
+        return NO_ERROR;
+    }
+
+    for (off_t block = offset / SNAP_BLOCK; block <= (off_t)(offset + len - 1) / SNAP_BLOCK; block++)
+    {
+        uint32_t n = snap_hdr->nentries;
+        bool saved = false;
+        for (uint32_t i = 0; i < n && !saved; i++)
+        {
+            saved = snap_hdr->entries[i].block == block && snap_hdr->entries[i].saved == snap_txn;
+        }
+        if (saved)
+        {
+            continue;
+        }
+
+        if (n == SNAP_ENTRIES)
+        {
+            // Readers check oldest after they used an image, so it must be
+            // set before the entries are reused
+            __atomic_store_n(&snap_hdr->oldest, snap_txn, __ATOMIC_RELEASE);
+            __atomic_store_n(&snap_hdr->nentries, 0, __ATOMIC_RELEASE);
+            snap_saving = false;
+            return NO_ERROR;
+        }
+
+        memset(image, 0, sizeof(image));
+        if (db_read(db_fd, image, SNAP_BLOCK, block * SNAP_BLOCK) == -1 ||
+            pwrite(snap_fd, image, SNAP_BLOCK, SNAP_DATA_AT + (off_t)n * SNAP_BLOCK) != SNAP_BLOCK)
+        {
+            return ERR_DB_FILE;
+        }
+
+        // Readers skip an entry while saved changes, see snap_entry()
+        snap_entry_t *e = &snap_hdr->entries[n];
+        __atomic_store_n(&e->saved, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&e->block, block, __ATOMIC_RELAXED);
+        __atomic_store_n(&e->saved, snap_txn, __ATOMIC_RELEASE);
+        __atomic_store_n(&snap_hdr->nentries, n + 1, __ATOMIC_RELEASE);
+    }
+
+    return NO_ERROR;
+}
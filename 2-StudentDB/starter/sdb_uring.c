@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Minimal io_uring backend for db_io_many(), talking to the kernel with the
+// raw system calls so the program needs no extra library.  The ring is set
+// up on first use and kept until uring_close().  Only the main thread
+// submits, the parallel scans keep using pread().
+//
+// The submission queue is filled with up to URING_DEPTH positional reads or
+// writes, one io_uring_enter() submits them all and waits for completions,
+// so the device sees the whole batch at once instead of one request after
+// the other.  If the kernel has no io_uring, or it is disabled, setup fails
+// once and the caller falls back to one db_read()/db_write() per entry.
+static int ring_fd = -1;           // fd of the ring, -1 if not set up
+static bool ring_failed = false;   // setup failed, do not try again
+
+static char *sq_ring = MAP_FAILED; // submission queue ring
+static size_t sq_ring_len;
+static char *cq_ring = MAP_FAILED; // completion queue ring, may be sq_ring
+static size_t cq_ring_len;
+static struct io_uring_sqe *sqes = MAP_FAILED;
+static size_t sqes_len;
+
+static unsigned *sq_tail;
+static unsigned *sq_mask;
+static unsigned *sq_array;
+static unsigned sq_entries;
+static unsigned *cq_head;
+static unsigned *cq_tail;
+static unsigned *cq_mask;
+static struct io_uring_cqe *cqes;
+
+/*
+ *  uring_setup
+ *
+ *  Creates the ring and maps its queues.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_OP      io_uring is not available
+ */
+static int uring_setup(void)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    ring_fd = syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (ring_fd == -1)
+    {
+        return ERR_DB_OP;
+    }
+
+    sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        // Both rings live in one mapping
+        if (cq_ring_len > sq_ring_len)
+        {
+            sq_ring_len = cq_ring_len;
+        }
+        cq_ring_len = sq_ring_len;
+    }
+
+    sq_ring = mmap(NULL, sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        uring_close();
+        return ERR_DB_OP;
+    }
+    cq_ring = sq_ring;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        cq_ring = mmap(NULL, cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_CQ_RING);
+    }
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring_fd, IORING_OFF_SQES);
+    if (cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        uring_close();
+        return ERR_DB_OP;
+    }
+
+    sq_tail = (unsigned *)(sq_ring + p.sq_off.tail);
+    sq_mask = (unsigned *)(sq_ring + p.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq_ring + p.sq_off.array);
+    sq_entries = p.sq_entries;
+    cq_head = (unsigned *)(cq_ring + p.cq_off.head);
+    cq_tail = (unsigned *)(cq_ring + p.cq_off.tail);
+    cq_mask = (unsigned *)(cq_ring + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq_ring + p.cq_off.cqes);
+
+    return NO_ERROR;
+}
+
+/*
+ *  uring_close
+ *
+ *  Tears the ring down, harmless if it was never set up.  The next
+ *  uring_rw() sets it up again.
+ *
+ *  returns:  nothing, this is a void function
+ */
+void uring_close(void)
+{
+    if (sqes != MAP_FAILED)
+    {
+        munmap(sqes, sqes_len);
+    }
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+    {
+        munmap(cq_ring, cq_ring_len);
+    }
+    if (sq_ring != MAP_FAILED)
+    {
+        munmap(sq_ring, sq_ring_len);
+    }
+    if (ring_fd != -1)
+    {
+        close(ring_fd);
+    }
+    sqes = MAP_FAILED;
+    cq_ring = MAP_FAILED;
+    sq_ring = MAP_FAILED;
+    ring_fd = -1;
+}
+
+/*
+ *  uring_submit
+ *      fd:     linux file descriptor
+ *      ios:    entries to submit, at most sq_entries
+ *      n:      number of entries
+ *      write:  true for writes, false for reads
+ *
+ *  Queues the entries, submits them with one io_uring_enter() and reaps the
+ *  completions as they arrive.  res of an entry is the result of its request,
+ *  -1 if it failed.
+ *
+ *  returns:  NO_ERROR       every request completed
+ *            ERR_DB_FILE    io_uring_enter() failed, the ring is unusable
+ */
+static int uring_submit(int fd, db_io_t *ios, unsigned n, bool write)
+{
+    unsigned tail = *sq_tail;
+
+    for (unsigned i = 0; i < n; i++)
+    {
+        unsigned slot = (tail + i) & *sq_mask;
+        struct io_uring_sqe *sqe = &sqes[slot];
+
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)ios[i].buf;
+        sqe->len = ios[i].len;
+        sqe->off = ios[i].offset;
+        sqe->user_data = i;
+        sq_array[slot] = slot;
+        ios[i].res = -1;
+    }
+    // The kernel may only see the new tail after the entries
+    __atomic_store_n(sq_tail, tail + n, __ATOMIC_RELEASE);
+
+    unsigned submitted = 0;
+    unsigned reaped = 0;
+    while (reaped < n)
+    {
+        int ret = syscall(__NR_io_uring_enter, ring_fd, n - submitted, 1,
+                          IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return ERR_DB_FILE;
+        }
+        submitted += ret;
+
+        unsigned head = *cq_head;
+        while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            const struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+            if (cqe->user_data < n)
+            {
+                ios[cqe->user_data].res = (cqe->res < 0) ? -1 : cqe->res;
+            }
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  uring_rw
+ *      fd:     linux file descriptor of a plain file
+ *      ios:    the reads or writes, res is set for each
+ *      n:      number of entries in ios
+ *      write:  true to write the buffers, false to read into them
+ *
+ *  Moves the entries through io_uring, up to URING_DEPTH at a time.  A
+ *  request the kernel failed, for example an opcode an older kernel does
+ *  not know, or a short write is redone with pread()/pwrite(), so res ends
+ *  up what those calls return.
+ *
+ *  returns:  NO_ERROR       the entries were moved, see their res
+ *            ERR_DB_OP      io_uring is not available, nothing was moved
+ */
+int uring_rw(int fd, db_io_t *ios, size_t n, bool write)
+{
+    if (ring_fd == -1 && (ring_failed || uring_setup() != NO_ERROR))
+    {
+        ring_failed = true;
+        return ERR_DB_OP;
+    }
+
+    for (size_t i = 0; i < n;)
+    {
+        unsigned batch = (n - i < sq_entries) ? n - i : sq_entries;
+        if (uring_submit(fd, &ios[i], batch, write) != NO_ERROR)
+        {
+            // Give the ring up for good, whatever did not complete is
+            // redone below
+            uring_close();
+            ring_failed = true;
+            for (size_t j = i + batch; j < n; j++)
+            {
+                ios[j].res = -1;
+            }
+            batch = n - i;
+        }
+
+        for (size_t j = i; j < i + batch; j++)
+        {
+            db_io_t *io = &ios[j];
+            if (io->res != -1 && (!write || (size_t)io->res == io->len))
+            {
+                continue;
+            }
+            io->res = write ? pwrite(fd, io->buf, io->len, io->offset)
+                            : pread(fd, io->buf, io->len, io->offset);
+        }
+        i += batch;
+    }
+
+    return NO_ERROR;
+}
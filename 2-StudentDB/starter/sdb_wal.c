@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h> //c library for system call file routines
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+// database include files
+#include "db.h"
+#include "sdbsc.h"
+
+// Write-ahead log of the open database.  Adds and deletes log the full
+// image of every record they are about to write, commit the log with one
+// fdatasync() and only then write the database, see log_student_write().
+// Callers that log several writes before applying them, like the server
+// write-back, share the commit.  A crash can then only tear a record in the
+// database file if its image is already durable in the log, and open_db()
+// replays the log before anything reads the database.  Only the session
+// that has the database to itself replays, see open_db().
+//
+// Records are full images at a file offset, so replaying a record twice or
+// replaying records that already reached the database is harmless.  The
+// log is emptied by wal_checkpoint() once the database itself is synced.
+// Writers do that as soon as no record is in flight, see wal_settle(), so
+// opening a database normally finds the log empty and reads nothing.
+// Sessions that do not write never create the log.
+static int wal_fd = -1;                     // fd of the log, -1 if none
+static wal_record_t wal_pending[WAL_BATCH]; // logged, not yet committed
+static size_t wal_npending;
+static bool wal_writer;                     // session may append and checkpoint
+
+/*
+ *  wal_checksum
+ *      *r:  log record
+ *
+ *  FNV-1a over the offset and the student image, detects records torn by a
+ *  crash while the log was appended.
+ *
+ *  returns:  checksum of the record
+ */
+static uint32_t wal_checksum(const wal_record_t *r)
+{
+    const unsigned char *p = (const unsigned char *)&r->offset;
+    size_t len = sizeof(r->offset) + sizeof(r->student);
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ *  compare_wal_record
+ *
+ *  qsort() comparator over pointers into the log, ordering records by
+ *  offset and records for the same offset in log order.
+ */
+static int compare_wal_record(const void *a, const void *b)
+{
+    const wal_record_t *ra = *(const wal_record_t * const *)a;
+    const wal_record_t *rb = *(const wal_record_t * const *)b;
+
+    if (ra->offset != rb->offset)
+    {
+        return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+    }
+    return (ra > rb) - (ra < rb);
+}
+
+/*
+ *  wal_in_flight
+ *      db_fd:   linux file descriptor of the database
+ *      offset:  file offset of a logged record
+ *
+ *  Writers hold the write lock of a slot from before they log it until
+ *  the record is in the database, a crash drops the lock.
+ *
+ *  returns:  true if another process is still writing the slot
+ */
+static bool wal_in_flight(int db_fd, off_t offset)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_RDLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = offset;
+    fl.l_len = sizeof(student_t);
+
+    return fcntl(db_fd, F_GETLK, &fl) == 0 && fl.l_type != F_UNLCK;
+}
+
+/*
+ *  wal_scan
+ *      db_fd:  linux file descriptor of the database
+ *      apply:  write the differences to the database
+ *
+ *  Reads the intact records of the log, they end at the first short or
+ *  damaged record, which is the tail a crash left behind before its commit.
+ *  Only the last image logged for each offset matters, it is compared to
+ *  the database and written when it differs.  A log left behind by a clean
+ *  run therefore costs one read per record and changes nothing.  When only
+ *  checking, records that other writers are still applying do not count.
+ *
+ *  When applying, the database is synced and the log emptied, the caller
+ *  has the database to itself.
+ *
+ *  returns:  <number>       records that differ from the database, when
+ *                           only checking a torn tail counts as one
+ *            ERR_DB_FILE    database or log file I/O issue
+ */
+static int wal_scan(int db_fd, bool apply)
+{
+    struct stat st;
+    student_t curr;
+    int changes = 0;
+
+    if (wal_fd == -1)
+    {
+        return 0;
+    }
+    if (fstat(wal_fd, &st) == -1)
+    {
+        return ERR_DB_FILE;
+    }
+    if (st.st_size == 0)
+    {
+        return 0;
+    }
+
+    size_t max = st.st_size / sizeof(wal_record_t);
+    wal_record_t *log = malloc(st.st_size);
+    wal_record_t **order = malloc((max + 1) * sizeof(wal_record_t *));
+    if (log == NULL || order == NULL ||
+        pread(wal_fd, log, st.st_size, 0) != st.st_size)
+    {
+        free(log);
+        free(order);
+        return ERR_DB_FILE;
+    }
+
+    size_t n = 0;
+    while (n < max && log[n].magic == WAL_MAGIC && log[n].checksum == wal_checksum(&log[n]) &&
+           log[n].offset >= 0 && log[n].offset % sizeof(student_t) == 0)
+    {
+        order[n] = &log[n];
+        n++;
+    }
+    off_t intact = n * sizeof(wal_record_t);
+    qsort(order, n, sizeof(wal_record_t *), compare_wal_record);
+
+    for (size_t i = 0; i < n && changes >= 0; i++)
+    {
+        const wal_record_t *r = order[i];
+        if (i + 1 < n && order[i + 1]->offset == r->offset)
+        {
+            continue; // a later image replaces this one
+        }
+
+        ssize_t bytes_read = db_read(db_fd, &curr, sizeof(student_t), r->offset);
+        if (bytes_read == -1)
+        {
+            changes = ERR_DB_FILE;
+        }
+        else if ((bytes_read != sizeof(student_t) ||
+                  memcmp(&curr, &r->student, sizeof(student_t)) != 0) &&
+                 (apply || !wal_in_flight(db_fd, r->offset)))
+        {
+            changes++;
+            if (apply && db_write(db_fd, &r->student, sizeof(student_t), r->offset) !=
+                             sizeof(student_t))
+            {
+                changes = ERR_DB_FILE;
+            }
+        }
+    }
+    free(log);
+    free(order);
+
+    if (changes < 0 || !apply)
+    {
+        return (changes >= 0 && st.st_size != intact) ? changes + 1 : changes;
+    }
+
+    // The replayed records have to be durable before the log is dropped
+    if (sync_db(db_fd) != NO_ERROR || ftruncate(wal_fd, 0) == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    return changes;
+}
+
+/*
+ *  wal_open
+ *      dbFile:    name of the database file, the log is dbFile WAL_FILE_SUFFIX
+ *      truncate:  the database was truncated, so the log is discarded
+ *      writer:    the session may log records and checkpoint the log
+ *
+ *  Opens the log, wal_check() and wal_replay() then bring the database up
+ *  to date before it is mapped or its indexes are opened.  Only writers
+ *  create it, for the others a missing log is an empty one.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    log file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int wal_open(char *dbFile, bool truncate, bool writer)
+{
+    char path[256];
+    int flags = O_RDWR | O_APPEND;
+
+    if (writer)
+    {
+        flags |= O_CREAT;
+    }
+    if (truncate)
+    {
+        flags |= O_TRUNC;
+    }
+
+    wal_npending = 0;
+    wal_writer = writer;
+    snprintf(path, sizeof(path), "%s%s", dbFile, WAL_FILE_SUFFIX);
+    wal_fd = open(path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (wal_fd == -1 && (writer || errno != ENOENT))
+    {
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  wal_check
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Finds out if the database needs a replay without changing anything, so
+ *  it is safe while other processes use the database.  Writers between
+ *  their commit and their database write are told apart from a crash by
+ *  their slot locks.
+ *
+ *  returns:  <number>       replay is needed if this is not 0
+ *            ERR_DB_FILE    database or log file I/O issue
+ */
+int wal_check(int db_fd)
+{
+    return wal_scan(db_fd, false);
+}
+
+/*
+ *  wal_replay
+ *      db_fd:  linux file descriptor of the database, not mapped yet
+ *
+ *  Applies the log to the database, the caller must have the database to
+ *  itself.
+ *
+ *  returns:  <number>       number of records that changed the database,
+ *                           the indexes are stale if this is not 0
+ *            ERR_DB_FILE    database or log file I/O issue
+ */
+int wal_replay(int db_fd)
+{
+    return wal_scan(db_fd, true);
+}
+
+/*
+ *  wal_log
+ *      offset:  file offset the record will be written to
+ *      *s:      the record image
+ *
+ *  Queues a record for the next wal_commit().  The database must not be
+ *  written until that commit returned, several wal_log() calls can share
+ *  one commit.  A full queue is committed on the spot.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    log file I/O issue
+ */
+int wal_log(off_t offset, const student_t *s)
+{
+    if (wal_fd == -1 || !wal_writer)
+    {
+        return ERR_DB_FILE;
+    }
+
+    if (wal_npending == WAL_BATCH && wal_commit() != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+
+    wal_record_t *r = &wal_pending[wal_npending++];
+    memset(r, 0, sizeof(wal_record_t));
+    r->magic = WAL_MAGIC;
+    r->offset = offset;
+    memcpy(&r->student, s, sizeof(student_t));
+    r->checksum = wal_checksum(r);
+
+    return NO_ERROR;
+}
+
+/*
+ *  wal_commit
+ *
+ *  Group commit, appends every record queued since the last commit with
+ *  one write() and makes them durable with one fdatasync().  Callers that
+ *  queue several writes, store_students() and a delete that moves a packed
+ *  record, pay for one commit instead of one per record.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    log file I/O issue
+ */
+int wal_commit(void)
+{
+    size_t len = wal_npending * sizeof(wal_record_t);
+
+    if (wal_npending == 0)
+    {
+        return NO_ERROR;
+    }
+    wal_npending = 0;
+
+    if (wal_fd == -1 || write(wal_fd, wal_pending, len) != (ssize_t)len ||
+        fdatasync(wal_fd) == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  wal_checkpoint
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Syncs the database and empties the log.  Writes that bypass the log, like
+ *  the bulk import or compress_db(), checkpoint first so an older record
+ *  can never be replayed over them.  Only writer sessions touch the log.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or log file I/O issue
+ */
+int wal_checkpoint(int db_fd)
+{
+    if (wal_fd == -1 || !wal_writer)
+    {
+        return NO_ERROR;
+    }
+
+    if (sync_db(db_fd) != NO_ERROR || ftruncate(wal_fd, 0) == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  wal_settle
+ *      db_fd:  linux file descriptor of the database
+ *      wait:   wait for the records other writers have in flight
+ *
+ *  Checkpoints the log once every record in it reached the database.
+ *  Writers hold the write lock of a slot from before they log it until the
+ *  record is written, so a read lock over every slot means none is left.
+ *  Without wait a log with records in flight is left to the writer that
+ *  applies them last.  The caller must not hold slot locks, the lock over
+ *  every slot would replace them.
+ *
+ *  returns:  NO_ERROR       on success, also when the log was left
+ *            ERR_DB_FILE    database or log file I/O issue
+ */
+int wal_settle(int db_fd, bool wait)
+{
+    struct stat st;
+    struct flock fl;
+
+    if (wal_fd == -1 || !wal_writer)
+    {
+        return NO_ERROR;
+    }
+    if (fstat(wal_fd, &st) == -1)
+    {
+        return ERR_DB_FILE;
+    }
+    if (st.st_size == 0)
+    {
+        return NO_ERROR;
+    }
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_RDLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = DB_LOCK_SESSION;
+    while (fcntl(db_fd, wait ? F_SETLKW : F_SETLK, &fl) == -1)
+    {
+        if (errno == EACCES || errno == EAGAIN)
+        {
+            return NO_ERROR;
+        }
+        if (errno != EINTR)
+        {
+            return ERR_DB_FILE;
+        }
+    }
+
+    int rc = wal_checkpoint(db_fd);
+    fl.l_type = F_UNLCK;
+    fcntl(db_fd, F_SETLK, &fl);
+    return rc;
+}
+
+/*
+ *  wal_close
+ *      db_fd:  linux file descriptor of the database
+ *
+ *  Closes the log.  A writer checkpoints it first, see wal_settle().  Only
+ *  a log that grew past WAL_CHECKPOINT_BYTES waits for the other writers,
+ *  a shorter one is left to them.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or log file I/O issue
+ */
+int wal_close(int db_fd)
+{
+    struct stat st;
+    int rc = NO_ERROR;
+
+    if (wal_fd == -1)
+    {
+        return NO_ERROR;
+    }
+
+    if (wal_writer && (fstat(wal_fd, &st) == -1 ||
+                       wal_settle(db_fd, st.st_size >= WAL_CHECKPOINT_BYTES) != NO_ERROR))
+    {
+        rc = ERR_DB_FILE;
+    }
+
+    close(wal_fd);
+    wal_fd = -1;
+    wal_npending = 0;
+    return rc;
+}
@@ -1,509 +1,4742 @@
+#define _GNU_SOURCE //for SEEK_DATA and SEEK_HOLE
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h> //c library for system call file routines
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 // database include files
 #include "db.h"
 #include "sdbsc.h"
 
+// Storage engine used by open_db() and the record I/O helpers below.  The
+// program only has a single database open at a time, so the state of the
+// memory mapped engine is kept here instead of changing the fd based API.
+static int db_engine = DB_ENGINE_FILEIO;
+static int db_map_fd = -1;    // fd the mapping belongs to, -1 if none
+static char *db_map = NULL;   // start of the mapped database file
+static size_t db_map_len = 0; // bytes mapped, always the size of the file
+
+// db_layout() result for the open database, reset by close_db()
+static int db_layout_fd = -1;
+static int db_layout_cached;
+
+// Locks taken by open_db() and the record operations, see set_db_access()
+static int db_access = DB_ACCESS_READ;
+static short db_index_held = F_UNLCK;  // index lock this session holds
+static char db_index_file[256];        // database the indexes belong to
+
+// Largest id validate_range() lets through, set by open_db().  Without a
+// database, for -C, the server checks ids against its own
+static int db_id_limit = SEG_MAX_STD_ID;
+
 /*
- *  open_db
- *      dbFile:  name of the database file
- *      should_truncate:  indicates if opening the file also empties it
+ *  set_db_engine
+ *      engine:  DB_ENGINE_FILEIO, DB_ENGINE_MMAP or DB_ENGINE_URING
  *
- *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *  Selects how databases opened after this call are accessed.
  *
- *  console:  Does not produce any console I/O on success
- *            M_ERR_DB_OPEN on error
+ *  returns:  nothing, this is a void function
+ */
+void set_db_engine(int engine)
+{
+    db_engine = engine;
+}
+
+/*
+ *  set_db_access
+ *      access:  one of the DB_ACCESS_* modes
  *
+ *  Selects the locks databases opened after this call take.  Lookups and
+ *  index readers share the database, writers only exclude each other from
+ *  the record slots they write and, while the records are written, from
+ *  the indexes.  The exclusive mode waits until every other process closed
+ *  the database.  Snapshot readers take no lock a writer waits for.
+ *
+ *  returns:  nothing, this is a void function
  */
+void set_db_access(int access)
+{
+    db_access = access;
+}
 
-int open_db(char *dbFile, bool should_truncate)
+/*
+ *  db_lock
+ *      fd:     linux file descriptor
+ *      type:   F_RDLCK, F_WRLCK or F_UNLCK
+ *      start:  first byte of the range
+ *      len:    bytes in the range
+ *
+ *  Takes or releases an advisory fcntl() lock, waiting for conflicting locks
+ *  of other processes to go away.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the lock could not be taken
+ */
+int db_lock(int fd, short type, off_t start, off_t len)
 {
-    // Set permissions: rw-rw----
-    // see sys/stat.h for constants
-    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    struct flock fl;
 
-    // open the file if it exists for Read and Write,
-    // create it if it does not exist
-    int flags = O_RDWR | O_CREAT;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
 
-    if (should_truncate)
-        flags += O_TRUNC;
+    while (fcntl(fd, F_SETLKW, &fl) == -1)
+    {
+        if (errno != EINTR)
+        {
+            return ERR_DB_FILE;
+        }
+    }
 
-    // Now open file
-    int fd = open(dbFile, flags, mode);
+    return NO_ERROR;
+}
 
-    if (fd == -1)
+/*
+ *  db_lock_span
+ *      start:  first byte of a range of slots
+ *      len:    bytes in the range
+ *
+ *  A file system or scan block at the end of the slots reaches into the
+ *  lock bytes, which every session holds.  Locks on such a block stop at
+ *  DB_LOCK_SESSION, so they do not wait for every other session.
+ *
+ *  returns:  len, cut off at DB_LOCK_SESSION
+ */
+static off_t db_lock_span(off_t start, off_t len)
+{
+    off_t locks = DB_LOCK_SESSION;
+    if (start < locks && start + len > locks)
     {
-        // Handle the error
-        printf(M_ERR_DB_OPEN);
-        return ERR_DB_FILE;
+        return locks - start;
     }
 
-    return fd;
+    return len;
 }
 
 /*
- *  get_student
- *      fd:  linux file descriptor
- *      id:  the student id we are looking forname of the
- *      *s:  a pointer where the located (if found) student data will be
- *           copied
+ *  db_map_file
+ *      fd:  linux file descriptor of the database
  *
- *  returns:  NO_ERROR       student located and copied into *s
- *            ERR_DB_FILE    database file I/O issue
- *            SRCH_NOT_FOUND student was not located in the database
+ *  (Re)maps the whole database file.  An empty file has nothing to map, the
+ *  fd is still remembered so that db_resize() maps it once it grows.
  *
- *  console:  Does not produce any console I/O used by other functions
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
  */
-int get_student(int fd, int id, student_t *s)
+static int db_map_file(int fd)
 {
-    // Seek to the beginning of the file
-    if (lseek(fd, 0, SEEK_SET) == -1)
+    struct stat st;
+
+    if (db_map != NULL)
     {
-        return ERR_DB_FILE; // Return error if seeking fails
+        munmap(db_map, db_map_len);
+        db_map = NULL;
+        db_map_len = 0;
     }
 
-    student_t curr; // Local variable to hold each student record
-    ssize_t bytes_read;
+    if (fstat(fd, &st) == -1)
+    {
+        return ERR_DB_FILE;
+    }
 
-    // Read the file record by record
-    while ((bytes_read = read(fd, &curr, sizeof(student_t))) > 0)
+    if (st.st_size > 0)
     {
-        // If student found by matching ID, copy data to provided student pointer
-        if (curr.id == id)
+        void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
         {
-            memcpy(s, &curr, sizeof(student_t));
-            return NO_ERROR;
+            return ERR_DB_FILE;
         }
+        db_map = base;
+        db_map_len = st.st_size;
     }
 
-    // If reading fails, return error code
-    if (bytes_read == -1)
+    db_map_fd = fd;
+    return NO_ERROR;
+}
+
+/*
+ *  db_map_grown
+ *      fd:  linux file descriptor of the mapped database
+ *
+ *  Writers of other sessions grow the file behind the mapping.  Reads past
+ *  its end and new scans map the file again once it is larger.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int db_map_grown(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
     {
         return ERR_DB_FILE;
     }
+    if ((size_t)st.st_size <= db_map_len)
+    {
+        return NO_ERROR;
+    }
 
-    return SRCH_NOT_FOUND; // Return if student not found
+    return db_map_file(fd);
 }
 
 /*
- *  add_student
- *      fd:     linux file descriptor
- *      id:     student id (range is defined in db.h )
- *      fname:  student first name
- *      lname:  student last name
- *      gpa:    GPA as an integer (range defined in db.h)
- *
- *  Adds a new student to the database.  After calculating the index for the
- *  student, check if there is another student already at that location.  A good
- *  way is to use something like memcmp() to ensure that the location for this
- *  student contains all zero byes indicating the space is empty.
- *
- *  returns:  NO_ERROR       student added to database
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           already exists)
+ *  db_read
+ *      fd:      linux file descriptor
+ *      buf:     destination buffer
+ *      len:     number of bytes to read
+ *      offset:  file offset to read from
  *
+ *  Positional read used by all record access.  For a mapped database this is
+ *  a copy out of the mapping, a segmented database reads from its segments,
+ *  otherwise this is a pread().
  *
- *  console:  M_STD_ADDED       on success
- *            M_ERR_DB_ADD_DUP  student already exists
- *            M_ERR_DB_READ     error reading or seeking the database file
- *            M_ERR_DB_WRITE    error writing to db file (adding student)
- *
+ *  returns:  number of bytes read, 0 at EOF, or -1 on error
  */
-
-int add_student(int fd, int id, char *fname, char *lname, int gpa)
+ssize_t db_read(int fd, void *buf, size_t len, off_t offset)
 {
-    student_t exist; // To check if student already exists
-    int result = get_student(fd, id, &exist);
-    if (result == NO_ERROR)
+    if (seg_active(fd))
     {
-        // If student exists, print error and return failure
-        printf(M_ERR_DB_ADD_DUP, id);
-        return ERR_DB_OP;
+        return seg_read(buf, len, offset);
     }
-
-    off_t position = id * sizeof(student_t); // Calculate the position of the new student record
-
-    // Seek to the calculated position
-    if (lseek(fd, position, SEEK_SET) == -1)
+    if (fd != db_map_fd)
     {
-        printf(M_ERR_DB_READ); // Print error if seek fails
-        return ERR_DB_FILE;
+        return pread(fd, buf, len, offset);
     }
 
-    student_t new_student = {0}; // Zero out the struct to ensure no uninitialized memory
-    new_student.id = id; // Set student ID
-    new_student.gpa = gpa; // Set student GPA
-
-    // Safely copy the first name with null termination
-    strncpy(new_student.fname, fname, sizeof(new_student.fname) - 1);
-    new_student.fname[sizeof(new_student.fname) - 1] = '\0';
-
-    // Safely copy the last name with null termination
-    strncpy(new_student.lname, lname, sizeof(new_student.lname) - 1);
-    new_student.lname[sizeof(new_student.lname) - 1] = '\0';
-
-    // Write the new student record to the file
-    ssize_t bytes_written = write(fd, &new_student, sizeof(student_t));
-    if (bytes_written != sizeof(student_t))
+    if (offset + len > db_map_len && db_map_grown(fd) != NO_ERROR)
     {
-        printf(M_ERR_DB_WRITE); // Print error if writing fails
-        return ERR_DB_FILE;
+        return -1;
     }
-
-    // Ensure the file size matches the expected size for the student record
-    off_t expected_size = (id + 1) * sizeof(student_t);
-    if (ftruncate(fd, expected_size) == -1)
+    if ((size_t)offset >= db_map_len)
     {
-        printf(M_ERR_DB_WRITE); // Print error if truncation fails
-        return ERR_DB_FILE;
+        return 0;
     }
-
-    printf(M_STD_ADDED, id); // Print success message
-    return NO_ERROR; // Return success
+    if (len > db_map_len - offset)
+    {
+        len = db_map_len - offset;
+    }
+    memcpy(buf, db_map + offset, len);
+    return len;
 }
 
 /*
- *  del_student
- *      fd:     linux file descriptor
- *      id:     student id to be deleted
+ *  db_resize
+ *      fd:    linux file descriptor
+ *      size:  new size of the database file
  *
- *  Removes a student to the database.  Use the get_student() function to
- *  locate the student to be deleted. If there is a student at that location
- *  write an empty student record - see EMPTY_STUDENT_RECORD from db.h at
- *  that location.
+ *  ftruncate() the database and, for a mapped database, remap it so the
+ *  mapping keeps covering exactly the file.
  *
- *  returns:  NO_ERROR       student deleted from database
+ *  returns:  NO_ERROR       on success
  *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           not in database)
- *
- *
- *  console:  M_STD_DEL_MSG      on success
- *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
- *            M_ERR_DB_READ      error reading or seeking the database file
- *            M_ERR_DB_WRITE     error writing to db file (adding student)
- *
  */
-int del_student(int fd, int id)
+static int db_resize(int fd, off_t size)
 {
-    student_t exist;
-    if (get_student(fd, id, &exist) == SRCH_NOT_FOUND)
+    if (seg_active(fd))
     {
-        printf(M_STD_NOT_FND_MSG, id); // Print error if student not found
-        return ERR_DB_OP;
+        return seg_resize(size);
+    }
+    if (ftruncate(fd, size) == -1)
+    {
+        return ERR_DB_FILE;
     }
 
-    // Seek to the student's record in the file
-    if (lseek(fd, -sizeof(student_t), SEEK_CUR) == -1)
+    if (fd == db_map_fd)
     {
-        return ERR_DB_FILE; // Return error if seeking fails
+        return db_map_file(fd);
     }
 
-    // Write an empty record to mark the student as deleted
-    ssize_t bytes_written = write(fd, &EMPTY_STUDENT_RECORD, sizeof(student_t));
+    return NO_ERROR;
+}
 
-    if (bytes_written != sizeof(student_t))
+/*
+ *  db_write
+ *      fd:      linux file descriptor
+ *      buf:     source buffer
+ *      len:     number of bytes to write
+ *      offset:  file offset to write to
+ *
+ *  Positional write used by all record access.  A mapped database is grown
+ *  with db_resize() when writing past EOF and then written through the
+ *  mapping, a segmented database writes to its segments, otherwise this is
+ *  a pwrite().  Inside snap_begin() the blocks open snapshots still need
+ *  are saved first.
+ *
+ *  returns:  number of bytes written, or -1 on error
+ */
+ssize_t db_write(int fd, const void *buf, size_t len, off_t offset)
+{
+    if (snap_preserve(fd, offset, len) != NO_ERROR)
+    {
+        return -1;
+    }
+    if (seg_active(fd))
     {
-        return ERR_DB_FILE; // Return error if writing fails
+        return seg_write(buf, len, offset);
+    }
+    if (fd != db_map_fd)
+    {
+        return pwrite(fd, buf, len, offset);
     }
 
-    printf(M_STD_DEL_MSG, id); // Print success message
-    return NO_ERROR; // Return success
+    // Another writer may have grown the file already, it never shrinks
+    if (offset + len > db_map_len &&
+        (db_map_grown(fd) != NO_ERROR ||
+         (offset + len > db_map_len && db_resize(fd, offset + len) != NO_ERROR)))
+    {
+        return -1;
+    }
+    memcpy(db_map + offset, buf, len);
+    return len;
 }
 
 /*
- *  count_db_records
+ *  db_io_many
  *      fd:     linux file descriptor
+ *      ios:    the reads or writes, res is set for each
+ *      n:      number of entries in ios
+ *      write:  true to write the buffers, false to read into them
  *
- *  Counts the number of records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Create a counter variable and initialize it
- *  to zero, every time a non-zero record is read increment the counter.
- *
- *  returns:  <number>       returns the number of records in db on success
- *            ERR_DB_FILE    database file I/O issue
- *            ERR_DB_OP      database operation logically failed (aka student
- *                           not in database)
- *
- *
- *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
- *            M_DB_EMPTY       on success if the record count in db is zero
- *            M_ERR_DB_READ    error reading or seeking the database file
- *            M_ERR_DB_WRITE   error writing to db file (adding student)
+ *  Positional I/O of many records with one call, for the batch paths.  With
+ *  the DB_ENGINE_URING engine a plain database file is read or written
+ *  through io_uring, URING_DEPTH requests in flight at a time.  Mapped and
+ *  segmented databases, the other engines and kernels without io_uring get
+ *  one db_read() or db_write() per entry.
  *
+ *  returns:  NO_ERROR       every entry moved all of its bytes
+ *            ERR_DB_FILE    an entry failed or came up short, see its res
  */
-int count_db_records(int fd)
+int db_io_many(int fd, db_io_t *ios, size_t n, bool write)
 {
-    int count = 0; // Counter for the records
-    student_t student;
-    ssize_t bytes_read;
+    int rc = NO_ERROR;
 
-    // Read through the file
-    while ((bytes_read = read(fd, &student, sizeof(student_t))) == sizeof(student_t))
+    if (db_engine != DB_ENGINE_URING || seg_active(fd) || fd == db_map_fd ||
+        uring_rw(fd, ios, n, write) != NO_ERROR)
     {
-        // Check if the record is not empty
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, sizeof(student_t)) != 0)
+        for (size_t i = 0; i < n; i++)
         {
-            count++; // Increment count for each valid record
+            ios[i].res = write ? db_write(fd, ios[i].buf, ios[i].len, ios[i].offset)
+                               : db_read(fd, ios[i].buf, ios[i].len, ios[i].offset);
         }
     }
 
-    if (bytes_read == -1)
+    for (size_t i = 0; i < n; i++)
     {
-        return ERR_DB_FILE; // Return error if reading fails
+        if (ios[i].res != (ssize_t)ios[i].len)
+        {
+            rc = ERR_DB_FILE;
+        }
     }
 
-    // If no records found, print message
-    if (count == 0)
+    return rc;
+}
+
+/*
+ *  db_block_size
+ *      fd:  linux file descriptor
+ *
+ *  Storage is only given back in whole file system blocks.  Slots never
+ *  straddle a block, anything that does not fit that picture falls back to
+ *  a single slot.
+ *
+ *  returns:  the block size used for punching holes, or -1 on error
+ */
+static off_t db_block_size(int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
     {
-        printf(M_DB_EMPTY);
+        return -1;
     }
-    else
+
+    off_t blk = st.st_blksize;
+    if (blk < (off_t)sizeof(student_t) || blk > DB_SCAN_BLOCK || DB_SCAN_BLOCK % blk != 0)
     {
-        printf(M_DB_RECORD_CNT, count); // Print the record count
+        blk = sizeof(student_t);
     }
 
-    return count; // Return the count of records
+    return blk;
 }
 
 /*
- *  print_db
- *      fd:     linux file descriptor
- *
- *  Prints all records in the database.  Start by reading the
- *  database at the beginning, and continue reading individual records
- *  until you it EOF.  EOF is when the read() syscall returns 0. Check
- *  if a slot is empty or previously deleted by investigating if all of
- *  the bytes in the record read are zeros - I would suggest using memory
- *  compare memcmp() for this. Be careful as the database might be empty.
- *  on the first real row encountered print the header for the required output:
+ *  db_punch
+ *      fd:      linux file descriptor
+ *      offset:  start of the range
+ *      len:     bytes in the range
  *
- *     printf(STUDENT_PRINT_HDR_STRING, "ID",
- *                  "FIRST NAME", "LAST_NAME", "GPA");
- *
- *  then for each valid record encountered print the required output:
- *
- *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
- *                    student.lname, calculated_gpa_from_student);
- *
- *  The code above assumes you are reading student records into a local
- *  variable named student that is of type student_t. Also dont forget that
- *  the GPA in the student structure is an int, to convert it into a real
- *  gpa divide by 100.0 and store in a float variable.
+ *  Deallocates a range of the file that holds only empty slots with
+ *  fallocate(FALLOC_FL_PUNCH_HOLE).  The file keeps its size and the range
+ *  reads back as zeros, that is as empty records, also through a mapping.
  *
  *  returns:  NO_ERROR       on success
+ *            ERR_DB_OP      the file system can not punch holes
  *            ERR_DB_FILE    database file I/O issue
+ */
+static int db_punch(int fd, off_t offset, off_t len)
+{
+    if (seg_active(fd))
+    {
+        return seg_punch(offset, len);
+    }
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == -1)
+    {
+        return (errno == EOPNOTSUPP) ? ERR_DB_OP : ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  db_seek
+ *      fd:      linux file descriptor
+ *      offset:  file offset
+ *      whence:  SEEK_DATA, SEEK_HOLE or SEEK_END
  *
+ *  lseek() of the database file, or of the segments of a segmented one.
  *
- *  console:  <see above>      on success, print table or database empty
- *            M_ERR_DB_READ    error reading or seeking the database file
+ *  returns:  the resulting offset, or -1 with errno set
+ */
+static off_t db_seek(int fd, off_t offset, int whence)
+{
+    if (seg_active(fd))
+    {
+        return seg_seek(offset, whence);
+    }
+
+    return lseek(fd, offset, whence);
+}
+
+/*
+ *  db_size
+ *      fd:  linux file descriptor
  *
+ *  returns:  the size of the database, or -1 on error
  */
-int print_db(int fd)
+off_t db_size(int fd)
 {
-    student_t student;
-    bool header_printed = false; // Flag to print the header once
-    int records_found = 0; // Counter for valid records
-    ssize_t bytes_read;
+    return db_seek(fd, 0, SEEK_END);
+}
 
-    // Read through the database
-    while ((bytes_read = read(fd, &student, sizeof(student_t))) == sizeof(student_t))
+/*
+ *  db_skip_hole
+ *      fd:         linux file descriptor
+ *      position:   offset of the next record the caller wants to read
+ *      *data_end:  end of the allocated extent found by the previous call,
+ *                  callers start a scan with it set to 0
+ *
+ *  student.db is a sparse file, most of the slots between valid records were
+ *  never written and are holes that read back as zeros.  Full table scans
+ *  use this to jump over them with lseek(SEEK_DATA/SEEK_HOLE), so a scan
+ *  only reads the allocated extents of the file.
+ *
+ *  returns:  the offset of the next record to read, this is position while
+ *            it is inside the current extent, otherwise the first record of
+ *            the next extent.  When there is no more data the file size is
+ *            returned, so the following read hits EOF.
+ *            -1 on error
+ */
+static off_t db_skip_hole(int fd, off_t position, off_t *data_end)
+{
+    if (position < *data_end)
     {
-        // Check if the record is valid
-        if (memcmp(&student, &EMPTY_STUDENT_RECORD, sizeof(student_t)) != 0)
-        {
-            if (!header_printed)
-            {
-                // Print header on first valid record
-                printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
-                header_printed = true; // Mark header as printed
-            }
-            // Convert GPA to float and print the student record
-            float real_gpa = student.gpa / 100.0;
-            printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname, student.lname, real_gpa);
-            records_found++; // Increment record counter
-        }
+        return position;
     }
 
-    if (bytes_read == -1)
+    off_t start = db_seek(fd, position, SEEK_DATA);
+    if (start == -1)
     {
-        printf(M_ERR_DB_READ); // Print error if reading fails
-        return ERR_DB_FILE;
+        // ENXIO means there is no data after position, the file may end
+        // in a hole
+        if (errno == ENXIO)
+        {
+            *data_end = db_size(fd);
+            return *data_end;
+        }
+        // Filesystem without hole support, the rest of the file is data
+        if (errno == EINVAL)
+        {
+            *data_end = db_size(fd);
+            return position;
+        }
+        return -1;
     }
 
-    // If no records found, print message
-    if (records_found == 0)
+    off_t end = db_seek(fd, start, SEEK_HOLE);
+    if (end == -1)
     {
-        printf(M_DB_EMPTY);
+        return -1;
     }
+    *data_end = end;
 
-    return NO_ERROR; // Return success
+    // Extents are block aligned, but keep reading on record boundaries
+    start -= start % sizeof(student_t);
+    return (start < position) ? position : start;
 }
 
 /*
- *  print_student
- *      *s:   a pointer to a student_t structure that should
- *            contain a valid student to be printed
+ *  db_scan_open
+ *      scan:  scan state to initialize
+ *      fd:    linux file descriptor
  *
- *  Start by ensuring that provided student pointer is valid.  To do this
- *  make sure it is not NULL and that s->id is not zero.  After ensuring
- *  that the student is valid, print it the exact way that is described
- *  in the print_db() function by first printing the header then the
- *  student data:
+ *  Starts a full table scan.  Instead of one read per record the scan moves
+ *  the file in DB_SCAN_BLOCK sized, block aligned chunks and hands out the
+ *  records from the buffer; a mapped database is scanned in place.  Holes
+ *  are skipped with db_skip_hole().  count, print, compress and queries all
+ *  go through db_scan_next().
  *
- *     printf(STUDENT_PRINT_HDR_STRING, "ID",
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the block buffer could not be allocated, or the
+ *                           grown file could not be mapped
+ */
+int db_scan_open(db_scan_t *scan, int fd)
+{
+    if (fd == db_map_fd && db_map_grown(fd) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+
+    return db_scan_range(scan, fd, 0, DB_SCAN_TO_EOF);
+}
+
+/*
+ *  db_scan_range
+ *      scan:   scan state to initialize
+ *      fd:     linux file descriptor
+ *      start:  file offset of the first record to scan
+ *      end:    file offset the scan stops at, or DB_SCAN_TO_EOF
+ *
+ *  Like db_scan_open() for the part of the file between start and end,
+ *  parallel scans give each thread its own range.  Only pread() and
+ *  lseek() results are used, so scans of one fd can run side by side.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the block buffer could not be allocated
+ */
+int db_scan_range(db_scan_t *scan, int fd, off_t start, off_t end)
+{
+    memset(scan, 0, sizeof(db_scan_t));
+    scan->fd = fd;
+    scan->position = start;
+    scan->data_end = start;
+    scan->end = end;
+
+    if (fd != db_map_fd)
+    {
+        scan->block = malloc(DB_SCAN_BLOCK);
+        if (scan->block == NULL)
+        {
+            return ERR_DB_FILE;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  db_scan_fill
+ *      scan:  scan state
+ *
+ *  Loads the next block of allocated data into the scan buffer.  A block
+ *  never crosses a DB_SCAN_BLOCK boundary or the end of the current extent.
+ *  Snapshot readers get the blocks changed since their snapshot put back,
+ *  see snap_overlay().
+ *
+ *  returns:  1 a block was loaded, 0 at EOF, -1 on error
+ */
+static int db_scan_fill(db_scan_t *scan)
+{
+    bool snapshot = snap_reading(scan->fd);
+    off_t position = db_skip_hole(scan->fd, scan->position, &scan->data_end);
+    if (position == -1)
+    {
+        return -1;
+    }
+
+    // A snapshot ends where the file ended when it was taken, and blocks
+    // deleted since then may be holes by now
+    off_t end = scan->end;
+    if (snapshot)
+    {
+        position = snap_next_saved(scan->position, position);
+        if (end == DB_SCAN_TO_EOF || end > snap_size())
+        {
+            end = snap_size();
+        }
+    }
+
+    if (end != DB_SCAN_TO_EOF && position >= end)
+    {
+        return 0;
+    }
+
+    off_t block_end = (position / DB_SCAN_BLOCK + 1) * DB_SCAN_BLOCK;
+    if (block_end > scan->data_end)
+    {
+        block_end = scan->data_end;
+    }
+    if (end != DB_SCAN_TO_EOF && block_end > end)
+    {
+        block_end = end;
+    }
+    size_t want = block_end - position;
+
+    if (scan->fd == db_map_fd)
+    {
+        // Scan the mapping in place, nothing to copy
+        if ((size_t)position >= db_map_len)
+        {
+            return 0;
+        }
+        if (want > db_map_len - position)
+        {
+            want = db_map_len - position;
+        }
+        scan->buf = db_map + position;
+        scan->len = want;
+    }
+    else
+    {
+        size_t got = 0;
+        while (got < want)
+        {
+            ssize_t bytes_read = db_read(scan->fd, scan->block + got, want - got, position + got);
+            if (bytes_read == -1)
+            {
+                return -1;
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+            got += bytes_read;
+        }
+        if (snapshot && snap_overlay(scan->block, position, got) != NO_ERROR)
+        {
+            return -1;
+        }
+        scan->buf = scan->block;
+        scan->len = got;
+    }
+
+    // Ignore a partial record at the end of the file
+    scan->len -= scan->len % sizeof(student_t);
+    if (scan->len == 0)
+    {
+        return 0;
+    }
+
+    scan->buf_offset = position;
+    scan->next = 0;
+    scan->position = position + scan->len;
+    return 1;
+}
+
+/*
+ *  db_scan_next
+ *      scan:  scan state from db_scan_open()
+ *      *s:    set to the next valid record, the pointer stays valid until
+ *             the next call
+ *
+ *  Empty and deleted slots are skipped.  scan->record_offset is the file
+ *  offset of the record returned.
+ *
+ *  returns:  1 a record was returned, 0 at the end of the table, -1 on error
+ */
+int db_scan_next(db_scan_t *scan, const student_t **s)
+{
+    for (;;)
+    {
+        while (scan->next < scan->len)
+        {
+            const student_t *curr = (const student_t *)(scan->buf + scan->next);
+            scan->record_offset = scan->buf_offset + scan->next;
+            scan->next += sizeof(student_t);
+
+            if (memcmp(curr, &EMPTY_STUDENT_RECORD, sizeof(student_t)) != 0)
+            {
+                *s = curr;
+                return 1;
+            }
+        }
+
+        int rc = db_scan_fill(scan);
+        if (rc <= 0)
+        {
+            return rc;
+        }
+    }
+}
+
+/*
+ *  db_scan_block
+ *      scan:    scan state from db_scan_open()
+ *      *first:  set to the first slot handed out, valid until the next call
+ *
+ *  Hands out the rest of the current block, or else the next one, as an
+ *  array of slots.  Unlike db_scan_next() the empty and deleted slots are
+ *  not skipped, this is for passes that look at a field of every slot at
+ *  the fixed sizeof(student_t) stride.
+ *
+ *  returns:  <number>  number of slots at *first
+ *            0         at the end of the table
+ *            -1        on error
+ */
+int db_scan_block(db_scan_t *scan, const student_t **first)
+{
+    if (scan->next >= scan->len)
+    {
+        int rc = db_scan_fill(scan);
+        if (rc <= 0)
+        {
+            return rc;
+        }
+    }
+
+    *first = (const student_t *)(scan->buf + scan->next);
+    size_t n = (scan->len - scan->next) / sizeof(student_t);
+    scan->record_offset = scan->buf_offset + scan->len - sizeof(student_t);
+    scan->next = scan->len;
+    return n;
+}
+
+/*
+ *  db_scan_close
+ *      scan:  scan state from db_scan_open()
+ *
+ *  returns:  nothing, this is a void function
+ */
+void db_scan_close(db_scan_t *scan)
+{
+    free(scan->block);
+    scan->block = NULL;
+}
+
+// One thread of db_scan_parallel()
+typedef struct db_scan_worker {
+    int fd;
+    off_t start;
+    off_t end;
+    db_scan_part_fn part;
+    void *arg;
+    int rc;
+} db_scan_worker_t;
+
+/*
+ *  db_scan_worker
+ *
+ *  pthread entry point, runs the part function over the range of one
+ *  db_scan_worker_t.
+ */
+static void *db_scan_worker(void *arg)
+{
+    db_scan_worker_t *w = arg;
+    db_scan_t scan;
+
+    w->rc = db_scan_range(&scan, w->fd, w->start, w->end);
+    if (w->rc == NO_ERROR)
+    {
+        w->rc = w->part(&scan, w->arg);
+        db_scan_close(&scan);
+    }
+
+    return NULL;
+}
+
+/*
+ *  db_scan_parallel
+ *      fd:        linux file descriptor
+ *      part:      runs the scan of one range, returns NO_ERROR or ERR_DB_FILE
+ *      args:      DB_SCAN_THREADS arguments for part, one per range
+ *      arg_size:  size of one argument in args
+ *
+ *  Full table scan split by id.  Records are fixed size, so the file is cut
+ *  into DB_SCAN_BLOCK aligned ranges of ascending ids and every range is
+ *  scanned by its own thread with its own block buffer.  The caller merges
+ *  the results of the ranges in order, which is id order.  A file of a
+ *  single block, or a machine with a single CPU, is scanned on the calling
+ *  thread without starting any.
+ *
+ *  returns:  <number>       ranges used, args[0] up to this were passed to part
+ *            ERR_DB_FILE    database file I/O issue in any of the ranges
+ */
+int db_scan_parallel(int fd, db_scan_part_fn part, void *args, size_t arg_size)
+{
+    db_scan_worker_t workers[DB_SCAN_THREADS];
+    pthread_t threads[DB_SCAN_THREADS];
+    bool started[DB_SCAN_THREADS] = { false };
+
+    // The threads share the mapping, it can only be replaced up front
+    if (fd == db_map_fd && db_map_grown(fd) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+
+    off_t size = snap_reading(fd) ? snap_size() : db_size(fd);
+    if (size == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    off_t blocks = (size + DB_SCAN_BLOCK - 1) / DB_SCAN_BLOCK;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nparts = (cpus < DB_SCAN_THREADS) ? (int)cpus : DB_SCAN_THREADS;
+    if (nparts > blocks)
+    {
+        nparts = (int)blocks;
+    }
+    if (nparts < 1)
+    {
+        nparts = 1;
+    }
+
+    // Whole blocks per range, the last range runs to EOF so records
+    // appended during the scan are not cut off
+    off_t per_part = (blocks + nparts - 1) / nparts * DB_SCAN_BLOCK;
+    for (int i = 0; i < nparts; i++)
+    {
+        workers[i].fd = fd;
+        workers[i].start = i * per_part;
+        workers[i].end = (i == nparts - 1) ? DB_SCAN_TO_EOF : (i + 1) * per_part;
+        workers[i].part = part;
+        workers[i].arg = (char *)args + i * arg_size;
+    }
+
+    // A range whose thread can not be started is scanned right here
+    for (int i = 1; i < nparts; i++)
+    {
+        started[i] = pthread_create(&threads[i], NULL, db_scan_worker, &workers[i]) == 0;
+    }
+    for (int i = 0; i < nparts; i++)
+    {
+        if (!started[i])
+        {
+            db_scan_worker(&workers[i]);
+        }
+    }
+
+    int rc = nparts;
+    for (int i = 0; i < nparts; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], NULL);
+        }
+        if (workers[i].rc != NO_ERROR)
+        {
+            rc = ERR_DB_FILE;
+        }
+    }
+
+    return rc;
+}
+
+/*
+ *  sync_db
+ *      fd:  linux file descriptor
+ *
+ *  Durability point, flushes everything written so far to stable storage.
+ *  For the memory mapped engine msync() writes the dirty pages of the
+ *  mapping back to the file, otherwise the file, or every segment of a
+ *  segmented database, is fdatasync()ed.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int sync_db(int fd)
+{
+    if (seg_active(fd))
+    {
+        return seg_sync();
+    }
+    if (fd == db_map_fd)
+    {
+        if (db_map != NULL && msync(db_map, db_map_len, MS_SYNC) == -1)
+        {
+            return ERR_DB_FILE;
+        }
+        return NO_ERROR;
+    }
+
+    if (fdatasync(fd) == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  close_db
+ *      fd:  linux file descriptor returned from open_db()
+ *
+ *  Closes the write-ahead log, syncs and unmaps a mapped database, writes
+ *  back the secondary indexes and then closes the file, the snapshot of a
+ *  snapshot reader and the io_uring ring of the batch paths.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int close_db(int fd)
+{
+    int rc = wal_close(fd);
+
+    if (fd == db_map_fd)
+    {
+        if (sync_db(fd) != NO_ERROR)
+        {
+            rc = ERR_DB_FILE;
+        }
+        if (db_map != NULL)
+        {
+            munmap(db_map, db_map_len);
+        }
+        db_map = NULL;
+        db_map_len = 0;
+        db_map_fd = -1;
+    }
+
+    if (fd == db_layout_fd)
+    {
+        db_layout_fd = -1;
+    }
+
+    if (idx_close(fd) != NO_ERROR)
+    {
+        rc = ERR_DB_FILE;
+    }
+
+    seg_close(fd);
+    snap_close(fd);
+    uring_close();
+    db_index_held = F_UNLCK;
+    if (close(fd) == -1)
+    {
+        rc = ERR_DB_FILE;
+    }
+
+    return rc;
+}
+
+/*
+ *  db_open_locked
+ *      dbFile:           name of the database file
+ *      should_truncate:  indicates if opening the file also empties it
+ *      type:             F_RDLCK or F_WRLCK for the session lock
+ *
+ *  Opens the database, takes the session lock and opens its segments, if it
+ *  is segmented, and its write-ahead log.
+ *  compress_db() renames the new file over the database while it holds the
+ *  session lock, so a process that was waiting for the lock may end up with
+ *  the replaced file.  It notices by the inode and opens the new one.
+ *
+ *  returns:  File descriptor on success, or -1 on failure
+ */
+static int db_open_locked(char *dbFile, bool should_truncate, short type)
+{
+    // Set permissions: rw-rw----
+    // see sys/stat.h for constants
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    struct stat opened;
+    struct stat current;
+
+    while (true)
+    {
+        // open the file if it exists for Read and Write,
+        // create it if it does not exist
+        int fd = open(dbFile, O_RDWR | O_CREAT, mode);
+        if (fd == -1)
+        {
+            return -1;
+        }
+
+        if (db_lock(fd, type, DB_LOCK_SESSION, 1) != NO_ERROR || fstat(fd, &opened) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+
+        if (stat(dbFile, &current) == 0 && current.st_dev == opened.st_dev &&
+            current.st_ino == opened.st_ino)
+        {
+            // Truncate only once the lock is held, O_TRUNC would empty the
+            // file under the feet of the processes using it
+            bool writer = (db_access == DB_ACCESS_WRITE || db_access == DB_ACCESS_EXCLUSIVE);
+            if ((should_truncate && ftruncate(fd, 0) == -1) ||
+                seg_open(dbFile, fd, should_truncate) != NO_ERROR)
+            {
+                close(fd);
+                return -1;
+            }
+            if (wal_open(dbFile, should_truncate, writer) != NO_ERROR)
+            {
+                seg_close(fd);
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
+
+        close(fd);
+    }
+}
+
+/*
+ *  open_db
+ *      dbFile:  name of the database file
+ *      should_truncate:  indicates if opening the file also empties it
+ *
+ *  Takes the locks of the access mode selected with set_db_access().  Records
+ *  left in the write-ahead log by an earlier run are replayed first, which
+ *  needs the database to itself for a moment.  With the DB_ENGINE_MMAP engine
+ *  selected the file is also memory mapped, and the secondary indexes are
+ *  opened alongside, rebuilt if the replay changed the database.  Writers
+ *  only open them in db_index_begin().  Use close_db() to release them.
+ *
+ *  returns:  File descriptor on success, or ERR_DB_FILE on failure
+ *
+ *  console:  Does not produce any console I/O on success
+ *            M_ERR_DB_OPEN on error
+ *
+ */
+
+int open_db(char *dbFile, bool should_truncate)
+{
+    short session = (db_access == DB_ACCESS_EXCLUSIVE) ? F_WRLCK : F_RDLCK;
+
+    snprintf(db_index_file, sizeof(db_index_file), "%s", dbFile);
+
+    // Now open file
+    int fd = db_open_locked(dbFile, should_truncate, session);
+    int pending = (fd < 0) ? ERR_DB_FILE : wal_check(fd);
+
+    // A shared session lock can not be upgraded in place without risking a
+    // deadlock with another process doing the same, start over exclusively
+    bool upgraded = (pending > 0 && session == F_RDLCK);
+    if (upgraded)
+    {
+        wal_close(fd);
+        seg_close(fd);
+        close(fd);
+        fd = db_open_locked(dbFile, should_truncate, F_WRLCK);
+        pending = (fd < 0) ? ERR_DB_FILE : 1;
+    }
+
+    int replayed = (pending > 0) ? wal_replay(fd) : pending;
+    if (replayed > 0)
+    {
+        idx_open(dbFile, fd, true);
+        idx_rebuild(fd);
+        idx_close(fd);
+    }
+
+    // Converting back to the shared lock never waits
+    if (replayed < 0 || (upgraded && db_lock(fd, F_RDLCK, DB_LOCK_SESSION, 1) != NO_ERROR))
+    {
+        if (fd >= 0)
+        {
+            wal_close(fd);
+            seg_close(fd);
+            close(fd);
+        }
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    // Snapshot readers patch what they read, and a segmented database is
+    // not one file to map, both keep the file I/O
+    if (db_engine == DB_ENGINE_MMAP && !seg_active(fd) && db_access != DB_ACCESS_SNAPSHOT &&
+        db_map_file(fd) != NO_ERROR)
+    {
+        wal_close(fd);
+        close(fd);
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    // Snapshot readers never wait for the index lock of a writer, they
+    // only use the occupancy index and only while no write began since
+    // their snapshot.  When no snapshot can be taken, for example because
+    // every reader slot is in use, they read like DB_ACCESS_READ.  Writers
+    // outside of exclusive sessions save what the snapshots need as they go.
+    bool snapshot = false;
+    if (db_access == DB_ACCESS_SNAPSHOT)
+    {
+        snapshot = (snap_open(dbFile, fd, true) == NO_ERROR);
+        if (snapshot)
+        {
+            idx_open_snapshot(dbFile, fd, snap_size());
+        }
+    }
+    else if (db_access == DB_ACCESS_LOOKUP || db_access == DB_ACCESS_WRITE)
+    {
+        snap_open(dbFile, fd, false);
+    }
+
+    // Readers share the index lock for the whole session, writers take it
+    // alone only while they write records, see db_index_begin().  Lookups
+    // never use the indexes.
+    if (db_access == DB_ACCESS_READ || (db_access == DB_ACCESS_SNAPSHOT && !snapshot))
+    {
+        if (db_lock(fd, F_RDLCK, DB_LOCK_INDEX, 1) != NO_ERROR)
+        {
+            close_db(fd);
+            printf(M_ERR_DB_OPEN);
+            return ERR_DB_FILE;
+        }
+        db_index_held = F_RDLCK;
+    }
+    if (db_access != DB_ACCESS_LOOKUP && db_access != DB_ACCESS_WRITE && !snapshot)
+    {
+        idx_open(dbFile, fd, db_access == DB_ACCESS_EXCLUSIVE);
+    }
+    db_id_limit = db_max_id(fd);
+
+    return fd;
+}
+
+/*
+ *  db_layout
+ *      fd:  linux file descriptor
+ *
+ *  add_student() places every record at id * sizeof(student_t), and since
+ *  ids start at MIN_STD_ID the first slot of such a file is always empty.
+ *  Files that were written non-positionally, for example by compress_db(),
+ *  pack the valid records from the start of the file, so a legacy file is
+ *  recognized by finding a student in slot 0.
+ *
+ *  Writes keep the layout of a file, so the answer is cached until the
+ *  database is closed with close_db().
+ *
+ *  returns:  DB_LAYOUT_POSITIONAL  records live at id * sizeof(student_t)
+ *            DB_LAYOUT_PACKED      records are packed, lookups must scan
+ *            ERR_DB_FILE           database file I/O issue
+ *
+ *  console:  Does not produce any console I/O
+ */
+int db_layout(int fd)
+{
+    student_t slot0;
+
+    if (fd == db_layout_fd)
+    {
+        return db_layout_cached;
+    }
+
+    ssize_t bytes_read = db_read(fd, &slot0, sizeof(student_t), 0);
+    if (bytes_read == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    // An empty file or an empty first slot is a positional database
+    db_layout_cached = DB_LAYOUT_POSITIONAL;
+    if (bytes_read == sizeof(student_t) &&
+        memcmp(&slot0, &EMPTY_STUDENT_RECORD, sizeof(student_t)) != 0)
+    {
+        db_layout_cached = DB_LAYOUT_PACKED;
+    }
+    db_layout_fd = fd;
+
+    return db_layout_cached;
+}
+
+/*
+ *  db_max_id
+ *      fd:  linux file descriptor
+ *
+ *  A single file has room for the ids up to MAX_STD_ID, the manifest of a
+ *  segmented database covers ids up to SEG_MAX_STD_ID.  The lock bytes lie
+ *  past the slot of the largest id either one takes.
+ *
+ *  returns:  the largest student id the database takes
+ */
+int db_max_id(int fd)
+{
+    return seg_active(fd) ? seg_max_id() : MAX_STD_ID;
+}
+
+/*
+ *  db_lock_record
+ *      fd:    linux file descriptor
+ *      id:    student id whose slot is locked
+ *      type:  F_RDLCK, F_WRLCK or F_UNLCK
+ *
+ *  Locks the slot of a student in a positional database.  A packed legacy
+ *  file has no slot per id, so the whole record area is locked instead.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int db_lock_record(int fd, int id, short type)
+{
+    int layout = db_layout(fd);
+    if (layout < 0)
+    {
+        return ERR_DB_FILE;
+    }
+
+    if (layout == DB_LAYOUT_PACKED || id < MIN_STD_ID || id > db_max_id(fd))
+    {
+        return db_lock(fd, type, 0, DB_LOCK_SESSION);
+    }
+
+    return db_lock(fd, type, (off_t)id * sizeof(student_t), sizeof(student_t));
+}
+
+/*
+ *  db_index_begin
+ *      fd:    linux file descriptor
+ *      type:  F_RDLCK to read records, F_WRLCK to write them
+ *
+ *  A DB_ACCESS_WRITE session writes records, and reads records whose slot
+ *  it does not lock, only between db_index_begin() and db_index_end().  It
+ *  holds the index lock just for that, so other writers run next to it and
+ *  readers wait for at most one commit worth of writes.  The indexes are
+ *  opened as the last writer left them and written back by
+ *  db_index_end().  Sessions of the other modes hold their locks and
+ *  indexes from open_db() to close_db(), for them this does nothing.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the index lock could not be taken
+ */
+static int db_index_begin(int fd, short type)
+{
+    if (db_access != DB_ACCESS_WRITE)
+    {
+        return NO_ERROR;
+    }
+    if (db_lock(fd, type, DB_LOCK_INDEX, 1) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+
+    db_index_held = type;
+    idx_open(db_index_file, fd, true);
+    return NO_ERROR;
+}
+
+/*
+ *  db_index_end
+ *      fd:  linux file descriptor
+ *
+ *  Closes the indexes and releases the index lock of db_index_begin().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    an index could not be written
+ */
+static int db_index_end(int fd)
+{
+    if (db_access != DB_ACCESS_WRITE)
+    {
+        return NO_ERROR;
+    }
+
+    int rc = idx_close(fd);
+    db_lock(fd, F_UNLCK, DB_LOCK_INDEX, 1);
+    db_index_held = F_UNLCK;
+    return rc;
+}
+
+/*
+ *  find_student
+ *      fd:      linux file descriptor
+ *      id:      the student id we are looking for
+ *      *s:      a pointer where the located (if found) student data will be
+ *               copied
+ *      *offset: set to the file offset of the located record
+ *
+ *  For positional databases the only slot that can hold the student is at
+ *  id * sizeof(student_t), so the lookup is a single db_read().  Packed legacy
+ *  files fall back to scanning the file record by record.
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not located in the database
+ *
+ *  console:  Does not produce any console I/O
+ */
+static int find_student(int fd, int id, student_t *s, off_t *offset)
+{
+    student_t curr; // Local variable to hold each student record
+    ssize_t bytes_read;
+
+    // Id 0 marks a deleted record, it can never be found
+    if (id < MIN_STD_ID)
+    {
+        return SRCH_NOT_FOUND;
+    }
+
+    int layout = db_layout(fd);
+    if (layout < 0)
+    {
+        return ERR_DB_FILE;
+    }
+
+    if (layout == DB_LAYOUT_POSITIONAL)
+    {
+        off_t position = (off_t)id * sizeof(student_t);
+
+        bytes_read = db_read(fd, &curr, sizeof(student_t), position);
+        if (bytes_read == -1)
+        {
+            return ERR_DB_FILE;
+        }
+
+        // Past EOF, or the slot is empty
+        if (bytes_read != sizeof(student_t) || curr.id != id)
+        {
+            return SRCH_NOT_FOUND;
+        }
+
+        memcpy(s, &curr, sizeof(student_t));
+        *offset = position;
+        return NO_ERROR;
+    }
+
+    // Packed file, scan it for the student
+    db_scan_t scan;
+    const student_t *scan_rec;
+    int rc;
+
+    if (db_scan_open(&scan, fd) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+    while ((rc = db_scan_next(&scan, &scan_rec)) > 0)
+    {
+        // If student found by matching ID, copy data to provided student pointer
+        if (scan_rec->id == id)
+        {
+            memcpy(s, scan_rec, sizeof(student_t));
+            *offset = scan.record_offset;
+            break;
+        }
+    }
+    db_scan_close(&scan);
+
+    // If reading fails, return error code
+    if (rc < 0)
+    {
+        return ERR_DB_FILE;
+    }
+    if (rc > 0)
+    {
+        return NO_ERROR;
+    }
+
+    return SRCH_NOT_FOUND; // Return if student not found
+}
+
+/*
+ *  get_student
+ *      fd:  linux file descriptor
+ *      id:  the student id we are looking forname of the
+ *      *s:  a pointer where the located (if found) student data will be
+ *           copied
+ *
+ *  returns:  NO_ERROR       student located and copied into *s
+ *            ERR_DB_FILE    database file I/O issue
+ *            SRCH_NOT_FOUND student was not located in the database
+ *
+ *  The slot is read under a read lock, so a concurrent add or delete of the
+ *  same student is either seen completely or not at all.  Sessions holding
+ *  the index lock skip it, records are only written under its write lock.
+ *
+ *  console:  Does not produce any console I/O used by other functions
+ */
+int get_student(int fd, int id, student_t *s)
+{
+    off_t offset;
+
+    if (db_index_held != F_UNLCK)
+    {
+        return find_student(fd, id, s, &offset);
+    }
+
+    if (db_lock_record(fd, id, F_RDLCK) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+    int rc = find_student(fd, id, s, &offset);
+    db_lock_record(fd, id, F_UNLCK);
+
+    return rc;
+}
+
+/*
+ *  init_student
+ *      *s:     record to fill in
+ *      id:     student id
+ *      fname:  student first name, truncated to fit the record
+ *      lname:  student last name, truncated to fit the record
+ *      gpa:    GPA as an integer
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void init_student(student_t *s, int id, const char *fname, const char *lname, int gpa)
+{
+    memset(s, 0, sizeof(student_t)); // Zero out the struct to ensure no uninitialized memory
+    s->id = id; // Set student ID
+    s->gpa = gpa; // Set student GPA
+
+    // Safely copy the first name with null termination
+    strncpy(s->fname, fname, sizeof(s->fname) - 1);
+    s->fname[sizeof(s->fname) - 1] = '\0';
+
+    // Safely copy the last name with null termination
+    strncpy(s->lname, lname, sizeof(s->lname) - 1);
+    s->lname[sizeof(s->lname) - 1] = '\0';
+}
+
+/*
+ *  punch_slot_block
+ *      fd:      linux file descriptor of a positional database
+ *      offset:  file offset of a slot that was just emptied
+ *
+ *  Deallocates the file system block holding the slot once every slot in it
+ *  is empty, so the storage of the file follows the live records without a
+ *  compress_db() pass.  The block is write locked while it is checked and
+ *  punched.  Callers release their slot lock first, two deletes in the same
+ *  block would wait for each other's slot otherwise.  A block that can not
+ *  be punched only costs storage, the delete already happened.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void punch_slot_block(int fd, off_t offset)
+{
+    char block[DB_SCAN_BLOCK / 64];
+    off_t blk = db_block_size(fd);
+
+    if (blk == -1 || blk > (off_t)sizeof(block))
+    {
+        return;
+    }
+
+    off_t start = offset - offset % blk;
+    off_t span = db_lock_span(start, blk);
+    if (db_lock(fd, F_WRLCK, start, span) != NO_ERROR)
+    {
+        return;
+    }
+
+    ssize_t len = db_read(fd, block, blk, start);
+    bool empty = (len > 0);
+    for (ssize_t i = 0; empty && i < len; i++)
+    {
+        empty = (block[i] == 0);
+    }
+    if (empty)
+    {
+        db_punch(fd, start, len);
+    }
+
+    db_lock(fd, F_UNLCK, start, span);
+}
+
+/*
+ *  log_student_write
+ *      fd:  linux file descriptor
+ *      *w:  the add or delete, w->op and w->image filled in by the caller,
+ *           only the id for a delete
+ *
+ *  First half of add_student() and del_student() for a caller that holds
+ *  the write lock of the slot.  Checks the slot and queues the records the
+ *  write changes with wal_log(), nothing is written or printed yet.  The
+ *  caller commits the log for any number of queued writes with one
+ *  wal_commit() and then calls apply_student_write() for each of them.
+ *
+ *  returns:  NO_ERROR       the records are queued
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      the student already exists, or is not there to
+ *                           be deleted
+ *
+ *  console:  Does not produce any console I/O
+ */
+static int log_student_write(int fd, student_write_t *w)
+{
+    student_t exist;
+    off_t offset;
+
+    w->logged = false;
+    w->rc = find_student(fd, w->image.id, &exist, &offset);
+    if (w->op == 'a')
+    {
+        w->rc = (w->rc == NO_ERROR) ? ERR_DB_OP : (w->rc == SRCH_NOT_FOUND) ? NO_ERROR : w->rc;
+    }
+    else
+    {
+        w->rc = (w->rc == SRCH_NOT_FOUND) ? ERR_DB_OP : w->rc;
+    }
+    if (w->rc != NO_ERROR)
+    {
+        return w->rc;
+    }
+
+    if (w->op == 'a')
+    {
+        // Calculate the position of the new student record, packed legacy
+        // databases have no slot per id and get it appended
+        w->offset = (off_t)w->image.id * sizeof(student_t);
+        if (db_layout(fd) == DB_LAYOUT_PACKED)
+        {
+            w->offset = db_size(fd);
+            if (w->offset == -1)
+            {
+                w->rc = ERR_DB_FILE;
+                return w->rc;
+            }
+            w->offset -= w->offset % sizeof(student_t);
+        }
+        w->logged = (wal_log(w->offset, &w->image) == NO_ERROR);
+        return NO_ERROR;
+    }
+
+    // Positional databases never use slot 0, so when the first record of a
+    // packed file is deleted the next valid record is moved into its place.
+    // Otherwise the file would look positional to db_layout().
+    w->image = exist;
+    w->offset = offset;
+    w->fill = EMPTY_STUDENT_RECORD;
+    w->fill_offset = offset;
+    if (offset == 0)
+    {
+        db_scan_t scan;
+        const student_t *scan_rec;
+        int rc;
+
+        if (db_scan_open(&scan, fd) != NO_ERROR)
+        {
+            w->rc = ERR_DB_FILE;
+            return w->rc;
+        }
+        while ((rc = db_scan_next(&scan, &scan_rec)) > 0)
+        {
+            if (scan.record_offset != 0 && scan_rec->id != DELETED_STUDENT_ID)
+            {
+                w->fill = *scan_rec;
+                w->fill_offset = scan.record_offset;
+                break;
+            }
+        }
+        db_scan_close(&scan);
+        if (rc < 0)
+        {
+            w->rc = ERR_DB_FILE;
+            return w->rc;
+        }
+    }
+
+    // Both writes are logged and share the commit
+    w->logged = (wal_log(offset, &w->fill) == NO_ERROR) &&
+                (w->fill_offset == offset ||
+                 wal_log(w->fill_offset, &EMPTY_STUDENT_RECORD) == NO_ERROR);
+    return NO_ERROR;
+}
+
+/*
+ *  apply_student_write
+ *      fd:         linux file descriptor
+ *      *w:         a write queued by log_student_write()
+ *      committed:  the wal_commit() after it succeeded
+ *
+ *  Second half of add_student() and del_student(), writes the records of a
+ *  committed write to the database, updates the indexes and reports the
+ *  outcome.  The slot lock is still held, and the locks of
+ *  begin_student_writes() are taken.  The block of a deleted student is
+ *  punched by finish_student_write().
+ *
+ *  returns:  NO_ERROR       the student was added or deleted
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      the student already exists, or is not there to
+ *                           be deleted
+ *
+ *  console:  what add_student() or del_student() print
+ */
+static int apply_student_write(int fd, student_write_t *w, bool committed)
+{
+    if (w->rc == ERR_DB_OP)
+    {
+        printf((w->op == 'a') ? M_ERR_DB_ADD_DUP : M_STD_NOT_FND_MSG, w->image.id);
+        return w->rc;
+    }
+    if (w->rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return w->rc;
+    }
+    if (!w->logged || !committed)
+    {
+        printf(M_ERR_DB_WRITE);
+        w->rc = ERR_DB_FILE;
+        return w->rc;
+    }
+
+    idx_begin();
+    if (w->op == 'a')
+    {
+        // Write the new student record to the file, past EOF this grows the file
+        if (db_write(fd, &w->image, sizeof(student_t), w->offset) != sizeof(student_t))
+        {
+            printf(M_ERR_DB_WRITE);
+            w->rc = ERR_DB_FILE;
+            return w->rc;
+        }
+        idx_add(&w->image, 1);
+        printf(M_STD_ADDED, w->image.id);
+        return NO_ERROR;
+    }
+
+    // Overwrite the student's record, an empty record marks it as deleted
+    if (db_write(fd, &w->fill, sizeof(student_t), w->offset) != sizeof(student_t) ||
+        (w->fill_offset != w->offset &&
+         db_write(fd, &EMPTY_STUDENT_RECORD, sizeof(student_t), w->fill_offset) != sizeof(student_t)))
+    {
+        printf(M_ERR_DB_WRITE);
+        w->rc = ERR_DB_FILE;
+        return w->rc;
+    }
+    idx_remove(&w->image);
+    printf(M_STD_DEL_MSG, w->image.id);
+    return NO_ERROR;
+}
+
+/*
+ *  finish_student_write
+ *      fd:  linux file descriptor
+ *      *w:  a write done by apply_student_write()
+ *
+ *  Releases the slot lock and gives back the block of a deleted student
+ *  once all of its slots are empty, see punch_slot_block().  Callers with
+ *  several writes apply all of them first, the punch releases the locks
+ *  of every slot in the block.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void finish_student_write(int fd, const student_write_t *w)
+{
+    db_lock_record(fd, w->image.id, F_UNLCK);
+    if (w->op == 'd' && w->rc == NO_ERROR && db_layout(fd) == DB_LAYOUT_POSITIONAL)
+    {
+        punch_slot_block(fd, w->offset);
+    }
+}
+
+/*
+ *  begin_student_writes
+ *      fd:  linux file descriptor
+ *
+ *  Takes the locks committed writes are applied under, the commit lock of
+ *  the snapshots and then the index lock, see snap_begin() and
+ *  db_index_begin().  Writers take them after their log commit, the
+ *  fdatasync() of one writer never holds up another.  End with
+ *  end_student_writes().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    a lock could not be taken, none is held
+ */
+static int begin_student_writes(int fd)
+{
+    if (snap_begin(fd) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+    if (db_index_begin(fd, F_WRLCK) != NO_ERROR)
+    {
+        snap_end();
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  end_student_writes
+ *      fd:  linux file descriptor
+ *
+ *  Writes back the indexes and releases the locks of begin_student_writes().
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void end_student_writes(int fd)
+{
+    db_index_end(fd);
+    snap_end();
+}
+
+/*
+ *  run_student_write
+ *      fd:  linux file descriptor
+ *      *w:  the add or delete, see log_student_write()
+ *
+ *  One add or delete with its own commit.  Single writes share DB_LOCK_WRITE,
+ *  a -b batch that writes holds it alone.  The slot stays write locked
+ *  from the check until the record is written, the commit and index locks
+ *  are only held while it is written.
+ *
+ *  returns:  what apply_student_write() returns
+ *
+ *  console:  what add_student() or del_student() print
+ */
+static int run_student_write(int fd, student_write_t *w)
+{
+    if (db_lock(fd, F_RDLCK, DB_LOCK_WRITE, 1) != NO_ERROR ||
+        db_lock_record(fd, w->image.id, F_WRLCK) != NO_ERROR)
+    {
+        db_lock(fd, F_UNLCK, DB_LOCK_WRITE, 1);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    log_student_write(fd, w);
+    bool committed = (wal_commit() == NO_ERROR);
+    bool locked = (begin_student_writes(fd) == NO_ERROR);
+    int rc = apply_student_write(fd, w, committed && locked);
+    if (locked)
+    {
+        end_student_writes(fd);
+    }
+    finish_student_write(fd, w);
+    db_lock(fd, F_UNLCK, DB_LOCK_WRITE, 1);
+
+    return rc;
+}
+
+/*
+ *  add_student
+ *      fd:     linux file descriptor
+ *      id:     student id (range is defined in db.h )
+ *      fname:  student first name
+ *      lname:  student last name
+ *      gpa:    GPA as an integer (range defined in db.h)
+ *
+ *  Adds a new student to the database.  After calculating the index for the
+ *  student, check if there is another student already at that location.  A good
+ *  way is to use something like memcmp() to ensure that the location for this
+ *  student contains all zero byes indicating the space is empty.
+ *
+ *  For a positional database that check is the single read of the target
+ *  slot done by find_student().  Writing the slot only grows the file when
+ *  the id is past EOF, it never shrinks it.  Packed legacy databases have
+ *  no slot per id, the record is appended to them instead.  The record is
+ *  committed to the write-ahead log before the database is written, and
+ *  the slot stays write locked from the check until then.
+ *
+ *  returns:  NO_ERROR       student added to database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           already exists)
+ *
+ *
+ *  console:  M_STD_ADDED       on success
+ *            M_ERR_DB_ADD_DUP  student already exists
+ *            M_ERR_DB_READ     error reading or seeking the database file
+ *            M_ERR_DB_WRITE    error writing to db file (adding student)
+ *
+ */
+
+int add_student(int fd, int id, char *fname, char *lname, int gpa)
+{
+    student_write_t w;
+
+    w.op = 'a';
+    init_student(&w.image, id, fname, lname, gpa);
+    return run_student_write(fd, &w);
+}
+
+/*
+ *  del_student
+ *      fd:     linux file descriptor
+ *      id:     student id to be deleted
+ *
+ *  Removes a student to the database.  Use find_student() to locate the
+ *  student to be deleted. If there is a student at that location write an
+ *  empty student record - see EMPTY_STUDENT_RECORD from db.h at that
+ *  location.  The slot stays write locked from the lookup until then.  In a
+ *  positional database the file system block of the slot is deallocated
+ *  once all of its slots are empty, see punch_slot_block().
+ *
+ *  returns:  NO_ERROR       student deleted from database
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           not in database)
+ *
+ *
+ *  console:  M_STD_DEL_MSG      on success
+ *            M_STD_NOT_FND_MSG  student not in database, cant be deleted
+ *            M_ERR_DB_READ      error reading or seeking the database file
+ *            M_ERR_DB_WRITE     error writing to db file (adding student)
+ *
+ */
+int del_student(int fd, int id)
+{
+    student_write_t w;
+
+    w.op = 'd';
+    w.image.id = id;
+    return run_student_write(fd, &w);
+}
+
+/*
+ *  load_students
+ *      fd:      linux file descriptor
+ *      *table:  empty table of student_t up to db_max_id()
+ *
+ *  Reads every student into its entry of table with a single scan, used by
+ *  the server mode.
+ *
+ *  returns:  <number>       number of students loaded
+ *            ERR_DB_FILE    database file I/O issue or out of memory
+ */
+int load_students(int fd, id_table_t *table)
+{
+    db_scan_t scan;
+    const student_t *student;
+    int count = 0;
+    int rc;
+
+    if (db_scan_open(&scan, fd) != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+    while ((rc = db_scan_next(&scan, &student)) > 0)
+    {
+        if (student->id >= MIN_STD_ID && student->id <= table->max_id)
+        {
+            student_t *entry = idtab_put(table, student->id);
+            if (entry == NULL)
+            {
+                rc = -1;
+                break;
+            }
+            *entry = *student;
+            count++;
+        }
+    }
+    db_scan_close(&scan);
+
+    return (rc < 0) ? ERR_DB_FILE : count;
+}
+
+/*
+ *  store_students
+ *      fd:       linux file descriptor of a positional database
+ *      ids:      slot of each image
+ *      images:   new contents of the slots, an empty record deletes
+ *      n:        number of slots
+ *
+ *  Write-back path of the server mode.  All images are committed to the
+ *  write-ahead log together, then written to their slots.  The indexes
+ *  follow the difference to what each slot held before, and slots that end
+ *  up empty give their block back like in del_student().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+int store_students(int fd, const int *ids, const student_t *images, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (wal_log((off_t)ids[i] * sizeof(student_t), &images[i]) != NO_ERROR)
+        {
+            return ERR_DB_FILE;
+        }
+    }
+    if (wal_commit() != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+
+    idx_begin();
+    for (size_t i = 0; i < n; i++)
+    {
+        off_t position = (off_t)ids[i] * sizeof(student_t);
+        student_t old = EMPTY_STUDENT_RECORD;
+
+        ssize_t bytes_read = db_read(fd, &old, sizeof(student_t), position);
+        if (bytes_read == -1)
+        {
+            return ERR_DB_FILE;
+        }
+        if (old.id == images[i].id && images[i].id == DELETED_STUDENT_ID)
+        {
+            continue; // added and deleted again before it was ever written
+        }
+
+        if (db_write(fd, &images[i], sizeof(student_t), position) != sizeof(student_t))
+        {
+            return ERR_DB_FILE;
+        }
+        if (old.id != DELETED_STUDENT_ID)
+        {
+            idx_remove(&old);
+        }
+        if (images[i].id != DELETED_STUDENT_ID)
+        {
+            idx_add(&images[i], 1);
+        }
+        else
+        {
+            punch_slot_block(fd, position);
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  count_part
+ *      scan:  scan of one id range
+ *      arg:   int the number of students in the range is stored in
+ *
+ *  db_scan_parallel() part of count_db_records().
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int count_part(db_scan_t *scan, void *arg)
+{
+    const student_t *student;
+    int *count = arg;
+    int rc;
+
+    *count = 0;
+    // Every record handed out by the scan is a valid one
+    while ((rc = db_scan_next(scan, &student)) > 0)
+    {
+        (*count)++;
+    }
+
+    return (rc < 0) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  count_db_records
+ *      fd:     linux file descriptor
+ *
+ *  Counts the number of records in the database.  When the occupancy
+ *  index is valid the count is its popcount and the database is not read
+ *  at all.  Otherwise the file is split into id ranges by
+ *  db_scan_parallel() and count_part() counts every record db_scan_next()
+ *  hands out.  The scan reads the file in large blocks, skips the
+ *  unallocated holes and only returns the slots that are not all zeros, so
+ *  empty and deleted slots are never counted.
+ *
+ *  returns:  <number>       returns the number of records in db on success
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      database operation logically failed (aka student
+ *                           not in database)
+ *
+ *
+ *  console:  M_DB_RECORD_CNT  on success, to report the number of students in db
+ *            M_DB_EMPTY       on success if the record count in db is zero
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *            M_ERR_DB_WRITE   error writing to db file (adding student)
+ *
+ */
+int count_db_records(int fd)
+{
+    int count = 0; // Counter for the records
+    int counts[DB_SCAN_THREADS];
+    int rc = 0;
+
+    // The occupancy index has one bit per student
+    count = occ_valid() ? occ_count() : -1;
+    if (count < 0)
+    {
+        count = 0;
+        rc = db_scan_parallel(fd, count_part, counts, sizeof(int));
+        for (int i = 0; i < rc; i++)
+        {
+            count += counts[i]; // Add up the records of each range
+        }
+    }
+
+    if (rc < 0)
+    {
+        return ERR_DB_FILE; // Return error if reading fails
+    }
+
+    // If no records found, print message
+    if (count == 0)
+    {
+        printf(M_DB_EMPTY);
+    }
+    else
+    {
+        printf(M_DB_RECORD_CNT, count); // Print the record count
+    }
+
+    return count; // Return the count of records
+}
+
+/*
+ *  occ_index_pays_off
+ *      fd:  linux file descriptor
+ *
+ *  Printing through the occupancy index reads one slot per student, while a
+ *  scan reads one block per extent or DB_SCAN_BLOCK.  The index only wins
+ *  for positional databases that are mapped, where a read is a copy, or
+ *  where students are sparse enough to average less than one per
+ *  OCC_SPARSE_BYTES of file.
+ *
+ *  returns:  true if print_db() should walk the occupancy index
+ */
+static bool occ_index_pays_off(int fd)
+{
+    if (!occ_valid() || db_layout(fd) != DB_LAYOUT_POSITIONAL)
+    {
+        return false;
+    }
+
+    if (fd == db_map_fd)
+    {
+        return true;
+    }
+
+    off_t size = snap_reading(fd) ? snap_size() : db_size(fd);
+    int count = occ_count();
+    return (size != -1) && (count >= 0) && ((off_t)count * OCC_SPARSE_BYTES < size);
+}
+
+/*
+ *  format_field
+ *      dst:    output buffer
+ *      name:   NUL padded name, not terminated if it fills the field
+ *      size:   size of the name field
+ *      width:  width and precision of the column
+ *
+ *  Same as "%-<width>.<width>s".
+ *
+ *  returns:  the end of the column in dst
+ */
+static char *format_field(char *dst, const char *name, size_t size, size_t width)
+{
+    size_t len = strnlen(name, (size < width) ? size : width);
+
+    memcpy(dst, name, len);
+    memset(dst + len, ' ', width - len);
+    return dst + width;
+}
+
+/*
+ *  format_int
+ *      dst:  output buffer
+ *      v:    number to print
+ *
+ *  Same as "%d".
+ *
+ *  returns:  the end of the number in dst
+ */
+static char *format_int(char *dst, int v)
+{
+    char digits[12];
+    int n = 0;
+
+    unsigned int u = (v < 0) ? 0u - (unsigned int)v : (unsigned int)v;
+    do
+    {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u > 0);
+    if (v < 0)
+    {
+        digits[n++] = '-';
+    }
+    while (n > 0)
+    {
+        *dst++ = digits[--n];
+    }
+
+    return dst;
+}
+
+/*
+ *  format_student
+ *      dst:  output buffer of at least STUDENT_ROW_MAX bytes
+ *      *s:   student to format
+ *
+ *  Formats s exactly like printf(STUDENT_PRINT_FMT_STRING, ...) with the
+ *  float GPA, without stdio.  The GPA is in hundredths, so it is printed
+ *  from the integer; a float holds any GPA below GPA_EXACT_MAX close enough
+ *  that "%.2f" rounds it back to the same hundredths.  Larger ones, only
+ *  found in damaged records, go through snprintf().
+ *
+ *  returns:  the length of the row, not NUL terminated
+ */
+#define GPA_EXACT_MAX 100000
+size_t format_student(char *dst, const student_t *s)
+{
+    char *p = format_int(dst, s->id);
+    while (p - dst < 6)
+    {
+        *p++ = ' ';
+    }
+    *p++ = ' ';
+    p = format_field(p, s->fname, sizeof(s->fname), 24);
+    *p++ = ' ';
+    p = format_field(p, s->lname, sizeof(s->lname), 32);
+    *p++ = ' ';
+
+    if (s->gpa > -GPA_EXACT_MAX && s->gpa < GPA_EXACT_MAX)
+    {
+        int gpa = (s->gpa < 0) ? -s->gpa : s->gpa;
+        if (s->gpa < 0)
+        {
+            *p++ = '-';
+        }
+        p = format_int(p, gpa / 100);
+        *p++ = '.';
+        *p++ = '0' + (gpa % 100) / 10;
+        *p++ = '0' + gpa % 10;
+        *p++ = '\n';
+    }
+    else
+    {
+        float real_gpa = s->gpa / 100.0;
+        p += snprintf(p, STUDENT_ROW_MAX - (p - dst), "%-3.2f\n", real_gpa);
+    }
+
+    return p - dst;
+}
+
+/*
+ *  print_row
+ *      part:  output buffer
+ *      *s:    student to add, NULL for the column header
+ *
+ *  Appends one formatted row to part, growing its buffer as needed.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    out of memory
+ */
+static int print_row(print_part_t *part, const student_t *s)
+{
+    if (part->cap - part->len < STUDENT_ROW_MAX)
+    {
+        size_t cap = (part->cap == 0) ? PRINT_OUT_BUF : part->cap * 2;
+        char *text = realloc(part->text, cap);
+        if (text == NULL)
+        {
+            return ERR_DB_FILE;
+        }
+        part->text = text;
+        part->cap = cap;
+    }
+
+    if (s == NULL)
+    {
+        part->len += snprintf(part->text + part->len, STUDENT_ROW_MAX, STUDENT_PRINT_HDR_STRING,
+                              "ID", "FIRST NAME", "LAST_NAME", "GPA");
+        return NO_ERROR;
+    }
+    part->len += format_student(part->text + part->len, s);
+    part->rows++;
+    return NO_ERROR;
+}
+
+/*
+ *  print_write
+ *      iov:     buffers to print
+ *      iovcnt:  number of buffers
+ *
+ *  Writes the buffers to stdout with writev(), after whatever stdio still
+ *  holds.  A failing stdout is ignored like a failing printf().
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void print_write(struct iovec *iov, int iovcnt)
+{
+    fflush(stdout);
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(STDOUT_FILENO, iov, iovcnt);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return;
+        }
+
+        // skip what was written, a short write resumes mid buffer
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/*
+ *  print_flush
+ *      part:  output buffer
+ *      done:  free the buffer after writing it
+ *
+ *  Writes the rows of part to stdout and empties it.
+ *
+ *  returns:  nothing, this is a void function
+ */
+static void print_flush(print_part_t *part, bool done)
+{
+    struct iovec iov = { part->text, part->len };
+
+    print_write(&iov, 1);
+    part->len = 0;
+    if (done)
+    {
+        free(part->text);
+        part->text = NULL;
+        part->cap = 0;
+    }
+}
+
+/*
+ *  print_part
+ *      scan:  scan of one id range
+ *      arg:   print_part_t the rows of the range are formatted into
+ *
+ *  db_scan_parallel() part of print_db(), formats the rows of its range
+ *  into a memory buffer, so the ranges can be printed in id order.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue or out of memory
+ */
+static int print_part(db_scan_t *scan, void *arg)
+{
+    print_part_t *part = arg;
+    const student_t *student;
+    int rc;
+
+    while ((rc = db_scan_next(scan, &student)) > 0)
+    {
+        if (print_row(part, student) != NO_ERROR)
+        {
+            return ERR_DB_FILE;
+        }
+    }
+
+    return (rc < 0) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  occ_collect_ids
+ *      **ids:  set to the ids in the occupancy index, to be free()d
+ *
+ *  A snapshot reader uses the index without the index lock, so the ids are
+ *  collected and checked against the snapshot once, before any is printed.
+ *
+ *  returns:  number of ids, -1 if the index can not be used
+ */
+static int occ_collect_ids(int **ids)
+{
+    int count = occ_count();
+    int n = 0;
+
+    *ids = (count > 0) ? malloc(count * sizeof(int)) : NULL;
+    if (count < 0 || (count > 0 && *ids == NULL))
+    {
+        return -1;
+    }
+    for (int id = occ_next(MIN_STD_ID); id >= 0 && n <= count; id = occ_next(id + 1))
+    {
+        if (n < count)
+        {
+            (*ids)[n] = id;
+        }
+        n++;
+    }
+
+    if (n != count || !occ_valid())
+    {
+        free(*ids);
+        *ids = NULL;
+        return -1;
+    }
+    return n;
+}
+
+/*
+ *  print_db
+ *      fd:     linux file descriptor
+ *
+ *  Prints all records in the database in id order.  The file is split into
+ *  id ranges by db_scan_parallel() and print_part() formats the records of
+ *  each range, db_scan_next() reads large blocks, skips the unallocated
+ *  holes and only returns the slots that are not all zeros.  When
+ *  occ_index_pays_off() the students are read one slot at a time through
+ *  the occupancy index instead.  The rows are formatted by
+ *  format_student() and leave in large write()s, the output is the same as
+ *
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID",
+ *                  "FIRST NAME", "LAST_NAME", "GPA");
+ *
+ *  once before the first row, then for each student
+ *
+ *     printf(STUDENT_PRINT_FMT_STRING, student.id, student.fname,
+ *                    student.lname, student.gpa / 100.0);
+ *
+ *  A database without students prints M_DB_EMPTY instead.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_DB_READ    error reading or seeking the database file
+ *
+ */
+int print_db(int fd)
+{
+    print_part_t parts[DB_SCAN_THREADS] = { 0 };
+    print_part_t out = { 0 };
+    struct iovec iov[DB_SCAN_THREADS + 1];
+    const student_t *student;
+    student_t slot;
+    bool header_printed = false; // Flag to print the header once
+    int records_found = 0; // Counter for valid records
+    int *ids = NULL;
+    int rc = 0;
+
+    int nids = occ_index_pays_off(fd) ? occ_collect_ids(&ids) : -1;
+    if (nids < 0)
+    {
+        // Each id range is formatted on its own thread, the ranges are then
+        // printed in order, which is id order, behind the header
+        rc = db_scan_parallel(fd, print_part, parts, sizeof(print_part_t));
+        for (int i = 0; i < rc; i++)
+        {
+            records_found += parts[i].rows;
+        }
+        if (records_found > 0 && print_row(&out, NULL) != NO_ERROR)
+        {
+            rc = -1;
+        }
+        else if (records_found > 0)
+        {
+            iov[0] = (struct iovec){ out.text, out.len };
+            for (int i = 0; i < rc; i++)
+            {
+                iov[i + 1] = (struct iovec){ parts[i].text, parts[i].len };
+            }
+            print_write(iov, rc + 1);
+        }
+        for (int i = 0; i < DB_SCAN_THREADS; i++)
+        {
+            free(parts[i].text);
+        }
+        free(out.text);
+    }
+    else
+    {
+        // Jump straight to the slots set in the occupancy index
+        for (int i = 0; i < nids; i++)
+        {
+            int id = ids[i];
+            off_t offset = (off_t)id * sizeof(student_t);
+            if (db_read(fd, &slot, sizeof(student_t), offset) != sizeof(student_t) ||
+                (snap_reading(fd) && snap_overlay((char *)&slot, offset, sizeof(student_t)) != NO_ERROR))
+            {
+                rc = -1;
+                break;
+            }
+            student = &slot;
+            if (student->id != id)
+            {
+                continue; // stale bit, nothing to print
+            }
+
+            // Print header on first valid record, then the student record
+            if ((!header_printed && print_row(&out, NULL) != NO_ERROR) ||
+                print_row(&out, student) != NO_ERROR)
+            {
+                rc = -1;
+                break;
+            }
+            header_printed = true;
+            records_found++; // Increment record counter
+            if (out.len >= PRINT_OUT_BUF - STUDENT_ROW_MAX)
+            {
+                print_flush(&out, false);
+            }
+        }
+        print_flush(&out, true);
+        free(ids);
+    }
+
+    if (rc < 0)
+    {
+        printf(M_ERR_DB_READ); // Print error if reading fails
+        return ERR_DB_FILE;
+    }
+
+    // If no records found, print message
+    if (records_found == 0)
+    {
+        printf(M_DB_EMPTY);
+    }
+
+    return NO_ERROR; // Return success
+}
+
+/*
+ *  print_student
+ *      *s:   a pointer to a student_t structure that should
+ *            contain a valid student to be printed
+ *
+ *  Start by ensuring that provided student pointer is valid.  To do this
+ *  make sure it is not NULL and that s->id is not zero.  After ensuring
+ *  that the student is valid, print it the exact way that is described
+ *  in the print_db() function by first printing the header then the
+ *  student data:
+ *
+ *     printf(STUDENT_PRINT_HDR_STRING, "ID",
  *                  "FIRST NAME", "LAST_NAME", "GPA");
  *
- *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname,
- *                    student.lname, calculated_gpa_from_s);
+ *     printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname,
+ *                    student.lname, calculated_gpa_from_s);
+ *
+ *  Dont forget that  the GPA in the student structure is an int, to convert
+ *  it into a real gpa divide by 100.0 and store in a float variable.
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *
+ *  console:  <see above>      on success, print table or database empty
+ *            M_ERR_STD_PRINT  if the function argument s is NULL or if
+ *                             s->id is zero
+ *
+ */
+void print_student(student_t *s)
+{
+    if (s == NULL || s->id == 0)
+    {
+        printf(M_ERR_STD_PRINT); // Print error if student is invalid
+        return;
+    }
+
+    // Print header once
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+
+    // Convert GPA to float and print student details
+    float real_gpa = s->gpa / 100.0;
+    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, real_gpa);
+}
+
+/*
+ *  compare_student_id
+ *
+ *  qsort() comparator ordering student records by id.
+ */
+int compare_student_id(const void *a, const void *b)
+{
+    const student_t *sa = a;
+    const student_t *sb = b;
+
+    return (sa->id > sb->id) - (sa->id < sb->id);
+}
+
+/*
+ *  punch_range
+ *      seg:    unused, this is a seg_part_fn
+ *      start:  DB_SCAN_BLOCK aligned offset the compaction starts at
+ *      end:    offset it stops at, or DB_SCAN_TO_EOF
+ *      arg:    int the linux file descriptor of a positional database
+ *
+ *  Online compaction of one range of the file, see punch_empty_slots().
+ *  The allocated extents of the range are walked a
+ *  DB_SCAN_BLOCK chunk at a time, and each chunk is write locked only while
+ *  it is checked.  Adds, deletes and lookups in the other chunks carry on.
+ *  Every file system block of the chunk that holds nothing but empty slots
+ *  is handed back with fallocate(FALLOC_FL_PUNCH_HOLE).  The file keeps its
+ *  size and the holes read back as empty records, so nothing else changes,
+ *  not even the indexes.  The work is proportional to the allocated part of
+ *  the file, never to the whole id range.
+ *
+ *  returns:  NO_ERROR       on success, or if the file system can not punch
+ *                           holes
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int punch_range(int seg, off_t start, off_t end, void *arg)
+{
+    int fd = *(int *)arg;
+    (void)seg;
+
+    off_t blk = db_block_size(fd);
+    if (blk == -1)
+    {
+        return ERR_DB_FILE;
+    }
+
+    char *chunk = malloc(DB_SCAN_BLOCK);
+    char *zeros = calloc(1, blk);
+    if (chunk == NULL || zeros == NULL)
+    {
+        free(chunk);
+        free(zeros);
+        return ERR_DB_FILE;
+    }
+
+    int rc = NO_ERROR;
+    off_t data_end = start;
+    off_t position = start;
+    bool can_punch = true;
+    while (rc == NO_ERROR && can_punch)
+    {
+        position = db_skip_hole(fd, position, &data_end);
+        if (position == -1)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+        position -= position % DB_SCAN_BLOCK;
+        if (end != DB_SCAN_TO_EOF && position >= end)
+        {
+            break;
+        }
+
+        off_t span = db_lock_span(position, DB_SCAN_BLOCK);
+        if (db_lock(fd, F_WRLCK, position, span) != NO_ERROR)
+        {
+            rc = ERR_DB_FILE;
+            break;
+        }
+
+        ssize_t len = db_read(fd, chunk, DB_SCAN_BLOCK, position);
+        if (len == -1)
+        {
+            rc = ERR_DB_FILE;
+        }
+
+        // Punch each run of empty blocks with a single call.  Only whole
+        // blocks count as empty, so the partial block at EOF, or EOF
+        // itself, ends a run that reaches the end of the file
+        off_t run_start = -1;
+        for (off_t b = 0; rc == NO_ERROR && can_punch && b <= len; b += blk)
+        {
+            bool empty = (len - b >= blk) && memcmp(chunk + b, zeros, blk) == 0;
+            if (empty && run_start == -1)
+            {
+                run_start = b;
+            }
+            if (!empty && run_start != -1)
+            {
+                int punched = db_punch(fd, position + run_start, b - run_start);
+                if (punched != NO_ERROR)
+                {
+                    can_punch = false;
+                    rc = (punched == ERR_DB_OP) ? NO_ERROR : ERR_DB_FILE;
+                }
+                run_start = -1;
+            }
+        }
+
+        db_lock(fd, F_UNLCK, position, span);
+        if (len < DB_SCAN_BLOCK)
+        {
+            break; // EOF
+        }
+        position += DB_SCAN_BLOCK;
+    }
+
+    free(chunk);
+    free(zeros);
+    return rc;
+}
+
+/*
+ *  punch_empty_slots
+ *      fd:     linux file descriptor of a positional database
+ *
+ *  Online compaction, see punch_range().  The segments of a segmented
+ *  database are separate files, they are compacted in parallel.
+ *
+ *  returns:  NO_ERROR       on success, or if the file system can not punch
+ *                           holes
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int punch_empty_slots(int fd)
+{
+    if (seg_active(fd))
+    {
+        return seg_parallel(punch_range, &fd);
+    }
+
+    return punch_range(0, 0, DB_SCAN_TO_EOF, &fd);
+}
+
+/*
+ *  collect_records
+ *      fd:  linux file descriptor
+ *      *n:  set to the number of records
+ *
+ *  Collects the records of the database that have a slot, sorted by id.
+ *  Records without a valid id can not be placed and are dropped.
+ *
+ *  returns:  malloc()ed array of the records, NULL on error
+ *
+ *  console:  M_ERR_DB_READ  error reading the database file
+ */
+static student_t *collect_records(int fd, size_t *n)
+{
+    db_scan_t scan;
+    const student_t *student;
+    int rc = -1;
+
+    size_t cap = 1024;
+    student_t *recs = malloc(cap * sizeof(student_t));
+    if (recs == NULL || db_scan_open(&scan, fd) != NO_ERROR)
+    {
+        free(recs);
+        printf(M_ERR_DB_READ);
+        return NULL;
+    }
+
+    *n = 0;
+    while ((rc = db_scan_next(&scan, &student)) > 0)
+    {
+        // Copy only records that have a slot
+        if (student->id < MIN_STD_ID || student->id > db_max_id(fd))
+        {
+            continue;
+        }
+        if (*n == cap)
+        {
+            student_t *grown = realloc(recs, 2 * cap * sizeof(student_t));
+            if (grown == NULL)
+            {
+                rc = -1;
+                break;
+            }
+            recs = grown;
+            cap *= 2;
+        }
+        recs[(*n)++] = *student;
+    }
+    db_scan_close(&scan);
+
+    if (rc < 0)
+    {
+        free(recs);
+        printf(M_ERR_DB_READ);
+        return NULL;
+    }
+
+    qsort(recs, *n, sizeof(student_t), compare_student_id);
+    return recs;
+}
+
+/*
+ *  write_positional
+ *      out_fd:  linux file descriptor of an empty file
+ *      recs:    records sorted by id
+ *      n:       number of records
+ *
+ *  Writes the records at their slots with one write per run of consecutive
+ *  ids, all handed to db_io_many() together, and makes them durable.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    file I/O issue
+ */
+static int write_positional(int out_fd, const student_t *recs, size_t n)
+{
+    size_t run_max = DB_SCAN_BLOCK / sizeof(student_t);
+    size_t nios = 0;
+
+    db_io_t *ios = malloc((n + 1) * sizeof(db_io_t));
+    if (ios == NULL)
+    {
+        return ERR_DB_FILE;
+    }
+    for (size_t i = 0; i < n;)
+    {
+        size_t run = 1;
+        while (i + run < n && run < run_max && recs[i + run].id == recs[i].id + (int)run)
+        {
+            run++;
+        }
+        ios[nios].buf = (void *)&recs[i];
+        ios[nios].len = run * sizeof(student_t);
+        ios[nios].offset = (off_t)recs[i].id * sizeof(student_t);
+        nios++;
+        i += run;
+    }
+
+    int rc = db_io_many(out_fd, ios, nios, true);
+    free(ios);
+    if (rc != NO_ERROR)
+    {
+        return ERR_DB_FILE;
+    }
+
+    return (fdatasync(out_fd) == -1) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  rewrite_db
+ *      fd:     linux file descriptor of a packed database, opened with
+ *              DB_ACCESS_EXCLUSIVE
+ *
+ *  Packed legacy files have no slot per id, so they are rewritten as a
+ *  positional file.  The valid records are collected, sorted by id and
+ *  written to TMP_DB_FILE with one write per run of consecutive ids, the
+ *  temporary file is then renamed over the database.  Records without a
+ *  valid id can not be placed and are dropped.  join_db() rewrites a
+ *  segmented database into one file the same way, as long as its ids fit.
+ *
+ *  returns:  <number>       the fd of the rewritten database file
+ *            ERR_DB_FILE    database file I/O issue
+ *            ERR_DB_OP      students past MAX_STD_ID do not fit one file
+ *
+ *  console:  M_ERR_JOIN_IDS   students past MAX_STD_ID, nothing changed
+ *            see compress_db() for the other errors
+ */
+static int rewrite_db(int fd)
+{
+    // The rewritten file has a different layout, no logged record may be
+    // replayed onto it
+    if (wal_checkpoint(fd) != NO_ERROR) {
+        close_db(fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    // Open temporary file
+    int tmp_fd = open(TMP_DB_FILE, O_RDWR | O_CREAT | O_TRUNC, 
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (tmp_fd == -1) {
+        close_db(fd);
+        printf(M_ERR_DB_OPEN);
+        return ERR_DB_FILE;
+    }
+
+    // Collect the valid records and write them at their slots
+    size_t n;
+    student_t *recs = collect_records(fd, &n);
+    if (recs == NULL) {
+        close_db(fd);
+        close(tmp_fd);
+        return ERR_DB_FILE;
+    }
+    if (n > 0 && recs[n - 1].id > MAX_STD_ID) {
+        free(recs);
+        close_db(fd);
+        close(tmp_fd);
+        unlink(TMP_DB_FILE);
+        printf(M_ERR_JOIN_IDS, MAX_STD_ID);
+        return ERR_DB_OP;
+    }
+    bool write_failed = (write_positional(tmp_fd, recs, n) != NO_ERROR);
+    free(recs);
+
+    if (write_failed) {
+        close_db(fd);
+        close(tmp_fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    // Replace original database with compressed version.  The old file is
+    // still open and locked, processes waiting for it move on to the new
+    // one, see db_open_locked().  The new one is locked the same way before
+    // its name is visible, so nobody uses it while the segments of a joined
+    // database are still there.
+    if (db_lock(tmp_fd, F_WRLCK, DB_LOCK_SESSION, 1) != NO_ERROR ||
+        rename(TMP_DB_FILE, DB_FILE) == -1) {
+        close_db(fd);
+        close(tmp_fd);
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    if (seg_active(fd) && seg_remove(DB_FILE) != NO_ERROR) {
+        close_db(fd);
+        close(tmp_fd);
+        printf(M_ERR_DB_CREATE);
+        return ERR_DB_FILE;
+    }
+    close(tmp_fd);
+    close_db(fd);
+
+    // Reopen the rewritten database, it has the same students but a new
+    // size, so the indexes are refreshed from it
+    fd = open_db(DB_FILE, false);
+    if (fd < 0) {
+        return ERR_DB_FILE;
+    }
+    idx_rebuild(fd);
+
+    return fd;
+}
+
+
+/*
+ *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
+ *
+ *  compress_db
+ *      fd:     linux file descriptor
+ *
+ *  This assignment takes advantage of the way Linux handles sparse files
+ *  on disk. Thus if there is a large hole between student records, Linux
+ *  will not use any physical storage.  However, when a database record is
+ *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
+ *  db.h - record.  del_student() gives a block back as soon as all of its
+ *  slots are empty, this sweeps up the blocks it could not, for example
+ *  ones emptied by older versions of the program.
+ *
+ *  Linux can deallocate the blocks in the middle of a file that hold only
+ *  deleted records with fallocate(FALLOC_FL_PUNCH_HOLE).  A positional
+ *  database is compressed that way in place, see punch_empty_slots(), while
+ *  other processes keep using it.  A packed legacy database is rewritten as
+ *  a positional file, see rewrite_db(), which needs the database to itself,
+ *  so the fd is closed and reopened with DB_ACCESS_EXCLUSIVE first.  See the
+ *  constants in db.h for required file names:
+ *
+ *         #define DB_FILE     "student.db"        //name of database file
+ *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
+ *
+ *  To ensure the caller can work with the compressed file after a rewrite,
+ *  the fd of the database is returned from this function.
+ *
+ *  returns:  <number>       returns the fd of the compressed database file
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *
+ *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
+ *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
+ *                             this error should also be returned after you
+ *                             compressed the database file and if you are unable
+ *                             to open it to pass the fd back to the caller
+ *            M_ERR_DB_CREATE  error creating the db file. For instance the
+ *                             inability to copy the temporary file back as
+ *                             the primary database file.
+ *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
+ *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
+ *
+ */
+int compress_db(int fd)
+{
+    int layout = db_layout(fd);
+    if (layout < 0) {
+        close_db(fd);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (layout == DB_LAYOUT_POSITIONAL) {
+        if (punch_empty_slots(fd) != NO_ERROR) {
+            close_db(fd);
+            printf(M_ERR_DB_WRITE);
+            return ERR_DB_FILE;
+        }
+        printf(M_DB_COMPRESSED_OK);
+        return fd;
+    }
+
+    // Replacing the file needs the database to itself, a process that
+    // rewrote it while we waited leaves a positional file behind
+    if (db_access != DB_ACCESS_EXCLUSIVE) {
+        close_db(fd);
+        set_db_access(DB_ACCESS_EXCLUSIVE);
+        fd = open_db(DB_FILE, false);
+        if (fd < 0) {
+            return ERR_DB_FILE;
+        }
+        return compress_db(fd);
+    }
+
+    fd = rewrite_db(fd);
+    if (fd >= 0) {
+        printf(M_DB_COMPRESSED_OK);
+    }
+    return fd;
+}
+
+/*
+ *  split_db
+ *      fd:     linux file descriptor, opened with DB_ACCESS_EXCLUSIVE
+ *
+ *  Moves the records of the database into segment files of SEG_IDS ids
+ *  each, see sdb_segment.c.  The segments and their manifest are written
+ *  next to the database and renamed into place before the database file is
+ *  emptied, from then on it only carries the locks.  Segments can be
+ *  compressed and backed up in parallel, and each is a small file.
+ *
+ *  returns:  <number>       the fd of the segmented database
+ *            ERR_DB_FILE    database or segment file I/O issue
+ *
+ *  console:  M_DB_SPLIT       on success
+ *            M_DB_IS_SPLIT    the database already is segmented
+ *            M_ERR_DB_READ    error reading the database file
+ *            M_ERR_DB_WRITE   error writing the segments
+ */
+int split_db(int fd)
+{
+    if (seg_active(fd))
+    {
+        printf(M_DB_IS_SPLIT);
+        return fd;
+    }
+
+    // The records move to other files, no logged record may be replayed
+    // onto the emptied database file
+    size_t n;
+    student_t *recs = collect_records(fd, &n);
+    if (recs == NULL)
+    {
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+    int nsegs = (wal_checkpoint(fd) == NO_ERROR) ? seg_create(DB_FILE, recs, n) : ERR_DB_FILE;
+    free(recs);
+    if (nsegs < 0 || ftruncate(fd, 0) == -1)
+    {
+        close_db(fd);
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    close_db(fd);
+
+    // Same students in a new place, the indexes are refreshed from them
+    fd = open_db(DB_FILE, false);
+    if (fd < 0)
+    {
+        return ERR_DB_FILE;
+    }
+    idx_rebuild(fd);
+
+    printf(M_DB_SPLIT, nsegs, SEG_IDS);
+    return fd;
+}
+
+/*
+ *  join_db
+ *      fd:     linux file descriptor, opened with DB_ACCESS_EXCLUSIVE
+ *
+ *  Moves the records of a segmented database back into the database file,
+ *  the way rewrite_db() rewrites a packed one, and removes the segments.
+ *
+ *  returns:  <number>       the fd of the joined database
+ *            ERR_DB_FILE    database or segment file I/O issue
+ *            ERR_DB_OP      students past MAX_STD_ID, the database is closed
+ *
+ *  console:  M_DB_JOINED      on success
+ *            M_DB_NOT_SPLIT   the database is not segmented
+ *            M_ERR_JOIN_IDS   it holds students past MAX_STD_ID
+ *            see compress_db() for the other errors
+ */
+int join_db(int fd)
+{
+    if (!seg_active(fd))
+    {
+        printf(M_DB_NOT_SPLIT);
+        return fd;
+    }
+
+    fd = rewrite_db(fd);
+    if (fd >= 0)
+    {
+        printf(M_DB_JOINED);
+    }
+    return fd;
+}
+
+/*
+ *  backup_db
+ *      fd:   linux file descriptor, opened with DB_ACCESS_READ so no writer
+ *            changes the database meanwhile
+ *      dir:  directory the backup is written to, created if needed
+ *
+ *  Copies the database file into dir under its own name, and for a
+ *  segmented database the manifest and the segments, the segments in
+ *  parallel.  Holes stay holes.  The indexes are not copied, -r rebuilds
+ *  them after the files were copied back.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or backup file I/O issue
+ *
+ *  console:  M_DB_BACKUP    on success
+ *            M_ERR_BACKUP   error writing the backup
+ */
+int backup_db(int fd, char *dir)
+{
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, DB_FILE);
+    if ((mkdir(dir, S_IRWXU | S_IRGRP | S_IXGRP) == -1 && errno != EEXIST) ||
+        seg_copy_file(fd, path) != NO_ERROR ||
+        (seg_active(fd) && seg_backup(dir) != NO_ERROR))
+    {
+        printf(M_ERR_BACKUP, dir);
+        return ERR_DB_FILE;
+    }
+
+    printf(M_DB_BACKUP, dir);
+    return NO_ERROR;
+}
+
+/*
+ *  parse_import_line
+ *      line:  one line of the import file, modified in place
+ *      *s:    the parsed student
+ *
+ *  Lines hold id,first_name,last_name,gpa separated by commas or tabs, the
+ *  gpa is the same 3 digit integer the -a option takes.
+ *
+ *  returns:  NO_ERROR       line parsed into *s
+ *            ERR_DB_OP      line is malformed
+ *            EXIT_FAIL_ARGS id or gpa failed validate_range()
+ */
+static int parse_import_line(char *line, student_t *s)
+{
+    const char *delims = ",\t\r\n";
+    char *save;
+    char *fields[4];
+    char *end;
+
+    fields[0] = strtok_r(line, delims, &save);
+    for (int i = 1; i < 4; i++)
+    {
+        fields[i] = strtok_r(NULL, delims, &save);
+    }
+    if (fields[3] == NULL || strtok_r(NULL, delims, &save) != NULL)
+    {
+        return ERR_DB_OP;
+    }
+
+    long id = strtol(fields[0], &end, 10);
+    if (*end != '\0')
+    {
+        return ERR_DB_OP;
+    }
+    long gpa = strtol(fields[3], &end, 10);
+    if (*end != '\0')
+    {
+        return ERR_DB_OP;
+    }
+
+    if (validate_range(id, gpa) != NO_ERROR)
+    {
+        return EXIT_FAIL_ARGS;
+    }
+
+    init_student(s, id, fields[1], fields[2], gpa);
+    return NO_ERROR;
+}
+
+/*
+ *  read_import_file
+ *      in:      the open import file
+ *      taken:   a bool per id of the db, set for ids already in it
+ *      **out:   set to a malloc()ed array of the students to import
+ *      *count:  set to the number of students in *out
+ *
+ *  Parses and validates the whole import file before the database is
+ *  touched.  Duplicates are checked against taken, which is updated for
+ *  every accepted student.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    the file could not be read or memory ran out
+ *
+ *  console:  M_ERR_IMPORT_* for each skipped line
+ */
+static int read_import_file(FILE *in, id_table_t *taken, student_t **out, size_t *count)
+{
+    size_t cap = 1024;
+    size_t n = 0;
+    student_t *batch = malloc(cap * sizeof(student_t));
+    char line[256];
+    int line_no = 0;
+
+    if (batch == NULL)
+    {
+        return ERR_DB_FILE;
+    }
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        line_no++;
+        if (strspn(line, " \t\r\n") == strlen(line))
+        {
+            continue; // blank line
+        }
+
+        student_t s;
+        int rc = parse_import_line(line, &s);
+        if (rc == ERR_DB_OP)
+        {
+            printf(M_ERR_IMPORT_LINE, line_no);
+            continue;
+        }
+        if (rc == EXIT_FAIL_ARGS)
+        {
+            printf(M_ERR_IMPORT_RNG, line_no);
+            continue;
+        }
+        bool *seen = idtab_put(taken, s.id);
+        if (seen == NULL)
+        {
+            free(batch);
+            return ERR_DB_FILE;
+        }
+        if (*seen)
+        {
+            printf(M_ERR_IMPORT_DUP, line_no, s.id);
+            continue;
+        }
+        *seen = true;
+
+        if (n == cap)
+        {
+            student_t *grown = realloc(batch, 2 * cap * sizeof(student_t));
+            if (grown == NULL)
+            {
+                free(batch);
+                return ERR_DB_FILE;
+            }
+            batch = grown;
+            cap *= 2;
+        }
+        batch[n++] = s;
+    }
+
+    if (ferror(in))
+    {
+        free(batch);
+        return ERR_DB_FILE;
+    }
+
+    *out = batch;
+    *count = n;
+    return NO_ERROR;
+}
+
+/*
+ *  write_import_batch
+ *      fd:     linux file descriptor
+ *      batch:  students to write, reordered by this function
+ *      n:      number of students in batch
+ *
+ *  The records are sorted by id, and each run of consecutive ids is written
+ *  with one positional write of up to DB_SCAN_BLOCK bytes.  The file is grown
+ *  once up front and synced once at the end.  Packed legacy databases get
+ *  the records appended instead.  The batch bypasses the write-ahead log, so
+ *  the log is checkpointed first.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_ERR_DB_READ  error reading the database file
+ *            M_ERR_DB_WRITE error writing the database file
+ */
+static int write_import_batch(int fd, student_t *batch, size_t n)
+{
+    if (n == 0)
+    {
+        return NO_ERROR;
+    }
+
+    int layout = db_layout(fd);
+    off_t size = db_size(fd);
+    if (layout < 0 || size == -1)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (wal_checkpoint(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    // Grow the file once to hold every new record
+    off_t append_at = size - size % sizeof(student_t);
+    off_t needed = append_at + n * sizeof(student_t);
+    if (layout == DB_LAYOUT_POSITIONAL)
+    {
+        qsort(batch, n, sizeof(student_t), compare_student_id);
+        needed = (off_t)(batch[n - 1].id + 1) * sizeof(student_t);
+    }
+    if (needed > size && db_resize(fd, needed) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    // Write runs of consecutive ids with a single write each, all runs are
+    // handed to db_io_many() together
+    db_io_t *ios = malloc(n * sizeof(db_io_t));
+    if (ios == NULL)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    size_t nios = 0;
+    size_t run_max = DB_SCAN_BLOCK / sizeof(student_t);
+    for (size_t i = 0; i < n;)
+    {
+        size_t run = 1;
+        off_t position = append_at + i * sizeof(student_t);
+        if (layout == DB_LAYOUT_POSITIONAL)
+        {
+            position = (off_t)batch[i].id * sizeof(student_t);
+            while (i + run < n && run < run_max &&
+                   batch[i + run].id == batch[i].id + (int)run)
+            {
+                run++;
+            }
+        }
+        else
+        {
+            run = (n - i < run_max) ? n - i : run_max;
+        }
+
+        ios[nios].buf = &batch[i];
+        ios[nios].len = run * sizeof(student_t);
+        ios[nios].offset = position;
+        nios++;
+        i += run;
+    }
+
+    idx_begin();
+    int rc = db_io_many(fd, ios, nios, true);
+    free(ios);
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+    idx_add(batch, n);
+
+    if (sync_db(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  import_students
+ *      fd:          linux file descriptor
+ *      importFile:  name of a CSV or TSV file, one student per line
+ *
+ *  Bulk loads students without running add_student() for each one.  The ids
+ *  already in the database are collected with a single scan, so duplicate
+ *  checks happen in memory, then write_import_batch() stores the students.
+ *  Lines that are malformed, out of range or duplicates are reported and
+ *  skipped.
+ *
+ *  returns:  <number>       number of students imported
+ *            ERR_DB_FILE    database or import file I/O issue
+ *
+ *  console:  M_DB_IMPORTED      on success
+ *            M_ERR_IMPORT_*     for each skipped line, or if the import
+ *                               file cannot be read
+ *            M_ERR_DB_READ      error reading the database file
+ *            M_ERR_DB_WRITE     error writing the database file
+ */
+int import_students(int fd, char *importFile)
+{
+    db_scan_t scan;
+    const student_t *student;
+    student_t *batch = NULL;
+    size_t n = 0;
+    int rc;
+
+    FILE *in = fopen(importFile, "r");
+    if (in == NULL)
+    {
+        printf(M_ERR_IMPORT_OPEN, importFile);
+        return ERR_DB_FILE;
+    }
+
+    // A flag per id of the db, set for students already in it
+    id_table_t taken;
+    if (idtab_init(&taken, db_max_id(fd), sizeof(bool)) != NO_ERROR ||
+        db_scan_open(&scan, fd) != NO_ERROR)
+    {
+        idtab_free(&taken);
+        fclose(in);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+    while ((rc = db_scan_next(&scan, &student)) > 0)
+    {
+        if (student->id >= MIN_STD_ID && student->id <= taken.max_id)
+        {
+            bool *seen = idtab_put(&taken, student->id);
+            if (seen == NULL)
+            {
+                rc = -1;
+                break;
+            }
+            *seen = true;
+        }
+    }
+    db_scan_close(&scan);
+    if (rc < 0)
+    {
+        idtab_free(&taken);
+        fclose(in);
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    rc = read_import_file(in, &taken, &batch, &n);
+    idtab_free(&taken);
+    fclose(in);
+    if (rc != NO_ERROR)
+    {
+        printf(M_ERR_IMPORT_OPEN, importFile);
+        return ERR_DB_FILE;
+    }
+
+    rc = write_import_batch(fd, batch, n);
+    free(batch);
+    if (rc != NO_ERROR)
+    {
+        return rc;
+    }
+
+    printf(M_DB_IMPORTED, (int)n);
+    return n;
+}
+
+/*
+ *  parse_batch_id
+ *      tok:  token holding the id, NULL if the line ended early
+ *      *id:  set to the id
+ *
+ *  returns:  true if tok is a whole number
+ */
+static bool parse_batch_id(const char *tok, int *id)
+{
+    char *end;
+
+    if (tok == NULL)
+    {
+        return false;
+    }
+    long val = strtol(tok, &end, 10);
+    if (end == tok || *end != '\0')
+    {
+        return false;
+    }
+    *id = (int)val;
+    return true;
+}
+
+/*
+ *  run_batch_finds
+ *      fd:   linux file descriptor
+ *      ids:  ids of a run of f commands, in the order of their lines
+ *      n:    number of ids
+ *
+ *  Runs consecutive f commands of run_batch() together.  In a positional
+ *  database the slots of the whole run are read with one db_io_many(), so
+ *  with the DB_ENGINE_URING engine the lookups are in flight at the same
+ *  time.  The run holds the index lock, no other process writes records
+ *  meanwhile, so the slots are read without the slot locks of get_student().
+ *  Packed legacy files look up one id after the other.
+ *
+ *  returns:  EXIT_OK        every lookup completed, found or not
+ *            EXIT_FAIL_DB   a lookup failed or a student was not found
+ *
+ *  console:  what the f option prints for each id
+ */
+static int run_batch_finds(int fd, const int *ids, size_t n)
+{
+    int exit_code = EXIT_OK;
+    int rc;
+
+    student_t *found = malloc(n * sizeof(student_t));
+    db_io_t *ios = malloc(n * sizeof(db_io_t));
+    if (found == NULL || ios == NULL || db_index_begin(fd, F_RDLCK) != NO_ERROR)
+    {
+        free(found);
+        free(ios);
+        printf(M_ERR_DB_READ);
+        return EXIT_FAIL_DB;
+    }
+
+    int layout = db_layout(fd);
+    if (layout == DB_LAYOUT_POSITIONAL)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            // Id 0 marks a deleted record and has no slot to read
+            bool slot = (ids[i] >= MIN_STD_ID);
+            ios[i].buf = &found[i];
+            ios[i].len = slot ? sizeof(student_t) : 0;
+            ios[i].offset = slot ? (off_t)ids[i] * sizeof(student_t) : 0;
+        }
+        db_io_many(fd, ios, n, false);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (layout < 0)
+        {
+            rc = ERR_DB_FILE;
+        }
+        else if (layout == DB_LAYOUT_PACKED)
+        {
+            rc = get_student(fd, ids[i], &found[i]);
+        }
+        else if (ids[i] < MIN_STD_ID)
+        {
+            rc = SRCH_NOT_FOUND;
+        }
+        else if (ios[i].res == -1)
+        {
+            rc = ERR_DB_FILE;
+        }
+        else if (ios[i].res != sizeof(student_t) || found[i].id != ids[i])
+        {
+            rc = SRCH_NOT_FOUND; // past EOF, or the slot is empty
+        }
+        else
+        {
+            rc = NO_ERROR;
+        }
+
+        if (rc == NO_ERROR)
+        {
+            print_student(&found[i]);
+        }
+        else if (rc == SRCH_NOT_FOUND)
+        {
+            printf(M_STD_NOT_FND_MSG, ids[i]);
+        }
+        else
+        {
+            printf(M_ERR_DB_READ);
+        }
+        if (rc < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+        }
+    }
+    db_index_end(fd);
+
+    free(found);
+    free(ios);
+    return exit_code;
+}
+
+/*
+ *  parse_batch_write
+ *      op:     option of the line, without the dash
+ *      args:   arguments of the line
+ *      nargs:  number of arguments
+ *      *w:     filled in with the add or delete
+ *
+ *  returns:  true if the line is a well formed a or d command, for an add
+ *            with an id and GPA in range
+ */
+static bool parse_batch_write(const char *op, char **args, int nargs, student_write_t *w)
+{
+    int id;
+    int gpa;
+
+    if (strcmp(op, "a") == 0 && nargs == 4 && parse_batch_id(args[0], &id) &&
+        parse_batch_id(args[3], &gpa) && validate_range(id, gpa) == NO_ERROR)
+    {
+        w->op = 'a';
+        init_student(&w->image, id, args[1], args[2], gpa);
+        return true;
+    }
+    if (strcmp(op, "d") == 0 && nargs == 1 && parse_batch_id(args[0], &id))
+    {
+        w->op = 'd';
+        w->image.id = id;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ *  run_batch_writes
+ *      fd:      linux file descriptor
+ *      writes:  a run of a and d commands for different ids, in the order
+ *               of their lines
+ *      n:       number of writes
+ *
+ *  Runs consecutive a and d commands of run_batch() with a single log
+ *  commit.  Every slot of the run is locked and its records are queued
+ *  with log_student_write(), then one wal_commit() makes all of them
+ *  durable, and only then are they written and reported in order, under
+ *  one begin_student_writes().  The slots stay locked until the whole run
+ *  is written.  Packed legacy files append to the end of the file, their
+ *  writes commit one by one.
+ *
+ *  returns:  EXIT_OK        every write succeeded
+ *            EXIT_FAIL_DB   a write failed, or its student did or did not
+ *                           exist
+ *
+ *  console:  what the a and d options print for each write
+ */
+static int run_batch_writes(int fd, student_write_t *writes, size_t n)
+{
+    int exit_code = EXIT_OK;
+    size_t run = (db_layout(fd) == DB_LAYOUT_PACKED) ? 1 : n;
+
+    for (size_t start = 0; start < n; start += run)
+    {
+        size_t end = (start + run < n) ? start + run : n;
+        for (size_t i = start; i < end; i++)
+        {
+            if (db_lock_record(fd, writes[i].image.id, F_WRLCK) == NO_ERROR)
+            {
+                log_student_write(fd, &writes[i]);
+            }
+            else
+            {
+                writes[i].rc = NO_ERROR;
+                writes[i].logged = false; // reported as a failed write
+            }
+        }
+
+        bool committed = (wal_commit() == NO_ERROR);
+        bool locked = (begin_student_writes(fd) == NO_ERROR);
+        for (size_t i = start; i < end; i++)
+        {
+            if (apply_student_write(fd, &writes[i], committed && locked) < 0)
+            {
+                exit_code = EXIT_FAIL_DB;
+            }
+        }
+        if (locked)
+        {
+            end_student_writes(fd);
+        }
+        for (size_t i = start; i < end; i++)
+        {
+            finish_student_write(fd, &writes[i]);
+        }
+    }
+
+    return exit_code;
+}
+
+// Command stream of run_batch(), read with read() instead of stdio so the
+// batch knows when the next line is not there yet
+typedef struct batch_input {
+    int fd;
+    char buf[BATCH_IN_BUF];
+    size_t pos;             // next unread byte of buf
+    size_t len;             // bytes in buf
+    bool eof;
+    bool error;
+} batch_input_t;
+
+/*
+ *  batch_input_ready
+ *      *in:  command stream
+ *
+ *  returns:  true if the next line can be read without waiting, it is
+ *            buffered or there is input, EOF or an error on the fd
+ */
+static bool batch_input_ready(batch_input_t *in)
+{
+    struct pollfd pfd = { in->fd, POLLIN, 0 };
+
+    if (in->eof || memchr(in->buf + in->pos, '\n', in->len - in->pos) != NULL)
+    {
+        return true;
+    }
+
+    return poll(&pfd, 1, 0) != 0;
+}
+
+/*
+ *  batch_read_line
+ *      *in:   command stream
+ *      line:  buffer for the line, NUL terminated
+ *      size:  size of line
+ *
+ *  Same as fgets(), a line longer than size - 1 bytes is returned in
+ *  pieces.
+ *
+ *  returns:  true if a line was read, false at EOF or on error
+ */
+static bool batch_read_line(batch_input_t *in, char *line, size_t size)
+{
+    for (;;)
+    {
+        size_t avail = in->len - in->pos;
+        char *nl = memchr(in->buf + in->pos, '\n', avail);
+        size_t take = (nl != NULL) ? (size_t)(nl - (in->buf + in->pos)) + 1 : avail;
+        if (take > size - 1)
+        {
+            take = size - 1;
+        }
+        if (nl != NULL || take == size - 1 || (in->eof && take > 0))
+        {
+            memcpy(line, in->buf + in->pos, take);
+            line[take] = '\0';
+            in->pos += take;
+            return true;
+        }
+        if (in->eof)
+        {
+            return false;
+        }
+
+        // Keep the start of the line and read behind it
+        memmove(in->buf, in->buf + in->pos, avail);
+        in->pos = 0;
+        in->len = avail;
+        ssize_t bytes_read = read(in->fd, in->buf + in->len, sizeof(in->buf) - in->len);
+        if (bytes_read == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_read <= 0)
+        {
+            in->eof = true;
+            in->error = (bytes_read == -1);
+            continue;
+        }
+        in->len += bytes_read;
+    }
+}
+
+/*
+ *  run_batch_runs
+ *      fd:        linux file descriptor
+ *      finds:     pending run of f commands
+ *      *nfinds:   number of finds, reset to 0
+ *      writes:    pending run of a and d commands
+ *      *nwrites:  number of writes, reset to 0
+ *
+ *  Runs whichever run run_batch() has collected, at most one of them has
+ *  commands.  A run of writes holds DB_LOCK_WRITE alone and is one write
+ *  for snapshot readers, both end with the run.  Between runs, and while
+ *  the batch waits for input, other writers go on next to the batch.
+ *
+ *  returns:  EXIT_OK        every command succeeded
+ *            EXIT_FAIL_DB   a command failed
+ *
+ *  console:  the messages of the commands
+ */
+static int run_batch_runs(int fd, const int *finds, size_t *nfinds,
+                          student_write_t *writes, size_t *nwrites)
+{
+    int exit_code = EXIT_OK;
+
+    if (*nfinds > 0 && run_batch_finds(fd, finds, *nfinds) != EXIT_OK)
+    {
+        exit_code = EXIT_FAIL_DB;
+    }
+    if (*nwrites > 0)
+    {
+        if (db_lock(fd, F_WRLCK, DB_LOCK_WRITE, 1) != NO_ERROR)
+        {
+            printf(M_ERR_DB_WRITE);
+            exit_code = EXIT_FAIL_DB;
+        }
+        else if (snap_begin(fd) != NO_ERROR)
+        {
+            printf(M_ERR_DB_WRITE);
+            exit_code = EXIT_FAIL_DB;
+            db_lock(fd, F_UNLCK, DB_LOCK_WRITE, 1);
+        }
+        else
+        {
+            if (run_batch_writes(fd, writes, *nwrites) != EXIT_OK)
+            {
+                exit_code = EXIT_FAIL_DB;
+            }
+            snap_end();
+            db_lock(fd, F_UNLCK, DB_LOCK_WRITE, 1);
+        }
+    }
+    *nfinds = 0;
+    *nwrites = 0;
+
+    return exit_code;
+}
+
+/*
+ *  run_batch
+ *      fd:     linux file descriptor
+ *      in_fd:  the command stream, stdin for the -b option
+ *
+ *  Script mode, runs one command per line against the already open
+ *  database.  A command is an option and its arguments as they are given
+ *  on the command line, the leading dash is optional:
+ *
+ *      a id first_name last_name gpa
+ *      c
+ *      d id
+ *      f id
+ *
+ *  Each command prints exactly what its option prints.  main() gives
+ *  stdout a BATCH_OUT_BUF buffer, so the output of many commands leaves in
+ *  a few large writes.  Up to BATCH_FIND_RUN consecutive f commands are
+ *  collected and looked up together, see run_batch_finds().  Likewise up
+ *  to BATCH_WRITE_RUN consecutive a and d commands for different ids share
+ *  one commit of the write-ahead log, see run_batch_writes().  A run only
+ *  collects the lines that already arrived, before the batch waits for
+ *  more input the run is done and the output flushed.  While a run of
+ *  writes goes the batch is the only writer, and snapshot readers see the
+ *  run as one write, see snap_begin().
+ *
+ *  returns:  EXIT_OK        every command succeeded
+ *            <exit code>    exit code of the last command that failed,
+ *                           EXIT_FAIL_ARGS for malformed lines
+ *
+ *  console:  the messages of the commands
+ *            M_ERR_BATCH_LINE  for each malformed line
+ *            M_ERR_DB_READ     error reading the command stream
+ */
+int run_batch(int fd, int in_fd)
+{
+    const char *delims = " \t\r\n";
+    char line[256];
+    char *save;
+    int line_no = 0;
+    int exit_code = EXIT_OK;
+    int finds[BATCH_FIND_RUN];
+    size_t nfinds = 0;
+    size_t nwrites = 0;
+    student_write_t write;
+    int id;
+    int gpa;
+    int rc;
+
+    batch_input_t *in = malloc(sizeof(batch_input_t));
+    student_write_t *writes = malloc(BATCH_WRITE_RUN * sizeof(student_write_t));
+    if (in == NULL || writes == NULL)
+    {
+        free(in);
+        free(writes);
+        printf(M_ERR_DB_WRITE);
+        return EXIT_FAIL_DB;
+    }
+    memset(in, 0, sizeof(batch_input_t));
+    in->fd = in_fd;
+
+    for (;;)
+    {
+        // Never wait for input with commands or their output held back, or
+        // with the log of the writes left for the next open to read
+        if (!batch_input_ready(in))
+        {
+            if (run_batch_runs(fd, finds, &nfinds, writes, &nwrites) != EXIT_OK)
+            {
+                exit_code = EXIT_FAIL_DB;
+            }
+            if (wal_settle(fd, false) != NO_ERROR)
+            {
+                printf(M_ERR_DB_WRITE);
+                exit_code = EXIT_FAIL_DB;
+            }
+            fflush(stdout);
+        }
+
+        bool more = batch_read_line(in, line, sizeof(line));
+        char *op = more ? strtok_r(line, delims, &save) : NULL;
+        if (more)
+        {
+            line_no++;
+        }
+        if (op != NULL && *op == '-')
+        {
+            op++;
+        }
+
+        char *args[4] = { NULL };
+        int nargs = 0;
+        char *tok;
+        while (op != NULL && (tok = strtok_r(NULL, delims, &save)) != NULL)
+        {
+            if (nargs == 4)
+            {
+                nargs++; // too many, rejected below
+                break;
+            }
+            args[nargs++] = tok;
+        }
+        if (more && op == NULL)
+        {
+            continue; // blank line
+        }
+
+        // Collect a run of f commands or a run of a and d commands, anything
+        // else ends the run.  A write for an id that is already in the run
+        // starts a new one, so it sees the first write.
+        if (op != NULL && parse_batch_write(op, args, nargs, &write))
+        {
+            bool same_id = false;
+            for (size_t i = 0; i < nwrites && !same_id; i++)
+            {
+                same_id = (writes[i].image.id == write.image.id);
+            }
+            if ((nfinds > 0 || nwrites == BATCH_WRITE_RUN || same_id) &&
+                run_batch_runs(fd, finds, &nfinds, writes, &nwrites) != EXIT_OK)
+            {
+                exit_code = EXIT_FAIL_DB;
+            }
+            writes[nwrites++] = write;
+            continue;
+        }
+        if (op != NULL && strcmp(op, "f") == 0 && nargs == 1 && parse_batch_id(args[0], &id))
+        {
+            if ((nwrites > 0 || nfinds == BATCH_FIND_RUN) &&
+                run_batch_runs(fd, finds, &nfinds, writes, &nwrites) != EXIT_OK)
+            {
+                exit_code = EXIT_FAIL_DB;
+            }
+            finds[nfinds++] = id;
+            continue;
+        }
+        if (run_batch_runs(fd, finds, &nfinds, writes, &nwrites) != EXIT_OK)
+        {
+            exit_code = EXIT_FAIL_DB;
+        }
+        if (!more)
+        {
+            break;
+        }
+
+        rc = NO_ERROR;
+        if (strcmp(op, "a") == 0 && nargs == 4 && parse_batch_id(args[0], &id) &&
+            parse_batch_id(args[3], &gpa))
+        {
+            // Adds in range are queued above
+            printf(M_ERR_STD_RNG);
+            exit_code = EXIT_FAIL_ARGS;
+            continue;
+        }
+        else if (strcmp(op, "c") == 0 && nargs == 0)
+        {
+            rc = db_index_begin(fd, F_RDLCK);
+            if (rc == NO_ERROR)
+            {
+                rc = count_db_records(fd);
+                db_index_end(fd);
+            }
+            else
+            {
+                printf(M_ERR_DB_READ);
+            }
+        }
+        else
+        {
+            printf(M_ERR_BATCH_LINE, line_no);
+            exit_code = EXIT_FAIL_ARGS;
+            continue;
+        }
+
+        if (rc < 0)
+        {
+            exit_code = EXIT_FAIL_DB;
+        }
+    }
+    free(writes);
+
+    bool failed = in->error;
+    free(in);
+    if (failed)
+    {
+        printf(M_ERR_DB_READ);
+        return EXIT_FAIL_DB;
+    }
+    return exit_code;
+}
+
+/*
+ *  scan_matches
+ *      fd:     linux file descriptor
+ *      match:  predicate selecting the students to return
+ *      arg:    passed through to match
+ *      *n:     set to the number of students returned
+ *
+ *  Fallback for the index queries when their index is not valid, collects
+ *  the matching students with a full scan.
+ *
+ *  returns:  malloc()ed array of the matches, NULL on error
+ */
+static student_t *scan_matches(int fd, bool (*match)(const student_t *, const void *),
+                               const void *arg, size_t *n)
+{
+    db_scan_t scan;
+    const student_t *student;
+    size_t cap = 64;
+    int rc;
+
+    *n = 0;
+    student_t *matches = malloc(cap * sizeof(student_t));
+    if (matches == NULL || db_scan_open(&scan, fd) != NO_ERROR)
+    {
+        free(matches);
+        return NULL;
+    }
+    while ((rc = db_scan_next(&scan, &student)) > 0)
+    {
+        if (!match(student, arg))
+        {
+            continue;
+        }
+        if (*n == cap)
+        {
+            student_t *grown = realloc(matches, 2 * cap * sizeof(student_t));
+            if (grown == NULL)
+            {
+                rc = -1;
+                break;
+            }
+            matches = grown;
+            cap *= 2;
+        }
+        matches[(*n)++] = *student;
+    }
+    db_scan_close(&scan);
+
+    if (rc < 0)
+    {
+        free(matches);
+        return NULL;
+    }
+    return matches;
+}
+
+/*
+ *  fetch_match
+ *      fd:        linux file descriptor
+ *      id:        id from an index entry
+ *      matches:   array the student is appended to
+ *      *n:        number of students in matches
+ *
+ *  returns:  NO_ERROR       the student was appended, or the index entry was
+ *                           stale and skipped
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int fetch_match(int fd, int id, student_t *matches, size_t *n)
+{
+    int rc = get_student(fd, id, &matches[*n]);
+
+    if (rc == ERR_DB_FILE)
+    {
+        return ERR_DB_FILE;
+    }
+    if (rc == NO_ERROR)
+    {
+        (*n)++;
+    }
+    return NO_ERROR;
+}
+
+/*
+ *  print_matches
+ *      matches:  students to print
+ *      n:        number of students
+ *
+ *  returns:  nothing, this is a void function
+ *
+ *  console:  the students in the print_db() format, header first
+ */
+static void print_matches(const student_t *matches, size_t n)
+{
+    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+    for (size_t i = 0; i < n; i++)
+    {
+        float real_gpa = matches[i].gpa / 100.0;
+        printf(STUDENT_PRINT_FMT_STRING, matches[i].id, matches[i].fname, matches[i].lname, real_gpa);
+    }
+}
+
+/*
+ *  compare_lname_student
+ *
+ *  qsort() comparator ordering student records by last name, then id, the
+ *  same order the last name index uses.
+ */
+static int compare_lname_student(const void *a, const void *b)
+{
+    const student_t *sa = a;
+    const student_t *sb = b;
+
+    int rc = strncmp(sa->lname, sb->lname, sizeof(sa->lname));
+    if (rc != 0)
+    {
+        return rc;
+    }
+    return compare_student_id(a, b);
+}
+
+static bool match_lname_prefix(const student_t *s, const void *arg)
+{
+    const char *prefix = arg;
+
+    return strncmp(s->lname, prefix, strlen(prefix)) == 0;
+}
+
+/*
+ *  find_by_lname
+ *      fd:      linux file descriptor
+ *      prefix:  last name prefix to search for
+ *
+ *  Prints every student whose last name starts with prefix, ordered by last
+ *  name and id.  With a valid last name index this is a binary search plus
+ *  one get_student() per match.  Without it the database is scanned and the
+ *  matches are sorted.
+ *
+ *  returns:  NO_ERROR       at least one student found and printed
+ *            SRCH_NOT_FOUND no student has a matching last name
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the matching students in the print_db() format
+ *            M_LNAME_NOT_FND  no student matched
+ *            M_ERR_DB_READ    error reading the database file
+ */
+int find_by_lname(int fd, char *prefix)
+{
+    const lname_entry_t *first;
+    student_t *matches;
+    size_t n = 0;
+    int count = lname_find_prefix(prefix, &first);
+
+    if (count >= 0)
+    {
+        matches = malloc((count + 1) * sizeof(student_t));
+        for (int i = 0; matches != NULL && i < count; i++)
+        {
+            if (fetch_match(fd, first[i].id, matches, &n) != NO_ERROR)
+            {
+                free(matches);
+                matches = NULL;
+            }
+        }
+    }
+    else
+    {
+        // No usable index, collect the matches with a scan
+        matches = scan_matches(fd, match_lname_prefix, prefix, &n);
+        if (matches != NULL)
+        {
+            qsort(matches, n, sizeof(student_t), compare_lname_student);
+        }
+    }
+
+    if (matches == NULL)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (n == 0)
+    {
+        free(matches);
+        printf(M_LNAME_NOT_FND, prefix);
+        return SRCH_NOT_FOUND;
+    }
+
+    print_matches(matches, n);
+    free(matches);
+    return NO_ERROR;
+}
+
+/*
+ *  compare_gpa_student
+ *
+ *  qsort() comparator ordering student records by GPA, then id, the same
+ *  order the GPA index uses.
+ */
+static int compare_gpa_student(const void *a, const void *b)
+{
+    const student_t *sa = a;
+    const student_t *sb = b;
+
+    if (sa->gpa != sb->gpa)
+    {
+        return (sa->gpa > sb->gpa) - (sa->gpa < sb->gpa);
+    }
+    return compare_student_id(a, b);
+}
+
+static bool match_gpa_range(const student_t *s, const void *arg)
+{
+    const int *range = arg;
+
+    return (s->gpa >= range[0]) && (s->gpa <= range[1]);
+}
+
+/*
+ *  find_by_gpa
+ *      fd:  linux file descriptor
+ *      lo:  lowest GPA as an integer, inclusive
+ *      hi:  highest GPA as an integer, inclusive
+ *
+ *  Prints every student with a GPA in lo..hi, ordered by GPA and id.  With a
+ *  valid GPA index only the buckets in the range are visited, plus one
+ *  get_student() per match.  Without it the database is scanned and the
+ *  matches are sorted.
+ *
+ *  returns:  NO_ERROR       at least one student found and printed
+ *            SRCH_NOT_FOUND no student has a GPA in the range
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  the matching students in the print_db() format
+ *            M_GPA_NOT_FND    no student matched
+ *            M_ERR_DB_READ    error reading the database file
+ */
+int find_by_gpa(int fd, int lo, int hi)
+{
+    const gpa_entry_t *first;
+    student_t *matches;
+    size_t n = 0;
+    int count = gpa_find_range(lo, hi, &first);
+
+    if (count >= 0)
+    {
+        matches = malloc((count + 1) * sizeof(student_t));
+        for (int i = 0; matches != NULL && i < count; i++)
+        {
+            if (fetch_match(fd, first[i].id, matches, &n) != NO_ERROR)
+            {
+                free(matches);
+                matches = NULL;
+            }
+        }
+    }
+    else
+    {
+        // No usable index, collect the matches with a scan
+        int range[2] = { lo, hi };
+        matches = scan_matches(fd, match_gpa_range, range, &n);
+        if (matches != NULL)
+        {
+            qsort(matches, n, sizeof(student_t), compare_gpa_student);
+        }
+    }
+
+    if (matches == NULL)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    if (n == 0)
+    {
+        free(matches);
+        printf(M_GPA_NOT_FND, lo / 100.0, hi / 100.0);
+        return SRCH_NOT_FOUND;
+    }
+
+    print_matches(matches, n);
+    free(matches);
+    return NO_ERROR;
+}
+
+/*
+ *  stats_block
+ *      *stats:  histogram to add to
+ *      slots:   slots of a scan block, see db_scan_block()
+ *      n:       number of slots
  *
- *  Dont forget that  the GPA in the student structure is an int, to convert
- *  it into a real gpa divide by 100.0 and store in a float variable.
+ *  Adds the GPAs of the students in the slots to the histogram.  The
+ *  slots are walked at the fixed sizeof(student_t) stride straight out of
+ *  the scan block, one cache line each, instead of one db_scan_next() call
+ *  per record.  A GPA or an id other than 0 already shows that a slot is
+ *  not empty, only slots with both 0 are compared whole.
  *
  *  returns:  nothing, this is a void function
+ */
+static void stats_block(db_stats_t *stats, const student_t *slots, size_t n)
+{
+    for (const student_t *s = slots; s < slots + n; s++)
+    {
+        if (s->gpa < MIN_STD_GPA || s->gpa > MAX_STD_GPA)
+        {
+            continue;
+        }
+        if (s->gpa == 0 && s->id == 0 &&
+            memcmp(s, &EMPTY_STUDENT_RECORD, sizeof(student_t)) == 0)
+        {
+            continue; // empty or deleted slot
+        }
+        stats->hist[s->gpa]++;
+    }
+}
+
+/*
+ *  stats_part
+ *      scan:  scan of one id range
+ *      arg:   db_stats_t the histogram of the range is built in
  *
+ *  db_scan_parallel() part of collect_stats(), takes the scan a whole
+ *  block at a time.
  *
- *  console:  <see above>      on success, print table or database empty
- *            M_ERR_STD_PRINT  if the function argument s is NULL or if
- *                             s->id is zero
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ */
+static int stats_part(db_scan_t *scan, void *arg)
+{
+    db_stats_t *stats = arg;
+    const student_t *slots;
+    int n;
+
+    memset(stats, 0, sizeof(db_stats_t));
+    while ((n = db_scan_block(scan, &slots)) > 0)
+    {
+        stats_block(stats, slots, n);
+    }
+
+    return (n < 0) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  collect_stats
+ *      fd:      linux file descriptor
+ *      *stats:  filled with the GPA histogram of the database
  *
+ *  The GPA index is a column of just the GPAs, 8 bytes per student instead
+ *  of 64, so when it is valid the histogram is built from it without
+ *  touching the database.  Otherwise, and always for a snapshot reader that
+ *  has no indexes open, a parallel scan builds one histogram per id range
+ *  from the gpa field of every slot of its blocks, see stats_block(), and
+ *  the histograms are added up.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
  */
-void print_student(student_t *s)
+static int collect_stats(int fd, db_stats_t *stats)
 {
-    if (s == NULL || s->id == 0)
+    db_stats_t parts[DB_SCAN_THREADS];
+
+    memset(stats, 0, sizeof(db_stats_t));
+    if (gpa_histogram(stats->hist) == NO_ERROR)
     {
-        printf(M_ERR_STD_PRINT); // Print error if student is invalid
-        return;
+        return NO_ERROR;
+    }
+
+    int nparts = db_scan_parallel(fd, stats_part, parts, sizeof(db_stats_t));
+    for (int i = 0; i < nparts; i++)
+    {
+        for (int gpa = MIN_STD_GPA; gpa <= MAX_STD_GPA; gpa++)
+        {
+            stats->hist[gpa] += parts[i].hist[gpa];
+        }
+    }
+
+    return (nparts < 0) ? ERR_DB_FILE : NO_ERROR;
+}
+
+/*
+ *  print_stats
+ *      fd:     linux file descriptor
+ *
+ *  Reports the number of students and the minimum, maximum, mean and median
+ *  GPA, followed by a histogram of the GPAs that occur.  Everything is
+ *  derived from the MIN_STD_GPA..MAX_STD_GPA histogram, the median is found
+ *  by walking the buckets to the middle student.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue
+ *
+ *  console:  M_DB_RECORD_CNT, M_STATS_GPA and the histogram on success
+ *            M_DB_EMPTY       if the database has no students
+ *            M_ERR_DB_READ    error reading the database file
+ */
+int print_stats(int fd)
+{
+    db_stats_t stats;
+
+    if (collect_stats(fd, &stats) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
+        return ERR_DB_FILE;
+    }
+
+    return report_stats(&stats);
+}
+
+/*
+ *  report_stats
+ *      *stats:  GPA histogram of the students
+ *
+ *  Prints the statistics of print_stats() for a histogram, also used for
+ *  the compact copy.
+ *
+ *  returns:  NO_ERROR       this never fails
+ *
+ *  console:  see print_stats()
+ */
+int report_stats(const db_stats_t *stats)
+{
+    int count = 0;
+    long long sum = 0;
+    int min = -1;
+    int max = -1;
+
+    for (int gpa = MIN_STD_GPA; gpa <= MAX_STD_GPA; gpa++)
+    {
+        if (stats->hist[gpa] == 0)
+        {
+            continue;
+        }
+        if (min < 0)
+        {
+            min = gpa;
+        }
+        max = gpa;
+        count += stats->hist[gpa];
+        sum += (long long)gpa * stats->hist[gpa];
+    }
+
+    if (count == 0)
+    {
+        printf(M_DB_EMPTY);
+        return NO_ERROR;
+    }
+
+    // Median of an even count is the mean of the two middle students
+    int lo_rank = (count - 1) / 2;
+    int hi_rank = count / 2;
+    int lo_gpa = -1;
+    int hi_gpa = -1;
+    int seen = 0;
+    for (int gpa = min; gpa <= max && hi_gpa < 0; gpa++)
+    {
+        seen += stats->hist[gpa];
+        if (lo_gpa < 0 && seen > lo_rank)
+        {
+            lo_gpa = gpa;
+        }
+        if (seen > hi_rank)
+        {
+            hi_gpa = gpa;
+        }
+    }
+
+    printf(M_DB_RECORD_CNT, count);
+    printf(M_STATS_GPA, min / 100.0, max / 100.0, (double)sum / count / 100.0,
+           (lo_gpa + hi_gpa) / 200.0);
+    printf(M_STATS_HIST_HDR, "GPA", "COUNT");
+    for (int gpa = min; gpa <= max; gpa++)
+    {
+        if (stats->hist[gpa] != 0)
+        {
+            printf(M_STATS_HIST_ROW, gpa / 100.0, stats->hist[gpa]);
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ *  export_copy
+ *      fd:     linux file descriptor
+ *      copy:   &compact_copy or &archive_copy
+ *
+ *  Migrates the database to the format of copy, see sdb_compact.c and
+ *  sdb_archive.c.  The database itself is left as it is, the copy is a
+ *  snapshot of it.
+ *
+ *  returns:  <number>       number of students in the copy
+ *            ERR_DB_FILE    database or copy file I/O issue
+ *
+ *  console:  copy->written  on success
+ *            M_ERR_DB_WRITE error writing the copy
+ */
+int export_copy(int fd, const copy_ops_t *copy)
+{
+    int count = copy->write(DB_FILE, fd);
+    if (count < 0)
+    {
+        printf(M_ERR_DB_WRITE);
+        return ERR_DB_FILE;
+    }
+
+    printf(copy->written, count);
+    return count;
+}
+
+/*
+ *  import_copy
+ *      fd:     linux file descriptor, opened with DB_ACCESS_EXCLUSIVE
+ *      copy:   &compact_copy or &archive_copy
+ *
+ *  Migrates a copy back to the 64 byte layout.  The copy is read
+ *  completely before the database is truncated, then the students are
+ *  written like a bulk import.
+ *
+ *  returns:  <number>       the fd of the restored database
+ *            ERR_DB_FILE    database or copy file I/O issue
+ *            ERR_DB_OP      the copy holds ids the database has no room for
+ *
+ *  console:  copy->loaded   on success
+ *            copy->missing  the copy is missing or damaged
+ *            M_ERR_STD_RNG  a student of the copy is out of range
+ *            M_ERR_DB_WRITE error writing the database file
+ */
+int import_copy(int fd, const copy_ops_t *copy)
+{
+    size_t n = 0;
+    int id;
+
+    if (copy->open(DB_FILE) != NO_ERROR)
+    {
+        close_db(fd);
+        printf(copy->missing);
+        return ERR_DB_FILE;
+    }
+
+    int rc = NO_ERROR;
+    student_t *batch = malloc((copy->count() + 1) * sizeof(student_t));
+    for (id = copy->next(MIN_STD_ID); batch != NULL && id >= 0; id = copy->next(id + 1))
+    {
+        if ((int)n == copy->count() || copy->get(id, &batch[n++]) != NO_ERROR)
+        {
+            rc = ERR_DB_FILE; // the count or the records do not match the ids
+            break;
+        }
+    }
+    copy->close();
+    if (batch == NULL || rc != NO_ERROR || id == ERR_DB_FILE)
+    {
+        free(batch);
+        close_db(fd);
+        printf(copy->missing);
+        return ERR_DB_FILE;
+    }
+
+    // A copy of a segmented database only fits back into one
+    if (n > 0 && batch[n - 1].id > db_max_id(fd))
+    {
+        free(batch);
+        close_db(fd);
+        printf(M_ERR_STD_RNG);
+        return ERR_DB_OP;
+    }
+
+    // Like -z, the truncating open also resets the indexes and the log
+    close_db(fd);
+    fd = open_db(DB_FILE, true);
+    if (fd < 0)
+    {
+        free(batch);
+        return ERR_DB_FILE;
+    }
+    rc = write_import_batch(fd, batch, n);
+    free(batch);
+    if (rc != NO_ERROR)
+    {
+        close_db(fd);
+        return ERR_DB_FILE;
+    }
+
+    printf(copy->loaded, (int)n);
+    return fd;
+}
+
+/*
+ *  run_copy
+ *      copy:  &compact_copy for -K or &archive_copy for -A
+ *      op:    the option of the command, 'c', 'f', 'p' or 's'
+ *      id:    student id for 'f'
+ *
+ *  Runs a read only command against a copy instead of the database.  The
+ *  output is the same as for the database the copy was written from.
+ *
+ *  returns:  the exit code of the command
+ *
+ *  console:  the messages of the command
+ *            copy->missing  the copy is missing or damaged
+ */
+int run_copy(const copy_ops_t *copy, char op, int id)
+{
+    print_part_t out = { 0 };
+    student_t student;
+    db_stats_t stats;
+    int exit_code = EXIT_OK;
+    int count = 0;
+    int rc;
+
+    if (copy->open(DB_FILE) != NO_ERROR)
+    {
+        printf(copy->missing);
+        return EXIT_FAIL_DB;
+    }
+
+    switch (op)
+    {
+    case 'c':
+        count = copy->count();
+        if (count == 0)
+        {
+            printf(M_DB_EMPTY);
+        }
+        else
+        {
+            printf(M_DB_RECORD_CNT, count);
+        }
+        break;
+
+    case 'f':
+        rc = copy->get(id, &student);
+        if (rc == NO_ERROR)
+        {
+            print_student(&student);
+        }
+        else
+        {
+            printf((rc == SRCH_NOT_FOUND) ? M_STD_NOT_FND_MSG : M_ERR_DB_READ, id);
+            exit_code = EXIT_FAIL_DB;
+        }
+        break;
+
+    case 'p':
+        for (id = copy->next(MIN_STD_ID); id >= 0; id = copy->next(id + 1))
+        {
+            if (copy->get(id, &student) != NO_ERROR ||
+                (count++ == 0 && print_row(&out, NULL) != NO_ERROR) ||
+                print_row(&out, &student) != NO_ERROR)
+            {
+                id = ERR_DB_FILE;
+                break;
+            }
+            if (out.len >= PRINT_OUT_BUF - STUDENT_ROW_MAX)
+            {
+                print_flush(&out, false);
+            }
+        }
+        print_flush(&out, true);
+        if (id == ERR_DB_FILE)
+        {
+            printf(M_ERR_DB_READ);
+            exit_code = EXIT_FAIL_DB;
+        }
+        else if (count == 0)
+        {
+            printf(M_DB_EMPTY);
+        }
+        break;
+
+    case 's':
+        memset(&stats, 0, sizeof(db_stats_t));
+        if (copy->histogram(stats.hist) != NO_ERROR)
+        {
+            printf(M_ERR_DB_READ);
+            exit_code = EXIT_FAIL_DB;
+            break;
+        }
+        report_stats(&stats);
+        break;
+    }
+
+    copy->close();
+    return exit_code;
+}
+
+/*
+ *  rebuild_index
+ *      fd:     linux file descriptor
+ *
+ *  Verifies the secondary indexes and the record checksums against a full
+ *  scan of the database and rebuilds them if they are missing, stale or
+ *  wrong.  The indexes are written back when the database is closed.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database or index file I/O issue
+ *
+ *  console:  M_IDX_VERIFIED  the existing indexes were correct
+ *            M_IDX_REBUILT   the indexes had to be rebuilt
+ *            M_ERR_IDX       error reading the db or the index file
+ */
+int rebuild_index(int fd)
+{
+    int wrong = idx_rebuild(fd);
+    if (wrong < 0)
+    {
+        printf(M_ERR_IDX);
+        return ERR_DB_FILE;
+    }
+
+    if (wrong == 0)
+    {
+        printf(M_IDX_VERIFIED, occ_count());
+    }
+    else
+    {
+        printf(M_IDX_REBUILT, occ_count());
     }
 
-    // Print header once
-    printf(STUDENT_PRINT_HDR_STRING, "ID", "FIRST NAME", "LAST_NAME", "GPA");
+    return NO_ERROR;
+}
+
+// Results of one range of verify_db()
+typedef struct verify_part {
+    int checked;            // records that match their checksum
+    long long *bad;         // slots that do not, ascending
+    size_t nbad;
+    size_t cap;
+    id_table_t *seen;       // shared, set for every id found in the file
+} verify_part_t;
+
+/*
+ *  verify_part
+ *      scan:  scan of one id range
+ *      arg:   verify_part_t of the range
+ *
+ *  db_scan_parallel() part of verify_db().  Every record is checked against
+ *  the checksum of its id, a record whose id is out of range fails as well.
+ *
+ *  returns:  NO_ERROR       on success
+ *            ERR_DB_FILE    database file I/O issue or out of memory
+ */
+static int verify_part(db_scan_t *scan, void *arg)
+{
+    verify_part_t *part = arg;
+    const student_t *student;
+    int rc;
+
+    while ((rc = db_scan_next(scan, &student)) > 0)
+    {
+        int id = student->id;
+        if (id >= MIN_STD_ID && id <= part->seen->max_id)
+        {
+            unsigned char *seen = idtab_put(part->seen, id);
+            if (seen == NULL)
+            {
+                return ERR_DB_FILE;
+            }
+            __atomic_store_n(seen, 1, __ATOMIC_RELAXED);
+            if (student_sum(student) == sum_get(id))
+            {
+                part->checked++;
+                continue;
+            }
+        }
+
+        if (part->nbad == part->cap)
+        {
+            part->cap = part->cap ? 2 * part->cap : 64;
+            long long *grown = realloc(part->bad, part->cap * sizeof(long long));
+            if (grown == NULL)
+            {
+                return ERR_DB_FILE;
+            }
+            part->bad = grown;
+        }
+        part->bad[part->nbad++] = scan->record_offset / (off_t)sizeof(student_t);
+    }
 
-    // Convert GPA to float and print student details
-    float real_gpa = s->gpa / 100.0;
-    printf(STUDENT_PRINT_FMT_STRING, s->id, s->fname, s->lname, real_gpa);
+    return (rc < 0) ? ERR_DB_FILE : NO_ERROR;
 }
 
 /*
- *  NOTE IMPLEMENTING THIS FUNCTION IS EXTRA CREDIT
- *
- *  compress_db
- *      fd:     linux file descriptor
- *
- *  This assignment takes advantage of the way Linux handles sparse files
- *  on disk. Thus if there is a large hole between student records, Linux
- *  will not use any physical storage.  However, when a database record is
- *  deleted storage is used to write a blank - see EMPTY_STUDENT_RECORD from
- *  db.h - record.
- *
- *  Since Linux provides no way to delete data in the middle of a file, and
- *  deleted records take up physical storage, this function will compress the
- *  database by rewriting a new database file that only includes valid student
- *  records. There are a number of ways to do this, but since this is extra credit
- *  you need to figure this out on your own.
- *
- *  At a high level create a temporary database file then copy all valid students from
- *  the active database (passed in via fd) to the temporary file. When this is done
- *  rename the temporary database file to the name of the real database file. See
- *  the constants in db.h for required file names:
- *
- *         #define DB_FILE     "student.db"        //name of database file
- *         #define TMP_DB_FILE ".tmp_student.db"   //for extra credit
+ *  verify_db
+ *      fd:  linux file descriptor
  *
- *  Note that you are passed in the fd of the database file to be compressed,
- *  it is very likely you will need to close it to overwrite it with the
- *  compressed version of the file.  To ensure the caller can work with the
- *  compressed file after you create it, it is a good design to return the fd
- *  of the new compressed file from this function
+ *  Checks every record of the database against its CRC32C from the
+ *  checksum sidecar.  The file is scanned in parallel id ranges like a
+ *  count, so the check runs at the speed the file can be read.  A record
+ *  whose bytes changed fails its checksum, a student whose record was
+ *  zeroed or lost is found through the checksums of the ids that were not
+ *  seen in the file.
  *
- *  returns:  <number>       returns the fd of the compressed database file
+ *  returns:  <number>       number of corrupted records, 0 if all are fine
+ *            ERR_DB_OP      there are no valid checksums to verify with
  *            ERR_DB_FILE    database file I/O issue
  *
- *
- *  console:  M_DB_COMPRESSED_OK  on success, the db was successfully compressed.
- *            M_ERR_DB_OPEN    error when opening/creating temporary database file.
- *                             this error should also be returned after you
- *                             compressed the database file and if you are unable
- *                             to open it to pass the fd back to the caller
- *            M_ERR_DB_CREATE  error creating the db file. For instance the
- *                             inability to copy the temporary file back as
- *                             the primary database file.
- *            M_ERR_DB_READ    error reading or seeking the the db or tempdb file
- *            M_ERR_DB_WRITE   error writing to db or tempdb file (adding student)
- *
+ *  console:  M_DB_VERIFIED      every record matches its checksum
+ *            M_ERR_SUM_SLOT     for each slot that fails its checksum
+ *            M_ERR_SUM_MISSING  for each student that is not in the file
+ *            M_ERR_DB_CORRUPT   the number of corrupted records
+ *            M_ERR_NO_SUMS      the checksums are missing or stale
+ *            M_ERR_DB_READ      error reading the database file
  */
-int compress_db(int fd)
+int verify_db(int fd)
 {
-    // Close original file descriptor
-    close(fd);
+    verify_part_t parts[DB_SCAN_THREADS];
 
-    // Open temporary file
-    int tmp_fd = open(TMP_DB_FILE, O_RDWR | O_CREAT | O_TRUNC, 
-                      S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-    if (tmp_fd == -1) {
-        printf(M_ERR_DB_OPEN);
-        return ERR_DB_FILE;
+    if (!sum_valid())
+    {
+        printf(M_ERR_NO_SUMS);
+        return ERR_DB_OP;
     }
 
-    // Reopen original database
-    fd = open(DB_FILE, O_RDONLY);
-    if (fd == -1) {
-        close(tmp_fd);
-        printf(M_ERR_DB_OPEN);
+    id_table_t seen;
+    if (idtab_init(&seen, db_max_id(fd), 1) != NO_ERROR)
+    {
+        printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
+    memset(parts, 0, sizeof(parts));
+    for (int i = 0; i < DB_SCAN_THREADS; i++)
+    {
+        parts[i].seen = &seen;
+    }
 
-    student_t student;
-    ssize_t bytes_read;
-    while ((bytes_read = read(fd, &student, sizeof(student_t))) == sizeof(student_t)) {
-        // Copy only non-empty records
-        if (student.id != 0) {
-            if (write(tmp_fd, &student, sizeof(student_t)) != sizeof(student_t)) {
-                close(fd);
-                close(tmp_fd);
-                printf(M_ERR_DB_WRITE);
-                return ERR_DB_FILE;
-            }
+    int nparts = db_scan_parallel(fd, verify_part, parts, sizeof(verify_part_t));
+    int checked = 0;
+    int corrupt = 0;
+    for (int i = 0; i < nparts; i++)
+    {
+        // The ranges are in id order, so are their slots
+        checked += parts[i].checked;
+        for (size_t j = 0; j < parts[i].nbad; j++)
+        {
+            printf(M_ERR_SUM_SLOT, parts[i].bad[j]);
+            corrupt++;
+        }
+    }
+    int id = (nparts < 0) ? SRCH_NOT_FOUND : sum_next(MIN_STD_ID);
+    for (; id >= 0; id = sum_next(id + 1))
+    {
+        unsigned char *found = idtab_get(&seen, id);
+        if (found == NULL || !*found)
+        {
+            printf(M_ERR_SUM_MISSING, id);
+            corrupt++;
         }
     }
+    for (int i = 0; i < DB_SCAN_THREADS; i++)
+    {
+        free(parts[i].bad);
+    }
+    idtab_free(&seen);
 
-    if (bytes_read == -1) {
-        close(fd);
-        close(tmp_fd);
+    if (nparts < 0 || id == ERR_DB_FILE)
+    {
         printf(M_ERR_DB_READ);
         return ERR_DB_FILE;
     }
-
-    // Close both files
-    close(fd);
-    close(tmp_fd);
-
-    // Replace original database with compressed version
-    if (rename(TMP_DB_FILE, DB_FILE) == -1) {
-        printf(M_ERR_DB_CREATE);
-        return ERR_DB_FILE;
+    if (corrupt > 0)
+    {
+        printf(M_ERR_DB_CORRUPT, corrupt);
     }
-
-    // Reopen the compressed database
-    fd = open(DB_FILE, O_RDWR);
-    if (fd == -1) {
-        printf(M_ERR_DB_OPEN);
-        return ERR_DB_FILE;
+    else
+    {
+        printf(M_DB_VERIFIED, checked);
     }
 
-    printf(M_DB_COMPRESSED_OK);
-    return fd;
+    return corrupt;
 }
 
 /*
@@ -513,7 +4746,8 @@ int compress_db(int fd)
  *
  *  This function validates that the id and gpa are in the allowable ranges
  *  as per the specifications.  It checks if the values are within the
- *  inclusive range using constents in db.h
+ *  inclusive range using constents in db.h, ids up to the largest one the
+ *  open database takes, see db_max_id()
  *
  *  returns:    NO_ERROR       on success, both ID and GPA are in range
  *              EXIT_FAIL_ARGS if either ID or GPA is out of range
@@ -524,7 +4758,7 @@ int compress_db(int fd)
 int validate_range(int id, int gpa)
 {
 
-    if ((id < MIN_STD_ID) || (id > MAX_STD_ID))
+    if ((id < MIN_STD_ID) || (id > db_id_limit))
         return EXIT_FAIL_ARGS;
 
     if ((gpa < MIN_STD_GPA) || (gpa > MAX_STD_GPA))
@@ -546,15 +4780,34 @@ int validate_range(int id, int gpa)
  */
 void usage(char *exename)
 {
-    printf("usage: %s -[h|a|c|d|f|p|z] options.  Where:\n", exename);
+    printf("usage: %s [-M|-U] [-C] [-K|-A] -[h|a|b|c|d|e|f|g|i|j|k|l|p|r|s|u|v|x|z|B|S] options.  Where:\n", exename);
+    printf("\t-M:  access the database through a memory mapping\n");
+    printf("\t-U:  submits the record I/O of b, i, j and x in batches to io_uring\n");
+    printf("\t-C:  sends a, c, d, f or p to the server started with -S\n");
+    printf("\t-K:  runs c, f, p or s against the compact copy written with -k\n");
+    printf("\t-A:  like -K for the compressed archive, -A -k writes it and -A -u restores it\n");
     printf("\t-h:  prints help\n");
     printf("\t-a id first_name last_name gpa(as 3 digit int):  adds a student\n");
+    printf("\t-b:  runs a, c, d and f commands from stdin, one per line like the options\n");
     printf("\t-c:  counts the records in the database\n");
     printf("\t-d id:  deletes a student\n");
+    printf("\t-e:  splits the database into segment files of %d ids each\n", SEG_IDS);
     printf("\t-f id:  finds and prints a student in the database\n");
+    printf("\t-g lo hi:  finds and prints students with lo <= gpa <= hi (as 3 digit ints)\n");
+    printf("\t-i file:  imports students from a csv file, one id,first_name,last_name,gpa per line\n");
+    printf("\t-j:  joins a database split with -e back into a single file\n");
+    printf("\t-k:  writes a compact copy of the database, 12 bytes per student plus the names\n");
     printf("\t-p:  prints all records in the student database\n");
+    printf("\t      c, p and s read a snapshot taken at their start, a and d never wait for them\n");
+    printf("\t-l prefix:  finds and prints students whose last name starts with prefix\n");
+    printf("\t-r:  verifies and rebuilds the indexes\n");
+    printf("\t-s:  prints GPA statistics and a GPA histogram\n");
+    printf("\t-u:  replaces the database with the students of the compact copy\n");
+    printf("\t-v:  verifies every record against its checksum\n");
     printf("\t-x:  compress the database file [EXTRA CREDIT]\n");
     printf("\t-z:  zero db file (remove all records)\n");
+    printf("\t-B dir:  copies the database files to dir, the segments in parallel\n");
+    printf("\t-S:  serves the database from memory until interrupted\n");
 }
 
 // Welcome to main()
@@ -580,6 +4833,37 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    // Optional leading modifiers, -M selects the memory mapped engine, -U
+    // the io_uring one, -C sends the command to a running server, -K and -A
+    // pick the compact copy or the archive.  Drop them so the operation and
+    // its arguments keep their usual argv positions
+    bool client = false;
+    const copy_ops_t *copy = NULL;
+    while ((argc > 2) && (strcmp(argv[1], "-M") == 0 || strcmp(argv[1], "-U") == 0 ||
+                          strcmp(argv[1], "-C") == 0 || strcmp(argv[1], "-K") == 0 ||
+                          strcmp(argv[1], "-A") == 0))
+    {
+        if (argv[1][1] == 'M')
+        {
+            set_db_engine(DB_ENGINE_MMAP);
+        }
+        else if (argv[1][1] == 'U')
+        {
+            set_db_engine(DB_ENGINE_URING);
+        }
+        else if (argv[1][1] == 'C')
+        {
+            client = true;
+        }
+        else
+        {
+            copy = (argv[1][1] == 'K') ? &compact_copy : &archive_copy;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     // The option is the first character after the dash for example
     //-h -a -c -d -f -p -x -z
     opt = (char)*(argv[1] + 1); // get the option flag
@@ -591,11 +4875,69 @@ int main(int argc, char *argv[])
         exit(EXIT_OK);
     }
 
+    // the server answers from its own table, the database is not opened
+    if (client && strchr("acdfp", opt) == NULL)
+    {
+        printf(M_ERR_SERVER_OP);
+        exit(EXIT_FAIL_ARGS);
+    }
+    if (copy != NULL && strchr("cfkpsu", opt) == NULL)
+    {
+        printf(M_ERR_COMPACT_OP);
+        exit(EXIT_FAIL_ARGS);
+    }
+
+    // reads of a copy answer without the database, -k and -u default to
+    // the compact copy
+    bool from_copy = (copy != NULL) && strchr("cfps", opt) != NULL;
+    if (copy == NULL)
+    {
+        copy = &compact_copy;
+    }
+
+    // take only the locks the operation needs, see set_db_access()
+    switch (opt)
+    {
+    case 'f':
+    case 'x':
+        set_db_access(DB_ACCESS_LOOKUP);
+        break;
+    case 'a':
+    case 'b':
+    case 'd':
+        set_db_access(DB_ACCESS_WRITE);
+        break;
+    case 'e':
+    case 'i':
+    case 'j':
+    case 'r':
+    case 'S':
+    case 'u':
+    case 'z':
+        set_db_access(DB_ACCESS_EXCLUSIVE);
+        break;
+    case 'c':
+    case 'p':
+    case 's':
+        set_db_access(DB_ACCESS_SNAPSHOT);
+        break;
+    default:
+        set_db_access(DB_ACCESS_READ);
+    }
+
+    // batch output leaves in large chunks, the buffer has to be set up
+    // before anything is printed
+    if (opt == 'b')
+    {
+        setvbuf(stdout, NULL, _IOFBF, BATCH_OUT_BUF);
+    }
+
     // now lets open the file and continue if there is no error
     // note we are not truncating the file using the second
     // parameter
-    fd = open_db(DB_FILE, false);
-    if (fd < 0)
+    // the server and the copies answer without the database
+    fd = (client || from_copy) ? -1 : open_db(DB_FILE, false);
+    if (fd < 0 && !client && !from_copy)
     {
         exit(EXIT_FAIL_DB);
     }
@@ -631,17 +4973,42 @@ int main(int argc, char *argv[])
             break;
         }
 
+        if (client)
+        {
+            init_student(&student, id, argv[3], argv[4], gpa);
+            exit_code = server_request(opt, &student);
+            break;
+        }
+
         rc = add_student(fd, id, argv[3], argv[4], gpa);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
 
         break;
 
+    case 'b':
+        //    arv[0] arv[1]
+        // prog_name     -b
+        //-----------------
+        // example:  prog_name -b < commands.txt
+        exit_code = run_batch(fd, STDIN_FILENO);
+        break;
+
     case 'c':
         //    arv[0] arv[1]
         // prog_name     -c
         //-----------------
         // example:  prog_name -c
+        if (client)
+        {
+            exit_code = server_request(opt, NULL);
+            break;
+        }
+        if (from_copy)
+        {
+            exit_code = run_copy(copy, opt, 0);
+            break;
+        }
         rc = count_db_records(fd);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
@@ -659,6 +5026,12 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
+        if (client)
+        {
+            student.id = id;
+            exit_code = server_request(opt, &student);
+            break;
+        }
         rc = del_student(fd, id);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
@@ -677,6 +5050,17 @@ int main(int argc, char *argv[])
             break;
         }
         id = atoi(argv[2]);
+        if (client)
+        {
+            student.id = id;
+            exit_code = server_request(opt, &student);
+            break;
+        }
+        if (from_copy)
+        {
+            exit_code = run_copy(copy, opt, id);
+            break;
+        }
         rc = get_student(fd, id, &student);
 
         switch (rc)
@@ -695,16 +5079,186 @@ int main(int argc, char *argv[])
         }
         break;
 
+    case 'i':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -i    file
+        //-------------------------
+        // example:  prog_name -i students.csv
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = import_students(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'g':
+        //    arv[0] arv[1]  arv[2]  arv[3]
+        // prog_name     -g      lo      hi
+        //---------------------------------
+        // example:  prog_name -g 350 500
+        if (argc != 4)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = atoi(argv[2]);
+        gpa = atoi(argv[3]);
+        if ((rc < MIN_STD_GPA) || (gpa > MAX_STD_GPA) || (rc > gpa))
+        {
+            printf(M_ERR_GPA_RNG);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = find_by_gpa(fd, rc, gpa);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'k':
+        //    arv[0] arv[1]
+        // prog_name     -k
+        //-----------------
+        // example:  prog_name -k
+        rc = export_copy(fd, copy);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'l':
+        //    arv[0] arv[1]  arv[2]
+        // prog_name     -l  prefix
+        //-------------------------
+        // example:  prog_name -l Do
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        rc = find_by_lname(fd, argv[2]);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'p':
         //    arv[0] arv[1]
         // prog_name     -p
         //-----------------
         // example:  prog_name -p
+        if (client)
+        {
+            exit_code = server_request(opt, NULL);
+            break;
+        }
+        if (from_copy)
+        {
+            exit_code = run_copy(copy, opt, 0);
+            break;
+        }
         rc = print_db(fd);
         if (rc < 0)
             exit_code = EXIT_FAIL_DB;
         break;
 
+    case 'r':
+        //    arv[0] arv[1]
+        // prog_name     -r
+        //-----------------
+        // example:  prog_name -r
+        rc = rebuild_index(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'v':
+        //    arv[0] arv[1]
+        // prog_name     -v
+        //-----------------
+        // example:  prog_name -v
+        rc = verify_db(fd);
+        if (rc != NO_ERROR)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 's':
+        //    arv[0] arv[1]
+        // prog_name     -s
+        //-----------------
+        // example:  prog_name -s
+        if (from_copy)
+        {
+            exit_code = run_copy(copy, opt, 0);
+            break;
+        }
+        rc = print_stats(fd);
+        if (rc < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'S':
+        //    arv[0] arv[1]
+        // prog_name     -S
+        //-----------------
+        // example:  prog_name -S &
+        // like compress_db, run_server returns the fd of the database
+        fd = run_server(fd);
+        if (fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'u':
+        //    arv[0] arv[1]
+        // prog_name     -u
+        //-----------------
+        // example:  prog_name -u
+        // like compress_db, import_copy returns the fd of the database
+        fd = import_copy(fd, copy);
+        if (fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'e':
+        //    arv[0] arv[1]
+        // prog_name     -e
+        //-----------------
+        // example:  prog_name -e
+        // like compress_db, split_db returns the fd of the database
+        fd = split_db(fd);
+        if (fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'j':
+        //    arv[0] arv[1]
+        // prog_name     -j
+        //-----------------
+        // example:  prog_name -j
+        // like compress_db, join_db returns the fd of the database
+        fd = join_db(fd);
+        if (fd < 0)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
+    case 'B':
+        //    arv[0] arv[1] arv[2]
+        // prog_name     -B    dir
+        //------------------------
+        // example:  prog_name -B backup
+        if (argc != 3)
+        {
+            usage(argv[0]);
+            exit_code = EXIT_FAIL_ARGS;
+            break;
+        }
+        if (backup_db(fd, argv[2]) != NO_ERROR)
+            exit_code = EXIT_FAIL_DB;
+        break;
+
     case 'x':
         //    arv[0] arv[1]
         // prog_name     -x
@@ -725,7 +5279,7 @@ int main(int argc, char *argv[])
         // example:  prog_name -x
         // HINT:  close the db file, we already have fd
         //       and reopen db indicating truncate=true
-        close(fd);
+        close_db(fd);
         fd = open_db(DB_FILE, true);
         if (fd < 0)
         {
@@ -742,6 +5296,10 @@ int main(int argc, char *argv[])
 
     // dont forget to close the file before exiting, and setting the
     // proper exit code - see the header file for expected values
-    close(fd);
+    if (fd >= 0 && close_db(fd) != NO_ERROR)
+    {
+        printf(M_ERR_DB_WRITE);
+        exit_code = EXIT_FAIL_DB;
+    }
     exit(exit_code);
 }
\ No newline at end of file
@@ -1,17 +1,400 @@
 #ifndef __SDB_H__
 
+#include <stdint.h>
+#include <sys/types.h>
+
 #include "db.h" //get student record type
 
+//state of a full table scan, see db_scan_open()
+#define DB_SCAN_BLOCK   (1024 * 1024)   //bytes moved per block read
+#define DB_SCAN_TO_EOF  ((off_t)-1)     //end of a scan that runs to EOF
+typedef struct db_scan {
+    int fd;
+    off_t position;         //file offset of the next block to load
+    off_t end;              //file offset the scan stops at, or DB_SCAN_TO_EOF
+    off_t data_end;         //end of the allocated extent being scanned
+    char *block;            //block buffer, NULL when scanning a mapping
+    char *buf;              //current block, in block or in the mapping
+    size_t len;             //bytes of records in buf
+    size_t next;            //offset in buf of the next record to check
+    off_t buf_offset;       //file offset of buf[0]
+    off_t record_offset;    //file offset of the last record returned
+} db_scan_t;
+
+//parallel scans split the file into DB_SCAN_BLOCK aligned ranges, one per
+//thread, see db_scan_parallel()
+#define DB_SCAN_THREADS 8               //most threads a scan is split into
+typedef int (*db_scan_part_fn)(db_scan_t *scan, void *arg);
+
+//rows formatted by format_student(), one range of a parallel print_db() or
+//the output buffer of a sequential print, see print_row()
+typedef struct print_part {
+    char *text;
+    size_t len;
+    size_t cap;
+    int rows;
+} print_part_t;
+#define STUDENT_ROW_MAX 128             //longest row of format_student()
+#define PRINT_OUT_BUF   (256 * 1024)    //sequential prints write() in chunks
+
+//segmented database, the slots are spread over fixed size segment files in
+//the directory dbFile SEG_DIR_SUFFIX, see sdb_segment.c
+#define SEG_DIR_SUFFIX  ".seg"
+#define SEG_MANIFEST    "manifest"      //lists the segments and their ids
+#define SEG_MAGIC       0x53454731      //"SEG1"
+#define SEG_IDS         16384           //ids per segment, 1 MiB of slots
+#define SEG_MAX_STD_ID  50000000        //ids past MAX_STD_ID only fit into
+                                        //segments, see db_max_id()
+#define SEG_FD_SPARE    64              //open files left for all but segments
+typedef struct seg_manifest {
+    uint32_t magic;
+    uint32_t seg_ids;       //ids per segment, whole DB_SCAN_BLOCKs
+    uint32_t nsegs;         //seg_entry_t records after the header
+    uint32_t reserved;
+} seg_manifest_t;
+typedef struct seg_entry {
+    int64_t first_id;       //segment file %05d holds first_id..last_id
+    int64_t last_id;
+} seg_entry_t;
+typedef int (*seg_part_fn)(int seg, off_t start, off_t end, void *arg);
+
+//one positional read or write of a batch, see db_io_many()
+typedef struct db_io {
+    void *buf;
+    size_t len;
+    off_t offset;
+    ssize_t res;            //bytes moved, or -1 on error
+} db_io_t;
+#define URING_DEPTH     256             //entries of the io_uring queues
+#define BATCH_FIND_RUN  1024            //f lines of -b looked up together
+#define BATCH_WRITE_RUN WAL_BATCH       //a and d lines of -b sharing a commit
+
+//table with an entry per student id, allocated a chunk of ids at a time,
+//see sdb_idtab.c
+#define IDTAB_CHUNK     SEG_IDS         //ids per chunk, like the segments
+typedef struct id_table {
+    int max_id;             //largest id of the table
+    size_t entry_size;      //bytes per id
+    int nchunks;
+    char **chunks;          //IDTAB_CHUNK entries each, NULL until one is set
+} id_table_t;
+
+//occupancy index sidecar, one bit per possible student id, see sdb_index.c
+#define OCC_FILE_SUFFIX ".occ"          //index file is the db file name + suffix
+#define OCC_MAGIC       0x4f434331      //"OCC1"
+#define OCC_WORDS(max_id) (((max_id) + 64) / 64)
+#define OCC_SPARSE_BYTES 4096           //print via the index below one student
+                                        //per this many bytes of file
+typedef struct occ_file {
+    uint32_t magic;         //OCC_MAGIC
+    uint32_t dirty;         //set while the database is being changed
+    int64_t db_size;        //database size when the index was written
+    uint64_t bits[];        //OCC_WORDS() of the largest id of the database
+} occ_file_t;
+
+//record checksum sidecar, the CRC32C of every student by id behind a header,
+//0 for an id without a student, see sdb_index.c
+#define SUM_FILE_SUFFIX ".crc"
+#define SUM_MAGIC       0x43524331      //"CRC1"
+typedef struct sum_header {
+    uint32_t magic;         //SUM_MAGIC
+    uint32_t dirty;         //set while the database is being changed
+    int64_t db_size;        //database size when the checksums were written
+} sum_header_t;
+#define SUM_FILE_SIZE(max_id) (sizeof(sum_header_t) + ((size_t)(max_id) + 1) * sizeof(uint32_t))
+
+//sorted sidecar indexes, a header followed by an array of entries kept in
+//key order, see sdb_index.c
+typedef struct sidx_header {
+    uint32_t magic;         //identifies the index
+    uint32_t dirty;         //set while the database is being changed
+    int64_t db_size;        //database size when the index was written
+    uint32_t count;         //number of entries
+    uint32_t entry_size;    //bytes per entry
+} sidx_header_t;
+
+//last name index, entries sorted by last name then id
+#define LNAME_FILE_SUFFIX ".lname"
+#define LNAME_MAGIC     0x4c4e4d31      //"LNM1"
+typedef struct lname_entry {
+    char lname[32];
+    int id;
+} lname_entry_t;
+
+//GPA index, entries sorted by GPA then id so every GPA is one bucket
+#define GPA_FILE_SUFFIX ".gpa"
+#define GPA_MAGIC       0x47504131      //"GPA1"
+typedef struct gpa_entry {
+    int gpa;
+    int id;
+} gpa_entry_t;
+
+//write-ahead log, full record images appended before the database is
+//written, see sdb_wal.c
+#define WAL_FILE_SUFFIX ".wal"
+#define WAL_MAGIC       0x57414c31      //"WAL1"
+#define WAL_BATCH       1024            //records queued per group commit
+#define WAL_CHECKPOINT_BYTES (64 * 1024) //close_db() empties a larger log
+typedef struct wal_record {
+    uint32_t magic;         //WAL_MAGIC
+    uint32_t checksum;      //over offset and student, see wal_checksum()
+    int64_t offset;         //database file offset of the record
+    student_t student;      //record image to write there
+} wal_record_t;
+
+//an add or delete split into queueing its records in the log and writing
+//them, so several writes can share one wal_commit(), see log_student_write()
+typedef struct student_write {
+    char op;                //'a' or 'd'
+    bool logged;            //the records are queued with wal_log()
+    int rc;                 //outcome of the check, then of the write
+    student_t image;        //the new student, or the one being deleted
+    off_t offset;           //slot the write goes to
+    student_t fill;         //record a delete writes there
+    off_t fill_offset;      //slot a delete empties, offset unless packed
+} student_write_t;
+
+//compact copy, a 12 byte hot record per id slot plus a heap with the names,
+//see sdb_compact.c
+#define COMPACT_HOT_SUFFIX  ".hot"
+#define COMPACT_HEAP_SUFFIX ".heap"
+#define COMPACT_MAGIC       0x434d5031  //"CMP1"
+typedef struct compact_record {
+    int id;                 //DELETED_STUDENT_ID if empty, COMPACT_MAGIC in slot 0
+    int gpa;                //number of students in slot 0
+    uint32_t name_off;      //heap offset of fname and lname, heap size in slot 0
+} compact_record_t;
+
+//snapshot sidecar, the images of database blocks as they were before a
+//writer changed them, kept while a snapshot reader may still need them, see
+//sdb_snap.c.  The images follow the header, SNAP_BLOCK bytes per entry.
+#define SNAP_FILE_SUFFIX ".snap"
+#define SNAP_MAGIC      0x534e5031      //"SNP1"
+#define SNAP_BLOCK      4096            //bytes saved per changed block
+#define SNAP_READERS    64              //snapshots that can be open at once
+#define SNAP_ENTRIES    4096            //saved blocks before snapshots expire
+#define SNAP_FIRST_VERSION 1            //version of a new sidecar
+typedef struct snap_entry {
+    int64_t block;          //database offset / SNAP_BLOCK
+    uint64_t saved;         //version of the write that changed the block
+} snap_entry_t;
+typedef struct snap_header {
+    uint32_t magic;         //SNAP_MAGIC
+    uint32_t nentries;      //saved blocks, grows while readers are open
+    uint64_t version;       //last write that began
+    uint64_t committed;     //last write that ended, new snapshots see it
+    uint64_t oldest;        //snapshots older than this were given up
+    uint64_t readers[SNAP_READERS]; //version seen by each reader, 0 if free
+    snap_entry_t entries[SNAP_ENTRIES];
+} snap_header_t;
+#define SNAP_DATA_AT    (((sizeof(snap_header_t) + SNAP_BLOCK - 1) / SNAP_BLOCK) * SNAP_BLOCK)
+
+//compressed archive, the students sorted by id in blocks of ARCHIVE_BLOCK
+//bytes that are compressed one by one, see sdb_archive.c
+#define ARCHIVE_SUFFIX  ".lz"
+#define ARCHIVE_MAGIC   0x41524331      //"ARC1"
+#define ARCHIVE_BLOCK   4096
+#define ARCHIVE_BLOCK_RECORDS (ARCHIVE_BLOCK / (int)sizeof(student_t))
+typedef struct archive_header {
+    uint32_t magic;
+    int count;              //number of students
+    uint32_t nblocks;       //entries in the block index after the header
+    uint32_t reserved;
+} archive_header_t;
+typedef struct archive_block {
+    int first_id;           //id range of the block
+    int last_id;
+    uint32_t offset;        //file offset of the compressed block
+    uint16_t clen;          //compressed bytes
+    uint16_t nrecords;      //students in the block
+} archive_block_t;
+
+//the LZ codec of the archive never grows data by more than this
+#define LZ_BOUND(n)     ((n) + (n) / 128 + 1)
+
+//read only copies of the database, the compact copy and the archive, see
+//run_copy()
+typedef struct copy_ops {
+    int (*write)(char *dbFile, int db_fd);
+    int (*open)(char *dbFile);
+    void (*close)(void);
+    int (*count)(void);
+    int (*next)(int id);
+    int (*get)(int id, student_t *s);
+    int (*histogram)(int *hist);
+    const char *written;    //message after the copy was written
+    const char *loaded;     //message after the database was restored
+    const char *missing;    //message if the copy can not be read
+} copy_ops_t;
+
+//server mode, one request and one reply per connection, see sdb_server.c
+#define SERVER_SOCK_SUFFIX ".sock"      //socket is the db file name + suffix
+#define SERVER_FLUSH_MS     100         //changes are written back this often
+#define SERVER_POLL_MS      200         //how quickly a stop signal is noticed
+#define SERVER_BACKLOG      128
+typedef struct server_request {
+    char op;                //option of the command, 'a', 'c', 'd', 'f' or 'p'
+    student_t student;      //whole record for a, only the id for d and f
+} server_request_t;
+typedef struct server_reply {
+    int exit_code;          //what the command exits with
+    uint32_t len;           //bytes of console output following the reply
+} server_reply_t;
+
+//script mode, see run_batch()
+#define BATCH_OUT_BUF   (1024 * 1024)   //stdout buffer, output leaves in chunks
+#define BATCH_IN_BUF    (64 * 1024)     //bytes of commands read at a time
+
+//GPA statistics, see print_stats()
+typedef struct db_stats {
+    int hist[MAX_STD_GPA + 1];  //number of students per integer GPA
+} db_stats_t;
+
 //prototypes for functions go below for this assignment
 int open_db(char *dbFile, bool should_truncate);
+int close_db(int fd);
+int sync_db(int fd);
+ssize_t db_read(int fd, void *buf, size_t len, off_t offset);
+ssize_t db_write(int fd, const void *buf, size_t len, off_t offset);
+int db_io_many(int fd, db_io_t *ios, size_t n, bool write);
+off_t db_size(int fd);
+int db_lock(int fd, short type, off_t start, off_t len);
+int db_max_id(int fd);
+void set_db_engine(int engine);
+void set_db_access(int access);
+int db_scan_open(db_scan_t *scan, int fd);
+int db_scan_range(db_scan_t *scan, int fd, off_t start, off_t end);
+int db_scan_next(db_scan_t *scan, const student_t **s);
+int db_scan_block(db_scan_t *scan, const student_t **first);
+void db_scan_close(db_scan_t *scan);
+int db_scan_parallel(int fd, db_scan_part_fn part, void *args, size_t arg_size);
 int add_student(int fd, int id, char *fname, char *lname, int gpa);
 int get_student(int fd, int id, student_t *s);
 int del_student(int fd, int id);
 int compress_db(int fd);
+int split_db(int fd);
+int join_db(int fd);
+int backup_db(int fd, char *dir);
 void print_student(student_t *s);
+size_t format_student(char *dst, const student_t *s);
 int validate_range(int id, int gpa);
 int count_db_records(int fd);
 int print_db(int fd);
+int import_students(int fd, char *importFile);
+int run_batch(int fd, int in_fd);
+int rebuild_index(int fd);
+int verify_db(int fd);
+int db_layout(int fd);
+int load_students(int fd, id_table_t *table);
+int store_students(int fd, const int *ids, const student_t *images, size_t n);
+int print_stats(int fd);
+int report_stats(const db_stats_t *stats);
+int compare_student_id(const void *a, const void *b);
+int export_copy(int fd, const copy_ops_t *copy);
+int import_copy(int fd, const copy_ops_t *copy);
+int run_copy(const copy_ops_t *copy, char op, int id);
+
+int find_by_lname(int fd, char *prefix);
+int find_by_gpa(int fd, int lo, int hi);
+
+//secondary index prototypes for sdb_index.c
+int idx_open(char *dbFile, int db_fd, bool create);
+int idx_open_snapshot(char *dbFile, int db_fd, int64_t db_size);
+int idx_close(int db_fd);
+void idx_begin(void);
+void idx_add(const student_t *students, size_t n);
+void idx_remove(const student_t *s);
+int idx_rebuild(int db_fd);
+bool occ_valid(void);
+int occ_count(void);
+int occ_next(int id);
+bool sum_valid(void);
+uint32_t sum_get(int id);
+int sum_next(int id);
+int lname_find_prefix(const char *prefix, const lname_entry_t **first);
+int gpa_find_range(int lo, int hi, const gpa_entry_t **first);
+int gpa_histogram(int *hist);
+
+//write-ahead log prototypes for sdb_wal.c
+int wal_open(char *dbFile, bool truncate, bool writer);
+int wal_check(int db_fd);
+int wal_replay(int db_fd);
+int wal_log(off_t offset, const student_t *s);
+int wal_commit(void);
+int wal_checkpoint(int db_fd);
+int wal_settle(int db_fd, bool wait);
+int wal_close(int db_fd);
+
+//segmented database prototypes for sdb_segment.c
+int seg_open(char *dbFile, int db_fd, bool truncate);
+void seg_close(int db_fd);
+bool seg_active(int db_fd);
+int seg_count(void);
+int seg_max_id(void);
+ssize_t seg_read(void *buf, size_t len, off_t offset);
+ssize_t seg_write(const void *buf, size_t len, off_t offset);
+int seg_resize(off_t size);
+int seg_punch(off_t offset, off_t len);
+off_t seg_seek(off_t offset, int whence);
+int seg_sync(void);
+int seg_parallel(seg_part_fn part, void *arg);
+int seg_copy_file(int from, const char *to);
+int seg_backup(const char *dir);
+int seg_create(char *dbFile, const student_t *recs, size_t n);
+int seg_remove(char *dbFile);
+
+//id table prototypes for sdb_idtab.c
+int idtab_init(id_table_t *t, int max_id, size_t entry_size);
+void idtab_free(id_table_t *t);
+void *idtab_get(const id_table_t *t, int id);
+void *idtab_put(id_table_t *t, int id);
+int idtab_next(const id_table_t *t, int id);
+
+//checksum prototypes for sdb_crc.c
+uint32_t crc32c(const void *buf, size_t len);
+uint32_t student_sum(const student_t *s);
+
+//snapshot prototypes for sdb_snap.c
+int snap_open(char *dbFile, int db_fd, bool reader);
+void snap_close(int db_fd);
+bool snap_reading(int db_fd);
+off_t snap_size(void);
+bool snap_current(void);
+int snap_overlay(char *buf, off_t offset, size_t len);
+off_t snap_next_saved(off_t from, off_t to);
+int snap_begin(int db_fd);
+void snap_end(void);
+int snap_preserve(int db_fd, off_t offset, size_t len);
+
+//io_uring prototypes for sdb_uring.c
+int uring_rw(int fd, db_io_t *ios, size_t n, bool write);
+void uring_close(void);
+
+//compact copy prototypes for sdb_compact.c
+int compact_write(char *dbFile, int db_fd);
+int compact_open(char *dbFile);
+void compact_close(void);
+int compact_count(void);
+int compact_next(int id);
+int compact_get(int id, student_t *s);
+int compact_histogram(int *hist);
+extern const copy_ops_t compact_copy;
+
+//archive prototypes for sdb_archive.c and sdb_lz.c
+int archive_write(char *dbFile, int db_fd);
+int archive_open(char *dbFile);
+void archive_close(void);
+int archive_count(void);
+int archive_next(int id);
+int archive_get(int id, student_t *s);
+int archive_histogram(int *hist);
+extern const copy_ops_t archive_copy;
+size_t lz_compress(const unsigned char *src, size_t len, unsigned char *dst);
+ssize_t lz_decompress(const unsigned char *src, size_t len, unsigned char *dst, size_t cap);
+
+//server mode prototypes for sdb_server.c
+int run_server(int fd);
+int server_request(char op, const student_t *s);
 void usage(char *);
 
 //error codes to be returned from individual functions
@@ -25,6 +408,51 @@ void usage(char *);
 #define SRCH_NOT_FOUND  -3
 #define NOT_IMPLEMENTED_YET 0
 
+//database file layouts
+// DB_LAYOUT_POSITIONAL  every record lives at id * sizeof(student_t)
+// DB_LAYOUT_PACKED      legacy file with the valid records packed together,
+//                       lookups have to scan the file
+#define DB_LAYOUT_POSITIONAL 0
+#define DB_LAYOUT_PACKED     1
+
+//storage engines selectable with set_db_engine()
+// DB_ENGINE_FILEIO  records are moved with pread()/pwrite()
+// DB_ENGINE_MMAP    the file is memory mapped, see sync_db() for durability
+// DB_ENGINE_URING   like DB_ENGINE_FILEIO, batches of records are submitted
+//                   to io_uring together, see db_io_many()
+#define DB_ENGINE_FILEIO    0
+#define DB_ENGINE_MMAP      1
+#define DB_ENGINE_URING     2
+
+//access modes selectable with set_db_access(), they decide which fcntl()
+//locks a process takes on the database
+// DB_ACCESS_LOOKUP     shared session, records are locked slot by slot or
+//                      chunk by chunk for online compaction, the indexes are
+//                      not used
+// DB_ACCESS_READ       shared session, shares the index lock with other readers
+// DB_ACCESS_WRITE      shared session, records are written under a write lock
+//                      on their slot, holding the index lock alone only
+//                      while they are written
+// DB_ACCESS_EXCLUSIVE  holds the whole database alone, for zero, import,
+//                      index rebuilds and rewriting packed files
+// DB_ACCESS_SNAPSHOT   shared session, scans see the database as it was when
+//                      it was opened and writers never wait for them, only
+//                      the occupancy index is used, while it is unchanged
+#define DB_ACCESS_LOOKUP    0
+#define DB_ACCESS_READ      1
+#define DB_ACCESS_WRITE     2
+#define DB_ACCESS_EXCLUSIVE 3
+#define DB_ACCESS_SNAPSHOT  4
+
+//the lock bytes live past the last possible record slot, so they never
+//overlap the record locks.  Writers commit under DB_LOCK_SNAP, every open
+//snapshot holds the byte of its reader slot after it.  Adds and deletes
+//share DB_LOCK_WRITE, a -b batch holds it alone while it writes a run.
+#define DB_LOCK_SESSION     ((off_t)(SEG_MAX_STD_ID + 1) * sizeof(student_t))
+#define DB_LOCK_INDEX       (DB_LOCK_SESSION + 1)
+#define DB_LOCK_SNAP        (DB_LOCK_INDEX + 1)
+#define DB_LOCK_WRITE       (DB_LOCK_SNAP + 1 + SNAP_READERS)
+
 
 //error codes to be returned to the shell
 // EXIT_OK          program executed without error
@@ -53,6 +481,46 @@ void usage(char *);
 #define M_DB_EMPTY        "Database contains no student records.\n"
 #define M_DB_RECORD_CNT   "Database contains %d student record(s).\n"
 #define M_NOT_IMPL        "The requested operation is not implemented yet!\n"
+#define M_DB_IMPORTED     "%d student(s) imported into database.\n"
+#define M_ERR_IMPORT_OPEN "Error reading import file %s!\n"
+#define M_ERR_IMPORT_LINE "Skipping line %d, expected id,first_name,last_name,gpa.\n"
+#define M_ERR_IMPORT_RNG  "Skipping line %d, either ID or GPA out of allowable range.\n"
+#define M_IDX_VERIFIED    "Indexes verified, %d student record(s).\n"
+#define M_IDX_REBUILT     "Indexes rebuilt, %d student record(s).\n"
+#define M_ERR_IDX         "Error rebuilding indexes!\n"
+#define M_DB_VERIFIED     "Database verified, %d student record(s) match their checksums.\n"
+#define M_ERR_SUM_SLOT    "Slot %lld fails its checksum!\n"
+#define M_ERR_SUM_MISSING "Student %d is missing from the database!\n"
+#define M_ERR_DB_CORRUPT  "Database has %d corrupted record(s)!\n"
+#define M_ERR_NO_SUMS     "No valid record checksums, compute them with -r!\n"
+#define M_ERR_SNAP_OLD    "Snapshot given up, too much of the database changed while reading!\n"
+#define M_LNAME_NOT_FND   "No students with a last name starting with %s.\n"
+#define M_GPA_NOT_FND     "No students with a GPA between %.2f and %.2f.\n"
+#define M_STATS_GPA       "GPA min %.2f, max %.2f, mean %.2f, median %.2f\n"
+#define M_STATS_HIST_HDR  "%-6s %s\n"
+#define M_STATS_HIST_ROW  "%-6.2f %d\n"
+#define M_ERR_GPA_RNG     "Cant search GPA range, bounds out of allowable range!\n"
+#define M_SERVER_STARTED  "Serving %s on %s, stop with Ctrl-C.\n"
+#define M_SERVER_STOPPED  "Server stopped, all changes written.\n"
+#define M_ERR_SERVER      "Cant reach the database server, start one with -S!\n"
+#define M_ERR_SERVER_SOCK "Error creating the server socket, is a server running?\n"
+#define M_ERR_SERVER_OP   "The server only runs the a, c, d, f and p options!\n"
+#define M_ERR_IMPORT_DUP  "Skipping line %d, student with ID=%d already exists in db.\n"
+#define M_COMPACT_WRITTEN "Compact copy written, %d student record(s).\n"
+#define M_COMPACT_LOADED  "Database restored from the compact copy, %d student record(s).\n"
+#define M_ERR_COMPACT     "Error reading the compact copy, write one with -k!\n"
+#define M_ERR_COMPACT_OP  "The copies only run the c, f, k, p, s and u options!\n"
+#define M_ARCHIVE_WRITTEN "Archive written, %d student record(s).\n"
+#define M_ARCHIVE_LOADED  "Database restored from the archive, %d student record(s).\n"
+#define M_ERR_ARCHIVE     "Error reading the archive, write one with -A -k!\n"
+#define M_DB_SPLIT        "Database split into %d segment(s) of %d ids.\n"
+#define M_DB_JOINED       "Database joined into a single file.\n"
+#define M_DB_IS_SPLIT     "Database is already split into segments.\n"
+#define M_ERR_JOIN_IDS    "Cant join, the database holds ids past %d.\n"
+#define M_DB_NOT_SPLIT    "Database is not split into segments.\n"
+#define M_DB_BACKUP       "Database backed up to %s.\n"
+#define M_ERR_BACKUP      "Error writing the backup to %s!\n"
+#define M_ERR_BATCH_LINE  "Skipping line %d, expected a, c, d or f and its arguments.\n"
 
 //useful format strings for print students
 //For example to print the header in the required output:
@@ -6,6 +6,7 @@ setup_file() {
     if [ -f "student.db" ]; then
         rm "student.db"
     fi
+    rm -f student.db.*
 }
 
 @test "Check if database is empty to start" {
@@ -14,6 +15,14 @@ setup_file() {
     [ "$output" = "Database contains no student records." ]
 }
 
+@test "Reading commands create no sidecar files" {
+    ./sdbsc -c > /dev/null
+    ./sdbsc -f 1 > /dev/null || true
+    ./sdbsc -l doe > /dev/null || true
+    ./sdbsc -s > /dev/null || true
+    [ -z "$(ls student.db.* 2> /dev/null)" ]
+}
+
 @test "Add a student 1 to db" {
     run ./sdbsc -a 1      john doe 345
     [ "$status" -eq 0 ]
@@ -192,4 +201,722 @@ setup_file() {
         echo "Failed Output:  $output"
         return 1
     }
-}
\ No newline at end of file
+}
+
+@test "Find student in compressed db" {
+    run ./sdbsc -f 63
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "63 jim doe 2.85" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+}
+
+@test "Delete first student of compressed db" {
+    run ./sdbsc -d 1
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 1 was deleted from database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 3
+    [ "$status" -eq 0 ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Student id 0 is never found" {
+    run ./sdbsc -f 0
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 0 was not found in database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+}
+
+@test "Memory mapped engine reads the same database" {
+    run ./sdbsc -M -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -M -f 63
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "63 jim doe 2.85" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+}
+
+@test "Bulk import students from a csv file" {
+    printf '200,amy,pond,355\n63,dup,student,300\n201\trory\twilliams\t290\n7,bad,gpa,900\n' > import_test.csv
+    run ./sdbsc -i import_test.csv
+    rm -f import_test.csv
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Skipping line 2, student with ID=63 already exists in db." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[1]}" = "Skipping line 4, either ID or GPA out of allowable range." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+    [ "${lines[2]}" = "2 student(s) imported into database." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -f 201
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "201 rory williams 2.90" ] || {
+        echo "Failed Output:  $normalized_output"
+        return 1
+    }
+}
+
+@test "Adding a lower id does not shrink the file" {
+    run ./sdbsc -z
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -a 500 high id 300
+    [ "$status" -eq 0 ]
+    run ./sdbsc -a 10 low id 300
+    [ "$status" -eq 0 ]
+
+    run stat --format="%s" ./student.db
+    [ "${lines[0]}" = "32064" ] || {
+        echo "Failed Output:  $output"
+        echo "Expected: 32064"
+        return 1
+    }
+
+    run ./sdbsc -f 500
+    [ "$status" -eq 0 ]
+}
+
+@test "Indexes are verified and rebuilt" {
+    run ./sdbsc -r
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Indexes verified, 2 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    rm -f student.db.occ
+    run ./sdbsc -r
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Indexes rebuilt, 2 student record(s)." ] || {
+        echo "Failed Output:  $output"
+        return 1
+    }
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+}
+
+@test "Count answers from the occupancy index" {
+    ./sdbsc -a 40 ann low 300 > /dev/null
+    ./sdbsc -a 44 bob low 310 > /dev/null
+
+    # a record the index does not know about, a scan would count it
+    printf '\x2a\x00\x00\x00' | dd of=student.db bs=1 seek=$((42 * 64)) conv=notrunc 2> /dev/null
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 4 student record(s)." ]
+
+    dd if=/dev/zero of=student.db bs=1 seek=$((42 * 64)) count=4 conv=notrunc 2> /dev/null
+    ./sdbsc -d 40 > /dev/null
+    ./sdbsc -d 44 > /dev/null
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+}
+
+@test "Find students by last name prefix" {
+    run ./sdbsc -a 20 sam lowe 310
+    [ "$status" -eq 0 ]
+    run ./sdbsc -a 21 pat lower 320
+    [ "$status" -eq 0 ]
+
+    run ./sdbsc -l low
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 20 sam lowe 3.10 21 pat lower 3.20"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -d 20
+    run ./sdbsc -l lowe
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "21 pat lower 3.20" ] || {
+        echo "Failed Output: $normalized_output"
+        return 1
+    }
+
+    run ./sdbsc -l zz
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No students with a last name starting with zz." ]
+}
+
+@test "Find students by GPA range" {
+    run ./sdbsc -g 310 320
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 21 pat lower 3.20"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -g 300 500
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="ID FIRST NAME LAST_NAME GPA 10 low id 3.00 500 high id 3.00 21 pat lower 3.20"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    run ./sdbsc -g 400 300
+    [ "$status" -eq 2 ]
+}
+
+@test "GPA statistics" {
+    run ./sdbsc -s
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    expected_output="Database contains 3 student record(s). GPA min 3.00, max 3.20, mean 3.07, median 3.00 GPA COUNT 3.00 2 3.20 1"
+    [ "$normalized_output" = "$expected_output" ] || {
+        echo "Failed Output: $normalized_output"
+        echo "Expected Output: $expected_output"
+        return 1
+    }
+
+    # Same answer from a scan when the GPA index is gone
+    rm -f student.db.gpa
+    run ./sdbsc -s
+    normalized_output=$(echo -n "$output" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "$expected_output" ]
+    run ./sdbsc -r
+}
+
+# writes one 80 byte log record with the image of the slot at an offset
+wal_record() {
+    local hash=2166136261 image=""
+    local bytes="$(for i in 0 1 2 3 4 5 6 7; do echo $((($1 >> (8 * i)) & 255)); done)
+$(dd if=student.db bs=1 skip=$1 count=64 2> /dev/null | od -An -v -tu1)"
+    for b in $bytes; do
+        hash=$((((hash ^ b) * 16777619) & 0xffffffff))
+        image="$image\\x$(printf %02x $b)"
+    done
+    printf '\x31\x4c\x41\x57'
+    for i in 0 1 2 3; do printf "\\x$(printf %02x $(((hash >> (8 * i)) & 255)))"; done
+    printf "$image"
+}
+
+@test "Write-ahead log replays a lost write" {
+    run ./sdbsc -a 30 wal replay 280
+    [ "$status" -eq 0 ]
+
+    # the log is emptied once the add reached the database, so opens do
+    # not read it
+    [ ! -s student.db.wal ]
+
+    # Pretend the database write of student 30 never happened: the log
+    # has its image, the database has the slot empty
+    wal_record $((30 * 64)) > student.db.wal
+    dd if=/dev/zero of=student.db bs=64 seek=30 count=1 conv=notrunc 2> /dev/null
+    [ $(stat -c %s student.db.wal) -eq 80 ]
+
+    # A torn record at the tail is ignored
+    printf 'torn' >> student.db.wal
+
+    run ./sdbsc -f 30
+    [ "$status" -eq 0 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "30 wal replay 2.80" ]
+    [ ! -s student.db.wal ]
+
+    # The indexes were rebuilt after the replay
+    run ./sdbsc -l repl
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "30 wal replay 2.80" ]
+
+    run ./sdbsc -d 30
+    [ "$status" -eq 0 ]
+    [ ! -s student.db.wal ]
+}
+
+@test "Concurrent adds, deletes and lookups" {
+    for i in $(seq 40 59); do
+        ./sdbsc -a $i many writers 300 > /dev/null &
+        ./sdbsc -f 10 > /dev/null &
+    done
+    wait
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 23 student record(s)." ]
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes verified, 23 student record(s)." ]
+
+    for i in $(seq 40 59); do
+        ./sdbsc -d $i > /dev/null &
+        ./sdbsc -l writ > /dev/null &
+    done
+    wait
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes verified, 3 student record(s)." ]
+}
+
+@test "Writers add and delete next to an open batch" {
+    rm -f batch.fifo batch.out
+    mkfifo batch.fifo
+    ./sdbsc -b < batch.fifo > batch.out 3>&- &
+    batch=$!
+    exec 5> batch.fifo
+    echo "c" >&5
+    echo "a 62 in batch 330" >&5
+
+    # the batch has the database open and its add written once it answered
+    for i in $(seq 50); do
+        [ "$(wc -l < batch.out)" -ge 2 ] && break
+        sleep 0.1
+    done
+    run cat batch.out
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+    [ "${lines[1]}" = "Student 62 added to database." ]
+
+    # writers only hold the index lock while they write records, and the
+    # batch lets go of the write lock while it waits for input
+    run timeout 5 ./sdbsc -a 60 next door 310
+    [ "$status" -eq 0 ]
+    run timeout 5 ./sdbsc -a 61 next door 320
+    [ "$status" -eq 0 ]
+    run timeout 5 ./sdbsc -d 61
+    [ "$status" -eq 0 ]
+
+    echo "d 60" >&5
+    exec 5>&-
+    wait $batch
+    run cat batch.out
+    [ "${lines[1]}" = "Student 62 added to database." ]
+    [ "${lines[2]}" = "Student 60 was deleted from database." ]
+    rm -f batch.fifo batch.out
+
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes verified, 4 student record(s)." ]
+    run ./sdbsc -d 62
+    [ "$status" -eq 0 ]
+}
+
+@test "Compress punches holes for deleted records in place" {
+    seq 1024 1151 | awk '{print $1",hole,punch,300"}' > import_test.csv
+    run ./sdbsc -i import_test.csv
+    rm -f import_test.csv
+    [ "${lines[0]}" = "128 student(s) imported into database." ]
+
+    # Blank the records the way older versions deleted them
+    dd if=/dev/zero of=student.db bs=64 seek=1024 count=128 conv=notrunc 2> /dev/null
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes rebuilt, 3 student record(s)." ]
+    size_before=$(stat -c %s student.db)
+    blocks_before=$(du -B1 student.db | cut -f1)
+
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database successfully compressed!" ]
+
+    # Same file size, less storage, same students
+    [ $(stat -c %s student.db) -eq $size_before ]
+    [ $(du -B1 student.db | cut -f1) -lt $blocks_before ]
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes verified, 3 student record(s)." ]
+}
+
+@test "Deleting the last student of a block frees the block" {
+    blocks_before=$(du -B1 student.db | cut -f1)
+    seq 1024 1087 | awk '{print $1",hole,punch,300"}' > import_test.csv
+    run ./sdbsc -i import_test.csv
+    rm -f import_test.csv
+    [ $(du -B1 student.db | cut -f1) -gt $blocks_before ]
+
+    for i in $(seq 1024 1087); do
+        ./sdbsc -d $i > /dev/null
+    done
+    [ $(du -B1 student.db | cut -f1) -eq $blocks_before ]
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+}
+
+@test "Compress frees empty blocks that run up to the end of the file" {
+    rm -f student.db student.db.*
+    ./sdbsc -a 1 john doe 345 > /dev/null
+    seq 64 130 | awk '{print $1",hole,punch,300"}' > import_test.csv
+    run ./sdbsc -i import_test.csv
+    rm -f import_test.csv
+    [ "${lines[0]}" = "67 student(s) imported into database." ]
+
+    # Blanked the old way the students fill a whole block and end in a
+    # partial one, nothing after them closes the empty run
+    dd if=/dev/zero of=student.db bs=64 seek=64 count=67 conv=notrunc 2> /dev/null
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes rebuilt, 1 student record(s)." ]
+    blocks_before=$(du -B1 student.db | cut -f1)
+
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [ $(stat -c %s student.db) -eq $((131 * 64)) ]
+    [ $(du -B1 student.db | cut -f1) -lt $blocks_before ]
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 1 student record(s)." ]
+}
+
+# writes one 64 byte student record: id fname lname gpa
+packed_record() {
+    printf "\\x$(printf %02x $1)\\x00\\x00\\x00"
+    printf '%s' "$2"; head -c $((24 - ${#2})) /dev/zero
+    printf '%s' "$3"; head -c $((32 - ${#3})) /dev/zero
+    printf "\\x$(printf %02x $(($4 % 256)))\\x$(printf %02x $(($4 / 256)))\\x00\\x00"
+}
+
+@test "Compress rewrites a packed legacy file positionally" {
+    rm -f student.db student.db.*
+    { packed_record 7 ann lee 300; packed_record 3 bob ray 250; } > student.db
+
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+
+    run ./sdbsc -x
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database successfully compressed!" ]
+    [ $(stat -c %s student.db) -eq 512 ]
+
+    run ./sdbsc -f 3
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "3 bob ray 2.50" ]
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes verified, 2 student record(s)." ]
+}
+
+@test "Server mode answers clients from memory and writes back" {
+    ./sdbsc -S > /dev/null 3>&- &
+    server=$!
+    for i in $(seq 50); do
+        [ -S student.db.sock ] && break
+        sleep 0.1
+    done
+
+    run ./sdbsc -C -a 11 eve fox 375
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Student 11 added to database." ]
+    run ./sdbsc -C -a 11 eve fox 375
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Cant add student with ID=11, already exists in db." ]
+    run ./sdbsc -C -d 3
+    [ "${lines[0]}" = "Student 3 was deleted from database." ]
+    run ./sdbsc -C -f 11
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "11 eve fox 3.75" ]
+    run ./sdbsc -C -c
+    [ "${lines[0]}" = "Database contains 2 student record(s)." ]
+    run ./sdbsc -C -x
+    [ "$status" -eq 2 ]
+
+    kill -INT $server
+    wait $server
+    [ ! -e student.db.sock ]
+
+    run ./sdbsc -f 3
+    [ "$status" -eq 1 ]
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes verified, 2 student record(s)." ]
+}
+
+@test "Batch mode runs commands from stdin" {
+    run ./sdbsc -b <<'CMDS'
+a 20 ann lee 300
+-a 21 bob ray 250
+
+f 20
+d 21
+a 20 ann lee 300
+bogus 1
+c
+CMDS
+    [ "$status" -eq 2 ]
+    [ "${lines[0]}" = "Student 20 added to database." ]
+    [ "${lines[1]}" = "Student 21 added to database." ]
+    normalized_output=$(echo -n "${lines[3]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "20 ann lee 3.00" ]
+    [ "${lines[4]}" = "Student 21 was deleted from database." ]
+    [ "${lines[5]}" = "Cant add student with ID=20, already exists in db." ]
+    [ "${lines[6]}" = "Skipping line 7, expected a, c, d or f and its arguments." ]
+    [ "${lines[7]}" = "Database contains 3 student record(s)." ]
+}
+
+@test "Batch writes to the same id apply in order" {
+    run ./sdbsc -b <<'CMDS'
+a 22 cal moe 100
+d 22
+d 22
+a 22 cal moe 200
+f 22
+d 22
+CMDS
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Student 22 added to database." ]
+    [ "${lines[1]}" = "Student 22 was deleted from database." ]
+    [ "${lines[2]}" = "Student 22 was not found in database." ]
+    [ "${lines[3]}" = "Student 22 added to database." ]
+    normalized_output=$(echo -n "${lines[5]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "22 cal moe 2.00" ]
+    [ "${lines[6]}" = "Student 22 was deleted from database." ]
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes verified, 3 student record(s)." ]
+}
+
+@test "Printing a database spanning several scan blocks keeps id order" {
+    seq 1 50 100000 | awk '{print $1",first"$1",last"$1",300"}' > import_test.csv
+    run ./sdbsc -i import_test.csv
+    rm -f import_test.csv
+    [ "${lines[0]}" = "2000 student(s) imported into database." ]
+
+    run ./sdbsc -p
+    [ "${#lines[@]}" -eq 2004 ]
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "1 first1 last1 3.00" ]
+    normalized_output=$(echo -n "${lines[2003]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "99951 first99951 last99951 3.00" ]
+    ./sdbsc -p | tail -n +2 | awk '{print $1}' | sort -n -c
+
+    seq 1 50 100000 | sed 's/^/d /' | ./sdbsc -b > /dev/null
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+}
+
+@test "Compact copy answers like the database and restores it" {
+    run ./sdbsc -K -c
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Error reading the compact copy, write one with -k!" ]
+
+    expected=$(./sdbsc -p)
+    run ./sdbsc -k
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Compact copy written, 3 student record(s)." ]
+    [ $(stat -c %s student.db.hot) -eq $((21 * 12)) ]
+
+    [ "$(./sdbsc -K -p)" = "$expected" ]
+    [ "$(./sdbsc -K -s)" = "$(./sdbsc -s)" ]
+    run ./sdbsc -K -f 11
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "11 eve fox 3.75" ]
+    run ./sdbsc -K -d 11
+    [ "$status" -eq 2 ]
+
+    ./sdbsc -d 11 > /dev/null
+    run ./sdbsc -u
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database restored from the compact copy, 3 student record(s)." ]
+    [ "$(./sdbsc -p)" = "$expected" ]
+    run ./sdbsc -r
+    [ "${lines[0]}" = "Indexes verified, 3 student record(s)." ]
+    rm -f student.db.hot student.db.heap
+}
+
+@test "Archive answers like the database and restores it" {
+    run ./sdbsc -A -c
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Error reading the archive, write one with -A -k!" ]
+
+    expected=$(./sdbsc -p)
+    run ./sdbsc -A -k
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Archive written, 3 student record(s)." ]
+
+    [ "$(./sdbsc -A -p)" = "$expected" ]
+    [ "$(./sdbsc -A -s)" = "$(./sdbsc -s)" ]
+    [ "$(./sdbsc -A -c)" = "$(./sdbsc -c)" ]
+    run ./sdbsc -A -f 20
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "20 ann lee 3.00" ]
+    run ./sdbsc -A -f 12
+    [ "$status" -eq 1 ]
+
+    ./sdbsc -z > /dev/null
+    run ./sdbsc -A -u
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database restored from the archive, 3 student record(s)." ]
+    [ "$(./sdbsc -p)" = "$expected" ]
+    rm -f student.db.lz
+}
+
+@test "Print rows match the printf format at the column edges" {
+    ./sdbsc -a 8 abcdefghijklmnopqrstuvwxyz0123 lee 5 > /dev/null
+    ./sdbsc -a 9 bo abcdefghijklmnopqrstuvwxyz0123456789 500 > /dev/null
+    # the names are stored cut to their field, one byte short for the NUL
+    expected=$(printf "%-6d %-24.24s %-32.32s %-3.2f\n" \
+        8 abcdefghijklmnopqrstuvw lee 0.05 \
+        9 bo abcdefghijklmnopqrstuvwxyz01234 5.00)
+    [ "$(./sdbsc -p | grep -E '^[89] ')" = "$expected" ]
+    [ "$(./sdbsc -f 8 | tail -1)" = "$(echo "$expected" | head -1)" ]
+    ./sdbsc -d 8 > /dev/null
+    ./sdbsc -d 9 > /dev/null
+}
+
+@test "Split database answers like one file and joins back" {
+    expected=$(./sdbsc -p)
+    run ./sdbsc -e
+    [ "$status" -eq 0 ]
+    [[ "${lines[0]}" =~ ^Database\ split\ into\ [0-9]+\ segment\(s\)\ of\ 16384\ ids\.$ ]]
+    [ -f student.db.seg/manifest ]
+    [ $(stat -c %s student.db) -eq 0 ]
+    run ./sdbsc -e
+    [ "${lines[0]}" = "Database is already split into segments." ]
+
+    [ "$(./sdbsc -p)" = "$expected" ]
+    ./sdbsc -a 40000 kim park 350 > /dev/null
+    [ -f student.db.seg/00002 ]
+    run ./sdbsc -f 40000
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "40000 kim park 3.50" ]
+    ./sdbsc -d 40000 > /dev/null
+    ./sdbsc -x > /dev/null
+    [ "$(./sdbsc -p)" = "$expected" ]
+
+    run ./sdbsc -a 20000000 lee chan 310
+    [ "$status" -eq 0 ]
+    run ./sdbsc -f 20000000
+    normalized_output=$(echo -n "${lines[1]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "20000000 lee chan 3.10" ]
+    run ./sdbsc -v
+    [ "$status" -eq 0 ]
+    run ./sdbsc -j
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Cant join, the database holds ids past 100000." ]
+    [ -f student.db.seg/manifest ]
+    ./sdbsc -d 20000000 > /dev/null
+    [ "$(./sdbsc -p)" = "$expected" ]
+
+    rm -rf student.db.bak
+    run ./sdbsc -B student.db.bak
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database backed up to student.db.bak." ]
+    [ -f student.db.bak/student.db.seg/manifest ]
+
+    run ./sdbsc -j
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database joined into a single file." ]
+    [ ! -e student.db.seg ]
+    [ "$(./sdbsc -p)" = "$expected" ]
+    run ./sdbsc -j
+    [ "${lines[0]}" = "Database is not split into segments." ]
+    rm -rf student.db.bak
+}
+
+@test "Runs of batch lookups answer like single lookups, also through io_uring" {
+    expected=$(for id in 7 12 0 11 -3 20; do ./sdbsc -f $id; done)
+    cmds=$(printf 'f %s\n' 7 12 0 11 -3 20)
+    run ./sdbsc -b <<< "$cmds"
+    [ "$status" -eq 1 ]
+    [ "$output" = "$expected" ]
+    run ./sdbsc -U -b <<< "$cmds"
+    [ "$status" -eq 1 ]
+    [ "$output" = "$expected" ]
+
+    # lookups before and after a delete in the same batch
+    run ./sdbsc -U -b <<'CMDS'
+a 30 kim park 350
+f 30
+d 30
+f 30
+CMDS
+    [ "$status" -eq 1 ]
+    normalized_output=$(echo -n "${lines[2]}" | tr -s '[:space:]' ' ')
+    [ "$normalized_output" = "30 kim park 3.50" ]
+    [ "${lines[4]}" = "Student 30 was not found in database." ]
+}
+
+@test "Verify finds records that were damaged or lost" {
+    run ./sdbsc -v
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database verified, 3 student record(s) match their checksums." ]
+
+    # flip a byte of the last name of student 11 and zero the slot of 20
+    printf 'X' | dd of=student.db bs=1 seek=$((11 * 64 + 30)) conv=notrunc 2> /dev/null
+    dd if=/dev/zero of=student.db bs=64 seek=20 count=1 conv=notrunc 2> /dev/null
+    run ./sdbsc -v
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "Slot 11 fails its checksum!" ]
+    [ "${lines[1]}" = "Student 20 is missing from the database!" ]
+    [ "${lines[2]}" = "Database has 2 corrupted record(s)!" ]
+
+    ./sdbsc -d 11 > /dev/null
+    ./sdbsc -a 11 eve fox 375 > /dev/null
+    ./sdbsc -a 20 ann lee 300 > /dev/null
+    ./sdbsc -r > /dev/null
+
+    rm -f student.db.crc
+    run ./sdbsc -v
+    [ "$status" -eq 1 ]
+    [ "${lines[0]}" = "No valid record checksums, compute them with -r!" ]
+    ./sdbsc -r > /dev/null
+    run ./sdbsc -v
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database verified, 3 student record(s) match their checksums." ]
+}
+
+@test "Snapshot reads answer next to an open batch" {
+    rm -f batch.fifo
+    mkfifo batch.fifo
+    ./sdbsc -b < batch.fifo > /dev/null 3>&- &
+    batch=$!
+    exec 5> batch.fifo
+
+    run timeout 5 ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+
+    echo "a 30 kim park 350" >&5
+    for i in $(seq 50); do
+        ./sdbsc -f 30 > /dev/null && break
+        sleep 0.1
+    done
+    run ./sdbsc -f 30
+    [ "$status" -eq 0 ]
+
+    # the batch holds neither the write nor the commit lock while it waits
+    # for input, so readers and writers go on next to it
+    run timeout 5 ./sdbsc -c
+    [ "$status" -eq 0 ]
+    [ "${lines[0]}" = "Database contains 4 student record(s)." ]
+    run timeout 5 ./sdbsc -a 31 lee roe 360
+    [ "$status" -eq 0 ]
+    run timeout 5 ./sdbsc -d 31
+    [ "$status" -eq 0 ]
+
+    echo "d 30" >&5
+    exec 5>&-
+    wait $batch
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+    rm -f batch.fifo
+
+    # with no reader left the next write drops the saved blocks
+    ./sdbsc -d 11 > /dev/null
+    ./sdbsc -a 11 eve fox 375 > /dev/null
+    [ "$(stat -c %s student.db.snap)" -le 73728 ]
+    run ./sdbsc -c
+    [ "${lines[0]}" = "Database contains 3 student record(s)." ]
+}